@@ -0,0 +1,100 @@
+#include "artifactstore.h"
+#include <QCoreApplication>
+#include <QStringList>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace {
+QString errnoText() { return QString::fromLocal8Bit(std::strerror(errno)); }
+
+int createMemoryFile(const QString &name) {
+#ifdef MFD_ALLOW_SEALING
+    const int fd = memfd_create(name.toUtf8().constData(), MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd >= 0 || errno != ENOSYS) return fd;
+#endif
+    return ::open("/dev/shm", O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);}
+}
+
+ArtifactStore::ArtifactStore(QObject *parent) : QObject(parent) {
+    m_monitor.setInterval(250);
+    connect(&m_monitor, &QTimer::timeout, this, &ArtifactStore::checkQuota);}
+
+ArtifactStore::~ArtifactStore() {
+    clear();}
+
+bool ArtifactStore::create(const QString &name, int consumers, QString *error) {
+    close(name);
+    Artifact a;
+    a.fd = createMemoryFile(QLatin1String("artifact:") + name);
+    if (a.fd < 0) {
+        *error = QString("cannot create artifact '%1': %2").arg(name, errnoText());
+        return false;}
+    a.path = QString("/proc/%1/fd/%2").arg(QCoreApplication::applicationPid()).arg(a.fd);
+    a.refs = consumers;
+    m_artifacts.insert(name, a);
+    return true;}
+
+QString ArtifactStore::path(const QString &name) const {
+    return m_artifacts.value(name).path;}
+
+// Polls the size while a producer writes, so a runaway step is stopped long
+// before it exhausts RAM rather than after.
+void ArtifactStore::watch(const QString &name) {
+    m_writing = name;
+    m_monitor.start();}
+
+bool ArtifactStore::finishWrite(const QString &name, QString *error) {
+    if (m_writing == name) {
+        m_monitor.stop();
+        m_writing.clear();}
+    const auto it = m_artifacts.constFind(name);
+    if (it == m_artifacts.cend()) {
+        *error = QString("artifact '%1' no longer exists").arg(name);
+        return false;}
+    const qint64 total = totalSize();
+    if (total > m_quota) {
+        *error = QString("artifacts use %1 MB, over the %2 MB quota").arg(total >> 20).arg(m_quota >> 20);
+        close(name);
+        return false;}
+#ifdef F_ADD_SEALS
+    // Consumers get a read-only artifact; fails harmlessly on the /dev/shm fallback.
+    fcntl(it->fd, F_ADD_SEALS, F_SEAL_WRITE | F_SEAL_GROW | F_SEAL_SHRINK | F_SEAL_SEAL);
+#endif
+    return true;}
+
+void ArtifactStore::release(const QString &name) {
+    const auto it = m_artifacts.find(name);
+    if (it == m_artifacts.end()) return;
+    if (--it->refs <= 0) close(name);}
+
+void ArtifactStore::clear() {
+    m_monitor.stop();
+    m_writing.clear();
+    const QStringList names = m_artifacts.keys();
+    for (const QString &name : names) close(name);}
+
+qint64 ArtifactStore::sizeOf(const Artifact &a) {
+    struct stat st;
+    return fstat(a.fd, &st) == 0 ? st.st_size : 0;}
+
+qint64 ArtifactStore::totalSize() const {
+    qint64 total = 0;
+    for (const Artifact &a : m_artifacts) total += sizeOf(a);
+    return total;}
+
+void ArtifactStore::checkQuota() {
+    const qint64 total = totalSize();
+    if (total <= m_quota) return;
+    m_monitor.stop();
+    emit quotaExceeded(m_writing, total);}
+
+void ArtifactStore::close(const QString &name) {
+    const auto it = m_artifacts.find(name);
+    if (it == m_artifacts.end()) return;
+    ::close(it->fd);
+    m_artifacts.erase(it);
+    emit artifactClosed(name);}
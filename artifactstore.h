@@ -0,0 +1,47 @@
+#pragma once
+
+#include <QObject>
+#include <QHash>
+#include <QString>
+#include <QTimer>
+
+// Named in-memory files for one workflow run. Each artifact is a memfd (or an
+// unlinked /dev/shm file) reachable by child processes as /proc/<pid>/fd/N, so
+// a producer's stdout lands in it directly and consumers open the same pages
+// without copies. An artifact is closed once every consuming step is done, and
+// all of them when the run ends. The quota covers all live artifacts together.
+class ArtifactStore : public QObject {
+    Q_OBJECT
+public:
+    explicit ArtifactStore(QObject *parent = nullptr);
+    ~ArtifactStore();
+    void setQuota(qint64 bytes) { m_quota = bytes; }
+    qint64 quota() const { return m_quota; }
+    bool create(const QString &name, int consumers, QString *error);
+    QString path(const QString &name) const;
+    void watch(const QString &name);
+    bool finishWrite(const QString &name, QString *error);
+    void release(const QString &name);
+    void clear();
+    qint64 totalSize() const;
+
+signals:
+    void quotaExceeded(const QString &name, qint64 totalBytes);
+    void artifactClosed(const QString &name);
+
+private slots:
+    void checkQuota();
+
+private:
+    struct Artifact {
+        int fd = -1;
+        QString path;
+        int refs = 0;
+    };
+    QHash<QString, Artifact> m_artifacts;
+    QString m_writing;
+    QTimer m_monitor;
+    qint64 m_quota = 2048LL * 1024 * 1024;
+    static qint64 sizeOf(const Artifact &a);
+    void close(const QString &name);
+};
@@ -0,0 +1,181 @@
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QVector>
+#include <cstdio>
+#include <functional>
+#include <limits>
+#include "nlohmann/json.hpp"
+#include "jsonio.h"
+
+// Loads one generated workflow and one generated command store through the
+// three paths the application has used: JsonIO's SAX layer, a QJsonDocument
+// tree, and an nlohmann::json tree read through std::string. All three end in
+// the same structs (compiled WorkflowCmd steps, SystemCmd map), so the times
+// compare whole loads. Usage: shoot_commands_bench [steps] [commands] [runs]
+
+namespace {
+using json = nlohmann::json;
+
+QByteArray makeWorkflow(int steps) {
+    QByteArray out = "{\"priority\": 1, \"steps\": [\n";
+    for (int i = 0; i < steps; ++i) {
+        if (i > 0) out += ",\n";
+        out += QString("  {\"id\": \"step%1\", \"command\": \"echo 'step %1 of the generated workflow' > /tmp/bench-%1.log\", "
+                       "\"delayAfterMs\": %2, \"runAsRoot\": false, \"stopOnError\": %3, \"waitTimeoutMs\": 30000")
+                   .arg(i).arg(i % 7 * 100).arg(i % 3 ? "true" : "false").toUtf8();
+        if (i % 10 == 0) out += ", \"forEach\": [\"alpha\", \"beta\", \"gamma\"], \"maxParallel\": 2";
+        out += "}";}
+    out += "\n]}\n";
+    return out;}
+
+QByteArray makeCommandStore(int commands) {
+    QByteArray out = "{\n";
+    const int categories = qMax(1, commands / 200);
+    for (int c = 0; c < categories; ++c) {
+        if (c > 0) out += ",\n";
+        out += QString("  \"Category %1\": [\n").arg(c).toUtf8();
+        for (int i = c; i < commands; i += categories) {
+            if (i != c) out += ",\n";
+            out += QString("    {\"command\": \"systemctl status unit-%1.service --no-pager\", "
+                           "\"description\": \"Stan usługi unit-%1 (zażółć gęślą jaźń)\"}").arg(i).toUtf8();}
+        out += "\n  ]";}
+    out += "\n}\n";
+    return out;}
+
+bool compileStep(const QJsonObject &object, WorkflowPlan *plan) {
+    WorkflowStepKeys keys;
+    for (auto it = object.begin(); it != object.end(); ++it) keys.set(it.key(), it.value());
+    WorkflowCmd cmd;
+    QString error;
+    if (!WorkflowCmd::compile(keys, &cmd, &error)) return false;
+    plan->steps.append(std::move(cmd));
+    return true;}
+
+bool workflowViaQJsonDocument(const QByteArray &data, WorkflowPlan *plan) {
+    QJsonParseError parseError;
+    const QJsonDocument doc = QJsonDocument::fromJson(data, &parseError);
+    if (parseError.error != QJsonParseError::NoError) return false;
+    const QJsonObject root = doc.object();
+    plan->priority = root.value("priority").toInt();
+    const QJsonArray steps = root.value("steps").toArray();
+    for (const QJsonValue &step : steps) {
+        if (!compileStep(step.toObject(), plan)) return false;}
+    return true;}
+
+QJsonValue toQJsonValue(const json &value) {
+    switch (value.type()) {
+    case json::value_t::null:
+        return QJsonValue(QJsonValue::Null);
+    case json::value_t::boolean:
+        return QJsonValue(value.get<bool>());
+    case json::value_t::number_integer:
+        return QJsonValue(qint64(value.get<json::number_integer_t>()));
+    case json::value_t::number_unsigned: {
+        const json::number_unsigned_t v = value.get<json::number_unsigned_t>();
+        return v <= json::number_unsigned_t(std::numeric_limits<qint64>::max()) ? QJsonValue(qint64(v)) : QJsonValue(double(v));}
+    case json::value_t::number_float:
+        return QJsonValue(value.get<double>());
+    case json::value_t::string:
+        return QJsonValue(QString::fromStdString(value.get<std::string>()));
+    case json::value_t::array: {
+        QJsonArray items;
+        for (const json &item : value) items.append(toQJsonValue(item));
+        return items;}
+    case json::value_t::object: {
+        QJsonObject fields;
+        for (auto it = value.begin(); it != value.end(); ++it) fields.insert(QString::fromStdString(it.key()), toQJsonValue(it.value()));
+        return fields;}
+    default:
+        return QJsonValue(QJsonValue::Undefined);}}
+
+bool workflowViaNlohmannDom(const QByteArray &data, WorkflowPlan *plan) {
+    const json doc = json::parse(data.constBegin(), data.constEnd(), nullptr, false);
+    if (doc.is_discarded() || !doc.is_object()) return false;
+    plan->priority = doc.value("priority", 0);
+    const auto steps = doc.find("steps");
+    if (steps == doc.end() || !steps->is_array()) return false;
+    for (const json &step : *steps) {
+        if (!compileStep(toQJsonValue(step).toObject(), plan)) return false;}
+    return true;}
+
+bool storeViaQJsonDocument(const QByteArray &data, QMap<QString, QVector<SystemCmd>> *commands) {
+    QJsonParseError parseError;
+    const QJsonDocument doc = QJsonDocument::fromJson(data, &parseError);
+    if (parseError.error != QJsonParseError::NoError) return false;
+    const QJsonObject root = doc.object();
+    for (auto it = root.begin(); it != root.end(); ++it) {
+        QVector<SystemCmd> &list = (*commands)[it.key()];
+        const QJsonArray entries = it.value().toArray();
+        for (const QJsonValue &entry : entries) {
+            const QJsonObject object = entry.toObject();
+            list.append({object.value("command").toString(), object.value("description").toString()});}}
+    return true;}
+
+bool storeViaNlohmannDom(const QByteArray &data, QMap<QString, QVector<SystemCmd>> *commands) {
+    const json doc = json::parse(data.constBegin(), data.constEnd(), nullptr, false);
+    if (doc.is_discarded() || !doc.is_object()) return false;
+    for (auto it = doc.begin(); it != doc.end(); ++it) {
+        QVector<SystemCmd> &list = (*commands)[QString::fromStdString(it.key())];
+        for (const json &entry : it.value()) {
+            list.append({QString::fromStdString(entry.value("command", std::string())),
+                         QString::fromStdString(entry.value("description", std::string()))});}}
+    return true;}
+
+// Best of runs, in milliseconds; -1 when a run fails or loads a different count.
+double measure(int runs, qsizetype expected, const std::function<qsizetype()> &load) {
+    double best = -1;
+    for (int i = 0; i < runs; ++i) {
+        QElapsedTimer timer;
+        timer.start();
+        const qsizetype loaded = load();
+        const double ms = timer.nsecsElapsed() / 1e6;
+        if (loaded != expected) return -1;
+        if (best < 0 || ms < best) best = ms;}
+    return best;}
+
+void report(const char *path, double ms, qsizetype bytes) {
+    if (ms < 0) std::printf("  %-16s failed\n", path);
+    else std::printf("  %-16s %9.2f ms %8.1f MB/s\n", path, ms, bytes / 1048576.0 / (ms / 1000.0));}
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    const QStringList args = app.arguments();
+    const int steps = args.size() > 1 ? args.at(1).toInt() : 20000;
+    const int commands = args.size() > 2 ? args.at(2).toInt() : 100000;
+    const int runs = args.size() > 3 ? qMax(1, args.at(3).toInt()) : 5;
+
+    const QByteArray workflow = makeWorkflow(steps);
+    std::printf("workflow: %d steps, %.1f MB, best of %d\n", steps, workflow.size() / 1048576.0, runs);
+    report("JsonIO (SAX)", measure(runs, steps, [&]{
+        WorkflowPlan plan;
+        QString error;
+        return JsonIO::readWorkflow(workflow, &plan, &error) ? plan.steps.count() : -1;}), workflow.size());
+    report("QJsonDocument", measure(runs, steps, [&]{
+        WorkflowPlan plan;
+        return workflowViaQJsonDocument(workflow, &plan) ? plan.steps.count() : -1;}), workflow.size());
+    report("nlohmann DOM", measure(runs, steps, [&]{
+        WorkflowPlan plan;
+        return workflowViaNlohmannDom(workflow, &plan) ? plan.steps.count() : -1;}), workflow.size());
+
+    const QByteArray store = makeCommandStore(commands);
+    const auto count = [](const QMap<QString, QVector<SystemCmd>> &map) {
+        qsizetype n = 0;
+        for (const QVector<SystemCmd> &list : map) n += list.count();
+        return n;};
+    std::printf("command store: %d commands, %.1f MB, best of %d\n", commands, store.size() / 1048576.0, runs);
+    report("JsonIO (SAX)", measure(runs, commands, [&]{
+        QMap<QString, QVector<SystemCmd>> map;
+        QString error;
+        return JsonIO::readCommandStore(store, &map, &error) ? count(map) : -1;}), store.size());
+    report("QJsonDocument", measure(runs, commands, [&]{
+        QMap<QString, QVector<SystemCmd>> map;
+        return storeViaQJsonDocument(store, &map) ? count(map) : -1;}), store.size());
+    report("nlohmann DOM", measure(runs, commands, [&]{
+        QMap<QString, QVector<SystemCmd>> map;
+        return storeViaNlohmannDom(store, &map) ? count(map) : -1;}), store.size());
+    return 0;}
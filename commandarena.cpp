@@ -0,0 +1,63 @@
+#include "commandarena.h"
+#include <QHashFunctions>
+#include <algorithm>
+
+namespace {
+// A string is stored as its length in two units, then its units. No string
+// starts at a block's last unit, so NoId is never a valid id.
+constexpr qsizetype LengthUnits = 2;
+constexpr CommandArena::Id OffsetMask = (CommandArena::Id(1) << CommandArena::OffsetBits) - 1;
+constexpr qsizetype MaxBlocks = qsizetype(1) << (32 - CommandArena::OffsetBits);
+}
+
+CommandArena::View CommandArena::view() const {
+    View view;
+    view.m_blocks = m_blocks;
+    return view;}
+
+// Blocks a View still holds are freed with it.
+void CommandArena::clear() {
+    m_blocks.clear();
+    m_used = 0;
+    m_slots.clear();
+    m_count = 0;}
+
+QStringView CommandArena::text(const Blocks &blocks, Id id) {
+    const QChar *at = blocks[id >> OffsetBits].get() + (id & OffsetMask);
+    const qsizetype length = qsizetype(at[0].unicode()) | qsizetype(at[1].unicode()) << 16;
+    return QStringView(at + LengthUnits, length);}
+
+CommandArena::Id CommandArena::intern(QStringView text) {
+    if (m_count * 2 >= qsizetype(m_slots.size())) grow();
+    const size_t mask = m_slots.size() - 1;
+    for (size_t i = qHash(text) & mask;; i = (i + 1) & mask) {
+        if (m_slots[i] == NoId) {
+            m_slots[i] = append(text);
+            m_count++;
+            return m_slots[i];}
+        if (this->text(m_slots[i]) == text) return m_slots[i];}}
+
+// A string longer than a block gets a block of its own.
+CommandArena::Id CommandArena::append(QStringView text) {
+    const qsizetype units = LengthUnits + text.size();
+    if (m_blocks.empty() || m_used + units > BlockUnits) {
+        Q_ASSERT(qsizetype(m_blocks.size()) < MaxBlocks);
+        m_blocks.emplace_back(new QChar[std::max(units, BlockUnits)]);
+        m_used = 0;}
+    QChar *at = m_blocks.back().get() + m_used;
+    at[0] = QChar(char16_t(text.size() & 0xFFFF));
+    at[1] = QChar(char16_t(text.size() >> 16));
+    std::copy(text.begin(), text.end(), at + LengthUnits);
+    const Id id = Id(m_blocks.size() - 1) << OffsetBits | Id(m_used);
+    m_used += units;
+    return id;}
+
+void CommandArena::grow() {
+    std::vector<Id> slots(std::max<size_t>(1024, m_slots.size() * 2), NoId);
+    const size_t mask = slots.size() - 1;
+    for (const Id id : m_slots) {
+        if (id == NoId) continue;
+        size_t i = qHash(text(id)) & mask;
+        while (slots[i] != NoId) i = (i + 1) & mask;
+        slots[i] = id;}
+    m_slots = std::move(slots);}
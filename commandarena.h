@@ -0,0 +1,56 @@
+#pragma once
+
+#include <QChar>
+#include <QStringView>
+#include <QtGlobal>
+#include <memory>
+#include <vector>
+
+// The strings of the command store. Each distinct string is kept once, behind
+// its length, in fixed-size UTF-16 blocks that never move, and is addressed
+// by a stable id (block and offset), so a category is a vector of id pairs
+// and equal ids mean equal text. Strings are only dropped all at once, by
+// clear() or by replacing the arena with a fresh one. A View shares the blocks as they are: a worker thread can read the
+// strings interned before the view was taken while intern() appends more.
+class CommandArena {
+public:
+    using Id = quint32;
+    static constexpr int OffsetBits = 20;
+    static constexpr qsizetype BlockUnits = qsizetype(1) << OffsetBits;
+
+    class View {
+    public:
+        QStringView text(Id id) const { return CommandArena::text(m_blocks, id); }
+
+    private:
+        friend class CommandArena;
+        std::vector<std::shared_ptr<QChar[]>> m_blocks;
+    };
+
+    Id intern(QStringView text);
+    QStringView text(Id id) const { return text(m_blocks, id); }
+    View view() const;
+    qsizetype count() const { return m_count; }     // distinct strings interned
+    void clear();
+
+private:
+    using Blocks = std::vector<std::shared_ptr<QChar[]>>;
+    static constexpr Id NoId = ~Id(0);
+    Blocks m_blocks;
+    qsizetype m_used = 0;       // units taken in the last block
+    std::vector<Id> m_slots;    // open addressing over the ids; NoId is free
+    qsizetype m_count = 0;
+
+    static QStringView text(const Blocks &blocks, Id id);
+    Id append(QStringView text);
+    void grow();
+};
+
+// A command of the store as its two interned strings.
+struct CommandRef {
+    CommandArena::Id command = 0;
+    CommandArena::Id description = 0;
+    bool operator==(const CommandRef &other) const { return command == other.command && description == other.description; }
+    bool operator!=(const CommandRef &other) const { return !(*this == other); }
+};
+Q_DECLARE_TYPEINFO(CommandRef, Q_PRIMITIVE_TYPE);
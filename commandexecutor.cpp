@@ -1,49 +1,445 @@
 #include "commandexecutor.h"
+#include "processsupervisor.h"
+#include "rootbroker.h"
+#include "spawnhelper.h"
 #include <QByteArray>
+#include <QThread>
+#include <csignal>
 
-CommandExecutor::CommandExecutor(QObject *parent) : QObject(parent) {}
+namespace {
+// Every executor's processes live on one shared thread, started with the first
+// executor and joined when the last one is destroyed (all on the GUI thread).
+QThread *s_thread = nullptr;
+int s_threadUsers = 0;
+ProcessSupervisor *s_supervisor = nullptr;
+RootBroker *s_broker = nullptr;
 
+QThread *acquireThread() {
+    if (s_threadUsers++ == 0) {
+        s_thread = new QThread;
+        s_thread->setObjectName("CommandExecutor");
+        s_thread->start();
+    }
+    return s_thread;
+}
+
+// Shared by all EpollBackend executors; deleted with the thread.
+ProcessSupervisor *supervisor() {
+    if (!s_supervisor) {
+        s_supervisor = new ProcessSupervisor;
+        s_supervisor->moveToThread(s_thread);
+    }
+    return s_supervisor;
+}
+
+void releaseThread() {
+    if (--s_threadUsers > 0) return;
+    if (s_supervisor) {
+        s_supervisor->deleteLater();
+        s_supervisor = nullptr;
+    }
+    s_thread->quit();
+    s_thread->wait();
+    delete s_thread;
+    s_thread = nullptr;
+}
+}
+
+void ProcessChannel::post(ProcessEvent event) {
+    queue.push(std::move(event));
+    // One queued wake-up per batch; the receiver clears the flag before draining.
+    if (!notifyPending.exchange(true, std::memory_order_acq_rel)) {
+        QMetaObject::invokeMethod(receiver, "drainEvents", Qt::QueuedConnection);
+    }
+}
+
+void ProcessWorker::start(quint64 run, const QString &program, const QStringList &args, const ProcessRedirects &redirects) {
+    QProcess *p = new QProcess(this);
+    m_process = p;
+    connect(p, &QProcess::readyReadStandardOutput, this, [this, p, run]{
+        const QByteArray data = p->readAllStandardOutput();
+        if (!data.isEmpty()) m_channel->post({ProcessEvent::Stdout, run, QString::fromUtf8(data)});
+    });
+    connect(p, &QProcess::readyReadStandardError, this, [this, p, run]{
+        const QByteArray data = p->readAllStandardError();
+        if (!data.isEmpty()) m_channel->post({ProcessEvent::Stderr, run, QString::fromUtf8(data)});
+    });
+    connect(p, &QProcess::started, this, [this, run]{
+        m_channel->post({ProcessEvent::Started, run});
+    });
+    connect(p, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), this,
+            [this, p, run](int exitCode, QProcess::ExitStatus exitStatus){
+        m_channel->post({ProcessEvent::Finished, run, QString(), exitCode, exitStatus});
+        if (m_process == p) m_process = nullptr;
+        p->deleteLater();
+    });
+    // QProcess does not emit finished() for a process that never started.
+    connect(p, &QProcess::errorOccurred, this, [this, p, run](QProcess::ProcessError error){
+        if (error != QProcess::FailedToStart) return;
+        m_channel->post({ProcessEvent::FailedToStart, run, p->errorString()});
+        if (m_process == p) m_process = nullptr;
+        p->deleteLater();
+    });
+    // Redirected channels are wired to the files by the child itself, so their
+    // bytes never pass through this process.
+    const QIODevice::OpenMode mode = redirects.append ? QIODevice::Append : QIODevice::Truncate;
+    if (redirects.mergeStderr) p->setProcessChannelMode(QProcess::MergedChannels);
+    if (!redirects.stdinFile.isEmpty()) p->setStandardInputFile(redirects.stdinFile);
+    if (!redirects.stdoutFile.isEmpty()) p->setStandardOutputFile(redirects.stdoutFile, mode);
+    if (!redirects.stderrFile.isEmpty()) p->setStandardErrorFile(redirects.stderrFile, mode);
+    p->start(program, args);
+}
+
+// Stage i writes straight into stage i + 1 through a kernel pipe, so a slow
+// consumer throttles its producer and nothing is buffered in this process.
+void ProcessWorker::startPipeline(quint64 run, const QList<PipelineStage> &stages) {
+    auto pipeline = std::make_shared<Pipeline>();
+    const int n = stages.count();
+    pipeline->run = run;
+    pipeline->exitCodes = QList<int>(n, 0);
+    pipeline->crashed = QList<bool>(n, false);
+    pipeline->done = QList<bool>(n, false);
+    pipeline->pending = n;
+    m_pipeline = pipeline;
+    for (int i = 0; i < n; ++i) pipeline->processes.append(new QProcess(this));
+    for (int i = 0; i < n; ++i) {
+        QProcess *p = pipeline->processes.at(i);
+        if (i + 1 < n) {
+            p->setStandardOutputProcess(pipeline->processes.at(i + 1));
+        } else {
+            connect(p, &QProcess::readyReadStandardOutput, this, [this, p, run]{
+                const QByteArray data = p->readAllStandardOutput();
+                if (!data.isEmpty()) m_channel->post({ProcessEvent::Stdout, run, QString::fromUtf8(data)});
+            });
+            connect(p, &QProcess::started, this, [this, run]{
+                m_channel->post({ProcessEvent::Started, run});
+            });
+        }
+        connect(p, &QProcess::readyReadStandardError, this, [this, p, run]{
+            const QByteArray data = p->readAllStandardError();
+            if (!data.isEmpty()) m_channel->post({ProcessEvent::Stderr, run, QString::fromUtf8(data)});
+        });
+        connect(p, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), this,
+                [this, pipeline, i](int exitCode, QProcess::ExitStatus exitStatus){
+            stageFinished(pipeline, i, exitCode, exitStatus);
+        });
+        connect(p, &QProcess::errorOccurred, this, [this, pipeline, i, p, run](QProcess::ProcessError error){
+            if (error != QProcess::FailedToStart) return;
+            m_channel->post({ProcessEvent::Stderr, run, QString("Pipeline stage %1 failed to start: %2").arg(i + 1).arg(p->errorString())});
+            stageFinished(pipeline, i, 127, QProcess::NormalExit);
+        });
+    }
+    // Consumers first, so every reader exists before its producer writes.
+    for (int i = n - 1; i >= 0; --i) {
+        pipeline->processes.at(i)->start(stages.at(i).program, stages.at(i).args);
+    }
+}
+
+void ProcessWorker::stageFinished(const std::shared_ptr<Pipeline> &pipeline, int stage, int exitCode, QProcess::ExitStatus status) {
+    if (pipeline->done.at(stage)) return;
+    pipeline->done[stage] = true;
+    pipeline->exitCodes[stage] = exitCode;
+    pipeline->crashed[stage] = status == QProcess::CrashExit;
+    if (--pipeline->pending > 0) return;
+    const int last = pipeline->exitCodes.count() - 1;
+    // A producer killed by SIGPIPE after its reader exited normally is the
+    // usual end of `producer | head`, not a failure. On a crash QProcess gives
+    // the signal as the exit code; any other signal stays a failure.
+    for (int i = 0; i <= last; ++i) {
+        if (!pipeline->crashed.at(i)) continue;
+        const bool brokenPipe = i < last && !pipeline->crashed.at(i + 1) && pipeline->exitCodes.at(i) == SIGPIPE;
+        pipeline->exitCodes[i] = brokenPipe ? 0 : -1;
+    }
+    int result = 0;
+    for (int i = last; i >= 0 && result == 0; --i) result = pipeline->exitCodes.at(i);
+    ProcessEvent event{ProcessEvent::Finished, pipeline->run, QString(), result, QProcess::NormalExit};
+    event.stageExitCodes = pipeline->exitCodes;
+    m_channel->post(std::move(event));
+    releasePipeline(pipeline);
+}
+
+void ProcessWorker::releasePipeline(const std::shared_ptr<Pipeline> &pipeline) {
+    for (QProcess *p : pipeline->processes) {
+        disconnect(p, nullptr, this, nullptr);
+        p->deleteLater();
+    }
+    pipeline->processes.clear();
+    if (m_pipeline == pipeline) m_pipeline.reset();
+}
+
+void ProcessWorker::stop() {
+    if (std::shared_ptr<Pipeline> pipeline = m_pipeline) {
+        for (QProcess *p : pipeline->processes) {
+            if (p->state() != QProcess::NotRunning) p->kill();
+        }
+        // The last stage to finish posts Finished and releases the pipeline.
+        for (int i = 0; i < pipeline->processes.count(); ++i) pipeline->processes.at(i)->waitForFinished(1000);
+        releasePipeline(pipeline);
+    }
+    QProcess *p = m_process;
+    if (!p) return;
+    if (p->state() != QProcess::NotRunning) {
+        p->kill();
+        p->waitForFinished(1000);
+    }
+    if (m_process == p) {
+        m_process = nullptr;
+        disconnect(p, nullptr, this, nullptr);
+        p->deleteLater();
+    }
+}
+
+// The process keeps running and its output is still posted, but the executor
+// no longer treats it as its current run.
+void ProcessWorker::detach() {
+    m_process = nullptr;
+    m_pipeline.reset();
+}
+
+// Every process but the current ones was detached; finished() still cleans each up.
+void ProcessWorker::killDetached() {
+    const QList<QProcess *> processes = findChildren<QProcess *>();
+    for (QProcess *p : processes) {
+        if (p == m_process || (m_pipeline && m_pipeline->processes.contains(p))) continue;
+        if (p->state() != QProcess::NotRunning) p->kill();
+    }
+}
+
+void ProcessWorker::shutdown() {
+    const QList<QProcess *> processes = findChildren<QProcess *>();
+    for (QProcess *p : processes) {
+        disconnect(p, nullptr, this, nullptr);
+        if (p->state() != QProcess::NotRunning) {
+            p->kill();
+            p->waitForFinished(1000);
+        }
+        delete p;
+    }
+    m_process = nullptr;
+    m_pipeline.reset();
+}
+
+CommandExecutor::Backend CommandExecutor::defaultBackend() {
+    return SpawnHelper::isRunning() ? EpollBackend : QProcessBackend;
+}
+
+CommandExecutor::CommandExecutor(QObject *parent, Backend backend)
+    : QObject(parent), m_channel(std::make_shared<ProcessChannel>()), m_backend(backend) {
+    m_channel->receiver = this;
+    QThread *thread = acquireThread();
+    if (m_backend == QProcessBackend) {
+        m_worker = new ProcessWorker(m_channel);
+        m_worker->moveToThread(thread);
+    }
+}
+
+// Nothing is posted to this object once shutdown/release has returned.
 CommandExecutor::~CommandExecutor() {
     stop();
+    if (m_worker) {
+        QMetaObject::invokeMethod(m_worker, &ProcessWorker::shutdown, Qt::BlockingQueuedConnection);
+        m_worker->deleteLater();
+    } else {
+        ProcessSupervisor *sup = supervisor();
+        ProcessChannel *channel = m_channel.get();
+        QMetaObject::invokeMethod(sup, [sup, channel]{ sup->release(channel); }, Qt::BlockingQueuedConnection);
+    }
+    if (s_broker) {
+        RootBroker *broker = s_broker;
+        ProcessChannel *channel = m_channel.get();
+        QMetaObject::invokeMethod(broker, [broker, channel]{ broker->release(channel); }, Qt::BlockingQueuedConnection);
+    }
+    releaseThread();
 }
 
 void CommandExecutor::runSystemCommand(const QString &program, const QStringList &args) {
     stop();
-    m_process = new QProcess(this);
-    connect(m_process, &QProcess::readyReadStandardOutput, this, &CommandExecutor::readStdOut);
-    connect(m_process, &QProcess::readyReadStandardError, this, &CommandExecutor::readStdErr);
-    connect(m_process, &QProcess::started, this, &CommandExecutor::onStarted);
-    connect(m_process, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
-            this, &CommandExecutor::onFinished);
-    m_process->start(program, args);
+    const quint64 run = ++m_lastRun;
+    const ProcessRedirects redirects = m_redirects;
+    m_redirects = ProcessRedirects();
+    m_currentRun = run;
+    m_running = true;
+    m_viaBroker = false;
+    m_program = program;
+    if (m_worker) {
+        ProcessWorker *worker = m_worker;
+        QMetaObject::invokeMethod(worker, [worker, run, program, args, redirects]{
+            worker->start(run, program, args, redirects);
+        }, Qt::QueuedConnection);
+    } else {
+        ProcessSupervisor *sup = supervisor();
+        std::shared_ptr<ProcessChannel> channel = m_channel;
+        QMetaObject::invokeMethod(sup, [sup, channel, run, program, args, redirects]{
+            sup->start(channel, run, program, args, redirects);
+        }, Qt::QueuedConnection);
+    }
+}
+
+void CommandExecutor::runPipeline(const QList<PipelineStage> &stages) {
+    Q_ASSERT(m_worker);
+    stop();
+    const quint64 run = ++m_lastRun;
+    m_currentRun = run;
+    m_running = true;
+    m_viaBroker = false;
+    m_program = QStringLiteral("pipeline");
+    m_stageExitCodes.clear();
+    ProcessWorker *worker = m_worker;
+    QMetaObject::invokeMethod(worker, [worker, run, stages]{
+        worker->startPipeline(run, stages);
+    }, Qt::QueuedConnection);
+}
+
+void CommandExecutor::runShellCommand(const QString &command, bool asRoot) {
+    if (!asRoot || !s_broker || !RootBroker::isReady() || !m_redirects.isEmpty()) {
+        QString program;
+        QStringList args;
+        shellInvocation(command, asRoot, &program, &args);
+        runSystemCommand(program, args);
+        return;
+    }
+    stop();
+    const quint64 run = ++m_lastRun;
+    m_currentRun = run;
+    m_running = true;
+    m_viaBroker = true;
+    m_program = QStringLiteral("root helper");
+    RootBroker *broker = s_broker;
+    std::shared_ptr<ProcessChannel> channel = m_channel;
+    QMetaObject::invokeMethod(broker, [broker, channel, run, command]{
+        broker->start(channel, run, command);
+    }, Qt::QueuedConnection);
+}
+
+void CommandExecutor::shellInvocation(const QString &command, bool asRoot, QString *program, QStringList *args) {
+    args->clear();
+    if (asRoot) {
+        *program = "/usr/bin/sudo";
+        *args << "-n" << "bash" << "-c" << command;
+    } else {
+        *program = "/bin/bash";
+        *args << "-c" << command;
+    }
+}
+
+// The broker holds a reference on the executor thread until it is disabled.
+RootBroker *CommandExecutor::enableRootBroker() {
+    if (!s_broker) {
+        QThread *thread = acquireThread();
+        s_broker = new RootBroker;
+        s_broker->moveToThread(thread);
+        QMetaObject::invokeMethod(s_broker, &RootBroker::launch, Qt::QueuedConnection);
+    }
+    return s_broker;
 }
 
+// Runs still in the broker finish as crashed.
+void CommandExecutor::disableRootBroker() {
+    if (!s_broker) return;
+    QMetaObject::invokeMethod(s_broker, &RootBroker::shutdown, Qt::BlockingQueuedConnection);
+    s_broker->deleteLater();
+    s_broker = nullptr;
+    releaseThread();
+}
+
+// Synchronous like before the worker thread: when stop() returns the process
+// is gone and its last output and finished() have been delivered.
 void CommandExecutor::stop() {
-    if (!m_process) return;
-    if (m_process->state() == QProcess::Running) {
-        m_process->kill();
-        m_process->waitForFinished(1000);
+    if (!m_running) return;
+    if (m_viaBroker) {
+        if (RootBroker *broker = s_broker) {
+            ProcessChannel *channel = m_channel.get();
+            QMetaObject::invokeMethod(broker, [broker, channel]{ broker->stop(channel); }, Qt::BlockingQueuedConnection);
+        }
+    } else if (m_worker) {
+        QMetaObject::invokeMethod(m_worker, &ProcessWorker::stop, Qt::BlockingQueuedConnection);
+    } else {
+        ProcessSupervisor *sup = supervisor();
+        ProcessChannel *channel = m_channel.get();
+        QMetaObject::invokeMethod(sup, [sup, channel]{ sup->stop(channel); }, Qt::BlockingQueuedConnection);
     }
-    m_process->deleteLater();
-    m_process = nullptr;
+    drainEvents();
+    m_currentRun = 0;
+    m_running = false;
 }
 
-void CommandExecutor::readStdOut() {
-    if (!m_process) return;
-    const QByteArray data = m_process->readAllStandardOutput();
-    if (!data.isEmpty()) emit outputReceived(QString::fromUtf8(data));
+void CommandExecutor::detach() {
+    if (!m_running) return;
+    if (m_viaBroker) {
+        if (RootBroker *broker = s_broker) {
+            ProcessChannel *channel = m_channel.get();
+            QMetaObject::invokeMethod(broker, [broker, channel]{ broker->detach(channel); }, Qt::QueuedConnection);
+        }
+    } else if (m_worker) {
+        QMetaObject::invokeMethod(m_worker, &ProcessWorker::detach, Qt::QueuedConnection);
+    } else {
+        ProcessSupervisor *sup = supervisor();
+        ProcessChannel *channel = m_channel.get();
+        QMetaObject::invokeMethod(sup, [sup, channel]{ sup->detach(channel); }, Qt::QueuedConnection);
+    }
+    m_currentRun = 0;
+    m_running = false;
 }
 
-void CommandExecutor::readStdErr() {
-    if (!m_process) return;
-    const QByteArray data = m_process->readAllStandardError();
-    if (!data.isEmpty()) emit errorReceived(QString::fromUtf8(data));
+void CommandExecutor::killDetached() {
+    if (m_worker) {
+        QMetaObject::invokeMethod(m_worker, &ProcessWorker::killDetached, Qt::QueuedConnection);
+    } else {
+        ProcessSupervisor *sup = supervisor();
+        ProcessChannel *channel = m_channel.get();
+        QMetaObject::invokeMethod(sup, [sup, channel]{ sup->killDetached(channel); }, Qt::QueuedConnection);
+    }
+    if (RootBroker *broker = s_broker) {
+        ProcessChannel *channel = m_channel.get();
+        QMetaObject::invokeMethod(broker, [broker, channel]{ broker->killDetached(channel); }, Qt::QueuedConnection);
+    }
 }
 
-void CommandExecutor::onStarted() {
-    emit started();
+// Events are moved into m_pending first so a slot that re-enters (e.g. calls
+// stop()) continues from the same ordered list. Adjacent chunks of the same
+// stream are merged, so a GUI that fell behind appends a few large blocks
+// instead of thousands of small ones.
+void CommandExecutor::drainEvents() {
+    m_channel->notifyPending.exchange(false, std::memory_order_acq_rel);
+    ProcessEvent event;
+    while (m_channel->queue.pop(&event)) m_pending.append(std::move(event));
+    while (!m_pending.isEmpty()) {
+        ProcessEvent next = m_pending.takeFirst();
+        if (next.kind == ProcessEvent::Stdout || next.kind == ProcessEvent::Stderr) {
+            while (!m_pending.isEmpty() && m_pending.first().kind == next.kind && m_pending.first().run == next.run
+                   && next.text.size() < 65536) {
+                next.text += m_pending.takeFirst().text;
+            }
+        }
+        dispatch(next);
+    }
 }
 
-void CommandExecutor::onFinished(int exitCode, QProcess::ExitStatus exitStatus) {
-    emit finished(exitCode, exitStatus);
+void CommandExecutor::dispatch(const ProcessEvent &event) {
+    const bool current = m_currentRun != 0 && event.run == m_currentRun;
+    switch (event.kind) {
+    case ProcessEvent::Stdout:
+        if (current) emit outputReceived(event.text);
+        break;
+    case ProcessEvent::Stderr:
+        if (current) emit errorReceived(event.text);
+        break;
+    case ProcessEvent::Started:
+        if (current) emit started();
+        break;
+    case ProcessEvent::Finished:
+        if (!current) break;
+        m_currentRun = 0;
+        m_running = false;
+        m_stageExitCodes = event.stageExitCodes;
+        emit finished(event.exitCode, event.exitStatus);
+        break;
+    case ProcessEvent::FailedToStart:
+        if (!current) break;
+        m_currentRun = 0;
+        m_running = false;
+        emit errorReceived(QString("Failed to start %1: %2").arg(m_program, event.text));
+        emit finished(-1, QProcess::CrashExit);
+        break;
+    }
 }
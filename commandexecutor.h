@@ -3,15 +3,113 @@
 #include <QObject>
 #include <QProcess>
 #include <QStringList>
+#include <QList>
+#include <atomic>
+#include <memory>
+#include "spscqueue.h"
+
+// File redirections for one run; an empty path keeps the pipe to this object.
+struct ProcessRedirects {
+    QString stdinFile;
+    QString stdoutFile;
+    QString stderrFile;
+    bool append = false;        // open output files in append mode
+    bool mergeStderr = false;   // stderr follows stdout
+    bool isEmpty() const { return stdinFile.isEmpty() && stdoutFile.isEmpty() && stderrFile.isEmpty() && !mergeStderr; }
+};
+
+// One process of a pipeline; its stdout feeds the next stage's stdin.
+struct PipelineStage {
+    QString program;
+    QStringList args;
+};
+
+// One entry handed from the executor thread to the GUI thread.
+struct ProcessEvent {
+    enum Kind { Started, Stdout, Stderr, Finished, FailedToStart };
+    Kind kind = Started;
+    quint64 run = 0;
+    QString text;
+    int exitCode = 0;
+    QProcess::ExitStatus exitStatus = QProcess::NormalExit;
+    QList<int> stageExitCodes;  // Finished of a pipeline: one code per stage
+};
+
+// Events of one CommandExecutor. Producers (the executor thread) call post();
+// the receiver drains on its own thread.
+struct ProcessChannel {
+    SpscQueue<ProcessEvent> queue;
+    std::atomic<bool> notifyPending{false};
+    QObject *receiver = nullptr;
+    void post(ProcessEvent event);
+};
+
+// Owns the QProcess objects of one CommandExecutor on the shared executor
+// thread, so pipes are drained even while the GUI thread is busy painting.
+class ProcessWorker : public QObject {
+    Q_OBJECT
+public:
+    explicit ProcessWorker(std::shared_ptr<ProcessChannel> channel) : m_channel(std::move(channel)) {}
+    void start(quint64 run, const QString &program, const QStringList &args, const ProcessRedirects &redirects);
+    void startPipeline(quint64 run, const QList<PipelineStage> &stages);
+    void stop();
+    void detach();
+    void killDetached();
+    void shutdown();
+
+private:
+    struct Pipeline {
+        quint64 run = 0;
+        QList<QProcess *> processes;
+        QList<int> exitCodes;
+        QList<bool> crashed;
+        QList<bool> done;
+        int pending = 0;
+    };
+    std::shared_ptr<ProcessChannel> m_channel;
+    QProcess *m_process = nullptr;
+    std::shared_ptr<Pipeline> m_pipeline;
+    void stageFinished(const std::shared_ptr<Pipeline> &pipeline, int stage, int exitCode, QProcess::ExitStatus status);
+    void releasePipeline(const std::shared_ptr<Pipeline> &pipeline);
+};
+
+class RootBroker;
 
 class CommandExecutor : public QObject {
     Q_OBJECT
 
 public:
-    explicit CommandExecutor(QObject *parent = nullptr);
+    // QProcessBackend: one QProcess per run. EpollBackend: children are spawned
+    // directly and share one epoll loop (see ProcessSupervisor); stdin is /dev/null.
+    enum Backend { QProcessBackend, EpollBackend };
+    // EpollBackend while the spawn helper runs, so no spawn forks the GUI process.
+    static Backend defaultBackend();
+    explicit CommandExecutor(QObject *parent = nullptr, Backend backend = defaultBackend());
     ~CommandExecutor();
     void runSystemCommand(const QString &program, const QStringList &args);
+    // `bash -c command`, as root through the root broker when it is ready and
+    // no file redirects are set, otherwise through `sudo -n`.
+    void runShellCommand(const QString &command, bool asRoot);
+    // Runs the stages concurrently, each stdout piped into the next stdin, on
+    // the executor thread; stderr of every stage and stdout of the last are
+    // forwarded. finished() follows pipefail and stageExitCodes() holds every
+    // stage's code. QProcessBackend only.
+    void runPipeline(const QList<PipelineStage> &stages);
     void stop();
+    // The run keeps going but is no longer this executor's: its output and
+    // exit are dropped, and killDetached() ends it.
+    void detach();
+    void killDetached();
+    // Applies to the next runSystemCommand only.
+    void setRedirects(const ProcessRedirects &redirects) { m_redirects = redirects; }
+    bool isRunning() const { return m_running; }
+    Backend backend() const { return m_backend; }
+    // Of the last finished pipeline; empty after a single command.
+    const QList<int> &stageExitCodes() const { return m_stageExitCodes; }
+    static void shellInvocation(const QString &command, bool asRoot, QString *program, QStringList *args);
+    // Starts the shared root broker (once); connect to its stateChanged() for progress.
+    static RootBroker *enableRootBroker();
+    static void disableRootBroker();
 
 signals:
     void outputReceived(const QString &text);
@@ -20,11 +118,19 @@ signals:
     void finished(int exitCode, QProcess::ExitStatus exitStatus);
 
 private slots:
-    void readStdOut();
-    void readStdErr();
-    void onStarted();
-    void onFinished(int exitCode, QProcess::ExitStatus exitStatus);
+    void drainEvents();
 
 private:
-    QProcess *m_process = nullptr;
+    std::shared_ptr<ProcessChannel> m_channel;
+    Backend m_backend;
+    ProcessWorker *m_worker = nullptr;
+    ProcessRedirects m_redirects;
+    quint64 m_lastRun = 0;
+    quint64 m_currentRun = 0;   // 0 once the run finished, was stopped or detached
+    bool m_running = false;
+    bool m_viaBroker = false;   // the current run was handed to the root broker
+    QString m_program;
+    QList<int> m_stageExitCodes;
+    QList<ProcessEvent> m_pending;
+    void dispatch(const ProcessEvent &event);
 };
@@ -0,0 +1,54 @@
+#include "commandlistmodel.h"
+
+// After a compaction every id differs, so no row can be told unchanged by
+// its ids.
+CommandListModel::CommandListModel(CommandStore *store, QObject *parent)
+    : QAbstractTableModel(parent), m_store(store) {
+    connect(m_store, &CommandStore::stringsMoved, this, [this]{ update(true); });}
+
+// An empty category also lets go of the ids before the store is reloaded.
+void CommandListModel::setCategory(const QString &category) {
+    beginResetModel();
+    m_category = category;
+    m_rows = category.isEmpty() ? QVector<CommandRef>() : m_store->commands(category);
+    endResetModel();}
+
+void CommandListModel::refresh() {
+    update(false);}
+
+void CommandListModel::update(bool idsMoved) {
+    if (m_category.isEmpty()) return;
+    const QVector<CommandRef> rows = m_store->commands(m_category);
+    const int before = int(m_rows.size());
+    const int after = int(rows.size());
+    int first = 0;
+    int last = qMin(before, after) - 1;
+    if (!idsMoved) {
+        while (first <= last && m_rows.at(first) == rows.at(first)) first++;
+        while (last >= first && m_rows.at(last) == rows.at(last)) last--;}
+    if (after > before) beginInsertRows(QModelIndex(), before, after - 1);
+    else if (after < before) beginRemoveRows(QModelIndex(), after, before - 1);
+    m_rows = rows;
+    if (after > before) endInsertRows();
+    else if (after < before) endRemoveRows();
+    if (first <= last) emit dataChanged(index(first, 0), index(last, 1));}
+
+QString CommandListModel::command(int row) const {
+    return m_store->text(m_rows.at(row).command).toString();}
+
+QString CommandListModel::description(int row) const {
+    return m_store->text(m_rows.at(row).description).toString();}
+
+int CommandListModel::rowCount(const QModelIndex &parent) const {
+    return parent.isValid() ? 0 : int(m_rows.size());}
+
+int CommandListModel::columnCount(const QModelIndex &parent) const {
+    return parent.isValid() ? 0 : 2;}
+
+QVariant CommandListModel::data(const QModelIndex &index, int role) const {
+    if (role != Qt::DisplayRole || !index.isValid() || index.row() >= m_rows.size()) return QVariant();
+    return index.column() == 0 ? command(index.row()) : description(index.row());}
+
+QVariant CommandListModel::headerData(int section, Qt::Orientation orientation, int role) const {
+    if (role != Qt::DisplayRole || orientation != Qt::Horizontal) return QVariant();
+    return section == 0 ? QStringLiteral("Command") : QStringLiteral("Description");}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <QAbstractTableModel>
+#include <QString>
+#include <QVector>
+#include "commandstore.h"
+
+// The Commands dock: the selected category's commands, read from the
+// CommandStore. Selecting a category shares the store's vector of string ids
+// instead of copying it, and a cell becomes a QString only when the view
+// (or the filter proxy) asks for it.
+class CommandListModel : public QAbstractTableModel {
+    Q_OBJECT
+public:
+    explicit CommandListModel(CommandStore *store, QObject *parent = nullptr);
+    void setCategory(const QString &category);
+    // Takes the category's commands again and updates only the rows that
+    // differ, so the view keeps its selection and scroll position. Also done
+    // on the store's stringsMoved(), with every row counted as changed.
+    void refresh();
+    QString command(int row) const;
+    QString description(int row) const;
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+private:
+    CommandStore *m_store;
+    QString m_category;
+    QVector<CommandRef> m_rows;
+    void update(bool idsMoved);
+};
@@ -0,0 +1,683 @@
+#include "commandstore.h"
+#include "jsonio.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QHash>
+#include <QSaveFile>
+#include <QSet>
+#include <QStandardPaths>
+#include <QtConcurrent/QtConcurrentRun>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+namespace {
+// Written in native byte order; a snapshot from another architecture fails
+// the version check and is rebuilt from the JSON.
+constexpr char SnapshotMagic[8] = {'S', 'C', 'S', 'N', 'A', 'P', '0', '1'};
+constexpr quint32 SnapshotVersion = 1;
+
+struct SnapshotHeader {
+    char magic[8];
+    quint32 version;
+    quint32 categoryCount;
+    quint64 entryCount;
+    quint64 stringUnits;        // UTF-16 units in the string table
+    qint64 sourceSize;
+    qint64 sourceModified;      // ms since the epoch
+    char sourceHash[20];        // SHA-1 of the JSON
+    char reserved[4];
+};
+// String offsets and lengths are in UTF-16 units.
+struct SnapshotCategory { quint32 name, nameLength, firstEntry, entryCount; };
+struct SnapshotEntry { quint32 command, commandLength, description, descriptionLength; };
+static_assert(sizeof(SnapshotHeader) == 72 && sizeof(SnapshotCategory) == 16 && sizeof(SnapshotEntry) == 16,
+              "snapshot tables must stay packed");
+
+const SnapshotHeader *header(const uchar *map) {
+    return reinterpret_cast<const SnapshotHeader *>(map);}
+const SnapshotCategory *categoryTable(const uchar *map) {
+    return reinterpret_cast<const SnapshotCategory *>(map + sizeof(SnapshotHeader));}
+const SnapshotEntry *entryTable(const uchar *map) {
+    return reinterpret_cast<const SnapshotEntry *>(categoryTable(map) + header(map)->categoryCount);}
+const QChar *stringTable(const uchar *map) {
+    return reinterpret_cast<const QChar *>(entryTable(map) + header(map)->entryCount);}
+
+QString journalPath(const QString &source) {
+    return source + QStringLiteral(".journal");}
+
+// Category names may hold any character; '%' and '/' are escaped in file
+// names, as is a leading '.', so no category is written to a dotfile. Only
+// the empty name still is (".json"), hence hidden files are listed too.
+QString shardPath(const QString &dir, const QString &category) {
+    QString name = category;
+    name.replace('%', QLatin1String("%25")).replace('/', QLatin1String("%2F"));
+    if (name.startsWith('.')) name.replace(0, 1, QLatin1String("%2E"));
+    return QDir(dir).absoluteFilePath(name + QLatin1String(".json"));}
+
+QStringList listShards(const QString &dir) {
+    QStringList categories;
+    for (QString name : QDir(dir).entryList({QStringLiteral("*.json")}, QDir::Files | QDir::Hidden)) {
+        name.chop(5);
+        if (name.startsWith(QLatin1String("%2E"), Qt::CaseInsensitive)) name.replace(0, 3, QLatin1Char('.'));
+        categories.append(name.replace(QLatin1String("%2F"), QLatin1String("/"), Qt::CaseInsensitive).replace(QLatin1String("%25"), QLatin1String("%")));}
+    return categories;}
+
+QString snapshotPath(const QString &source) {
+    const QByteArray key = QCryptographicHash::hash(QFileInfo(source).absoluteFilePath().toUtf8(), QCryptographicHash::Sha1).toHex().left(16);
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath(QString("commands-%1.snapshot").arg(QString::fromLatin1(key)));}
+
+// Checks every table bound once, so reading a category later cannot run off the map.
+bool validSnapshot(const uchar *map, qint64 size) {
+    if (size < qint64(sizeof(SnapshotHeader))) return false;
+    const SnapshotHeader *h = header(map);
+    if (std::memcmp(h->magic, SnapshotMagic, sizeof(SnapshotMagic)) != 0 || h->version != SnapshotVersion) return false;
+    if (h->categoryCount > quint64(size) || h->entryCount > quint64(size) || h->stringUnits > quint64(size)) return false;
+    if (sizeof(SnapshotHeader) + h->categoryCount * sizeof(SnapshotCategory) + h->entryCount * sizeof(SnapshotEntry)
+            + h->stringUnits * sizeof(QChar) != quint64(size)) {
+        return false;}
+    const auto fits = [h](quint64 at, quint64 length) { return at + length <= h->stringUnits; };
+    for (quint32 i = 0; i < h->categoryCount; ++i) {
+        const SnapshotCategory &c = categoryTable(map)[i];
+        if (!fits(c.name, c.nameLength) || quint64(c.firstEntry) + c.entryCount > h->entryCount) return false;}
+    for (quint64 i = 0; i < h->entryCount; ++i) {
+        const SnapshotEntry &e = entryTable(map)[i];
+        if (!fits(e.command, e.commandLength) || !fits(e.description, e.descriptionLength)) return false;}
+    return true;}
+
+// Best effort: without a snapshot the next start simply reads the JSON.
+QByteArray contentHash(const QByteArray &json) {
+    return QCryptographicHash::hash(json, QCryptographicHash::Sha1);}
+
+// Interned strings are written once; entries that share one share its offset.
+void writeSnapshot(const QString &source, const QByteArray &hash, const QMap<QString, QVector<CommandRef>> &commands,
+                   const CommandArena::View &strings) {
+    QVector<SnapshotCategory> categories;
+    QVector<SnapshotEntry> entries;
+    QString table;
+    QHash<CommandArena::Id, quint32> offsets;
+    qsizetype entryCount = 0;
+    for (const QVector<CommandRef> &refs : commands) entryCount += refs.size();
+    categories.reserve(commands.size());
+    entries.reserve(entryCount);
+    bool fits = true;
+    const auto add = [&](QStringView text, quint32 *at, quint32 *length) {
+        *at = quint32(table.size());
+        *length = quint32(text.size());
+        table += text;
+        fits = fits && quint64(table.size()) <= std::numeric_limits<quint32>::max();};
+    const auto addId = [&](CommandArena::Id id, quint32 *at, quint32 *length) {
+        const auto known = offsets.constFind(id);
+        if (known != offsets.cend()) {
+            *at = known.value();
+            *length = quint32(strings.text(id).size());
+            return;}
+        add(strings.text(id), at, length);
+        offsets.insert(id, *at);};
+    for (auto it = commands.cbegin(); it != commands.cend() && fits; ++it) {
+        SnapshotCategory category;
+        add(it.key(), &category.name, &category.nameLength);
+        category.firstEntry = quint32(entries.size());
+        category.entryCount = quint32(it.value().size());
+        categories.append(category);
+        for (const CommandRef &cmd : it.value()) {
+            SnapshotEntry entry;
+            addId(cmd.command, &entry.command, &entry.commandLength);
+            addId(cmd.description, &entry.description, &entry.descriptionLength);
+            entries.append(entry);}}
+    if (!fits) return;
+    const QFileInfo info(source);
+    SnapshotHeader h = {};
+    std::memcpy(h.magic, SnapshotMagic, sizeof(SnapshotMagic));
+    h.version = SnapshotVersion;
+    h.categoryCount = quint32(categories.size());
+    h.entryCount = quint64(entries.size());
+    h.stringUnits = quint64(table.size());
+    h.sourceSize = info.size();
+    h.sourceModified = info.lastModified().toMSecsSinceEpoch();
+    std::memcpy(h.sourceHash, hash.constData(), sizeof(h.sourceHash));
+    const QString path = snapshotPath(source);
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) return;
+    file.write(reinterpret_cast<const char *>(&h), sizeof(h));
+    file.write(reinterpret_cast<const char *>(categories.constData()), categories.size() * qsizetype(sizeof(SnapshotCategory)));
+    file.write(reinterpret_cast<const char *>(entries.constData()), entries.size() * qsizetype(sizeof(SnapshotEntry)));
+    file.write(reinterpret_cast<const char *>(table.constData()), table.size() * qsizetype(sizeof(QChar)));
+    file.commit();}
+}
+
+CommandStore::CommandStore(QObject *parent) : QObject(parent) {
+    m_quietTimer.setSingleShot(true);
+    m_quietTimer.setInterval(QuietMs);
+    connect(&m_quietTimer, &QTimer::timeout, this, &CommandStore::startWrite);
+    // Categories that failed to write stay dirty and journal lines that
+    // failed stay unwritten; both are retried after another quiet period.
+    connect(&m_write, &QFutureWatcherBase::finished, this, [this]{
+        const WriteResult result = m_write.result();
+        bool pending = !m_queued.isEmpty() || !result.error.isEmpty();
+        for (const Category &category : std::as_const(m_categories)) pending = pending || category.dirty;
+        finishWrite(result);
+        if (pending && !m_quietTimer.isActive()) m_quietTimer.start();});
+    // Files replaced by a rename drop out of the watcher; the directory
+    // notices the new one.
+    m_reloadTimer.setSingleShot(true);
+    m_reloadTimer.setInterval(ReloadDelayMs);
+    connect(&m_reloadTimer, &QTimer::timeout, this, &CommandStore::checkSource);
+    connect(&m_read, &QFutureWatcherBase::finished, this, [this]{ finishRead(m_read.result()); });
+    // Deferred, so ids never change under a caller of commands().
+    m_compactTimer.setSingleShot(true);
+    m_compactTimer.setInterval(0);
+    connect(&m_compactTimer, &QTimer::timeout, this, &CommandStore::compactStrings);
+    const auto changed = [this]{
+        const QFileInfo info(m_path);
+        if (!m_sharded && info.exists() && !m_watcher.files().contains(info.absoluteFilePath())) m_watcher.addPath(info.absoluteFilePath());
+        m_reloadTimer.start();};
+    connect(&m_watcher, &QFileSystemWatcher::fileChanged, this, changed);
+    connect(&m_watcher, &QFileSystemWatcher::directoryChanged, this, changed);}
+
+CommandStore::~CommandStore() {
+    sync();}
+
+bool CommandStore::load(const QString &path, QString *error) {
+    sync();
+    m_generation++;
+    closeSnapshot();
+    m_categories.clear();
+    m_strings.clear();
+    m_journal.reset();
+    m_path = path;
+    m_sharded = QFileInfo(path).isDir();
+    watch();
+    if (m_sharded) {
+        for (const QString &name : listShards(path)) m_categories[name].inShard = true;
+        return true;}
+    if (!mapSnapshot(path)) {
+        QFile file(path);
+        if (!file.open(QIODevice::ReadOnly)) {
+            *error = "Cannot open file.";
+            return false;}
+        const QByteArray json = file.readAll();
+        file.close();
+        QMap<QString, QVector<SystemCmd>> commands;
+        if (!JsonIO::readCommandStore(json, &commands, error)) return false;
+        const QByteArray hash = contentHash(json);
+        const QMap<QString, QVector<CommandRef>> refs = useJson(hash, commands);
+        writeSnapshot(path, hash, refs, m_strings.view());}
+    // A read-only store still loads; only change() fails then.
+    QString journalError;
+    openJournal(true, &journalError);
+    return true;}
+
+bool CommandStore::save(const QString &path, QString *error) {
+    sync();
+    m_generation++;
+    if (m_sharded && path == m_path) {
+        for (auto it = m_categories.cbegin(); it != m_categories.cend(); ++it) {
+            if (!it->dirty) continue;
+            *error = QString("Cannot write the file of category '%1'.").arg(it.key());
+            return false;}
+        return true;}
+    QString unread;
+    const QMap<QString, QVector<CommandRef>> commands = all(&unread);
+    if (!unread.isEmpty()) {
+        *error = unread;
+        return false;}
+    if (QFileInfo(path).isDir()) {
+        const WriteResult result = writeShards(path, commands, m_strings.view());
+        if (!result.error.isEmpty()) {
+            *error = result.error;
+            return false;}
+        m_journal.reset();
+        m_jsonHash.clear();
+        for (auto it = m_categories.begin(); it != m_categories.end(); ++it) {
+            it->shardHash = result.shardHashes.value(it.key());
+            it->lastUsed = 0;}
+        m_sharded = true;
+        m_path = path;
+        evictShards(QString());
+        watch();
+        return true;}
+    const QByteArray json = JsonIO::writeCommandStore(commands, m_strings.view());
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size() || !file.commit()) {
+        *error = file.errorString();
+        return false;}
+    m_jsonHash = contentHash(json);
+    writeSnapshot(path, m_jsonHash, commands, m_strings.view());
+    if (m_path != path || m_sharded) {
+        m_sharded = false;
+        m_path = path;
+        watch();}
+    return openJournal(false, error);}
+
+void CommandStore::reset(const QStringList &categories) {
+    sync();
+    m_generation++;
+    closeSnapshot();
+    m_categories.clear();
+    m_strings.clear();
+    m_journal.reset();
+    m_jsonHash.clear();
+    m_sharded = false;
+    for (const QString &name : categories) m_categories.insert(name, Category());}
+
+// GUI thread, with what readSource() parsed. The snapshot is written by a
+// write task like the others.
+void CommandStore::reload(const SourceRead &source, QStringList *changed) {
+    sync();
+    const QMap<QString, Category> old = m_categories;
+    const QMap<QString, QVector<CommandRef>> refs = useJson(source.hash, source.commands);
+    m_write.setFuture(QtConcurrent::run([path = m_path, hash = m_jsonHash, refs, strings = m_strings.view()]{
+        writeSnapshot(path, hash, refs, strings);
+        return WriteResult();}));
+    QString journalError;
+    openJournal(true, &journalError);
+    // Categories never shown were not read from the old snapshot; they are
+    // only reported when they appear or disappear.
+    for (auto it = old.cbegin(); it != old.cend(); ++it) {
+        const auto now = m_categories.find(it.key());
+        if (now == m_categories.end() || (it->snapshotIndex < 0 && now->commands != it->commands)) changed->append(it.key());}
+    for (auto it = m_categories.cbegin(); it != m_categories.cend(); ++it) {
+        if (!old.contains(it.key())) changed->append(it.key());}
+    m_compactTimer.start();}
+
+// Strings are interned into the arena as it is, so a reload gives unchanged
+// commands their old ids. Returns what the snapshot is written from.
+QMap<QString, QVector<CommandRef>> CommandStore::useJson(const QByteArray &hash, const QMap<QString, QVector<SystemCmd>> &commands) {
+    closeSnapshot();
+    m_categories.clear();
+    QMap<QString, QVector<CommandRef>> refs;
+    for (auto it = commands.cbegin(); it != commands.cend(); ++it) refs.insert(it.key(), m_categories[it.key()].commands = intern(it.value()));
+    m_jsonHash = hash;
+    return refs;}
+
+void CommandStore::watch() {
+    if (!m_watcher.files().isEmpty()) m_watcher.removePaths(m_watcher.files());
+    if (!m_watcher.directories().isEmpty()) m_watcher.removePaths(m_watcher.directories());
+    const QFileInfo info(m_path);
+    if (m_sharded) {
+        m_watcher.addPath(info.absoluteFilePath());
+        for (auto it = m_categories.cbegin(); it != m_categories.cend(); ++it) {
+            if (!it->inShard && QFileInfo::exists(shardPath(m_path, it.key()))) m_watcher.addPath(shardPath(m_path, it.key()));}
+        return;}
+    if (info.absoluteDir().exists()) m_watcher.addPath(info.absolutePath());
+    if (info.exists()) m_watcher.addPath(info.absoluteFilePath());}
+
+// The JSON is read, hashed and parsed on a worker (readSource()); only
+// interning and the diff run here, in finishRead().
+void CommandStore::checkSource() {
+    if (m_write.isRunning() || m_read.isRunning()) {
+        m_reloadTimer.start();
+        return;}
+    if (m_sharded) {
+        checkShards();
+        return;}
+    m_read.setFuture(QtConcurrent::run(&CommandStore::readSource, m_path, m_jsonHash, m_generation));}
+
+// Worker thread. Our own writes end with m_jsonHash matching the file, as
+// does a rewrite with the same content, so only a real change is parsed.
+CommandStore::SourceRead CommandStore::readSource(const QString &path, const QByteArray &knownHash, quint64 generation) {
+    SourceRead source;
+    source.generation = generation;
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return source;
+    const QByteArray json = file.readAll();
+    file.close();
+    source.hash = contentHash(json);
+    if (source.hash == knownHash) return source;
+    source.changed = true;
+    if (!JsonIO::readCommandStore(json, &source.commands, &source.error)) source.commands.clear();
+    return source;}
+
+// A load(), save() or reset() since the read started may have moved the
+// store elsewhere or already taken this content.
+void CommandStore::finishRead(const SourceRead &source) {
+    if (!source.changed || m_sharded || source.generation != m_generation || source.hash == m_jsonHash) return;
+    if (!source.error.isEmpty()) {
+        emit reloadFailed(source.error);
+        return;}
+    QStringList changed;
+    reload(source, &changed);
+    emit reloaded(changed);}
+
+// Categories whose file appeared or went away are reported, as are those
+// already read whose file now differs from what was read or written here.
+// Categories with edits not yet written keep them.
+void CommandStore::checkShards() {
+    QStringList changed;
+    const QStringList listed = listShards(m_path);
+    const QSet<QString> names(listed.cbegin(), listed.cend());
+    for (const QString &name : listed) {
+        if (m_categories.contains(name)) continue;
+        m_categories[name].inShard = true;
+        changed.append(name);}
+    const QStringList watched = m_watcher.files();
+    for (auto it = m_categories.begin(); it != m_categories.end();) {
+        if (it->dirty) {
+            ++it;
+            continue;}
+        if (!names.contains(it.key())) {
+            changed.append(it.key());
+            it = m_categories.erase(it);
+            continue;}
+        const QString path = shardPath(m_path, it.key());
+        QFile file(path);
+        if (it->inShard || !file.open(QIODevice::ReadOnly)) {
+            ++it;
+            continue;}
+        if (!watched.contains(path)) m_watcher.addPath(path);
+        const QByteArray json = file.readAll();
+        file.close();
+        const QByteArray hash = contentHash(json);
+        if (hash != it->shardHash) {
+            QVector<SystemCmd> commands;
+            QString error;
+            if (JsonIO::readCommandShard(json, &commands, &error)) {
+                const QVector<CommandRef> refs = intern(commands);
+                if (refs != it->commands) changed.append(it.key());
+                it->commands = refs;
+                it->shardHash = hash;
+            } else {
+                emit reloadFailed(QString("%1: %2").arg(path, error));}}
+        ++it;}
+    if (changed.isEmpty()) return;
+    m_compactTimer.start();
+    emit reloaded(changed);}
+
+bool CommandStore::change(const CommandChange &change, QString *error) {
+    if (m_sharded) {
+        Category &category = m_categories[change.category];
+        if (!materialize(change.category, category, error)) return false;
+        apply(change);
+        category.dirty = true;
+        m_quietTimer.start();
+        m_compactTimer.start();
+        return true;}
+    if (!m_journal) {
+        *error = "The command store has no journal open.";
+        return false;}
+    apply(change);
+    m_queued += JsonIO::writeCommandChange(change);
+    m_journalRecords++;
+    m_quietTimer.start();
+    m_compactTimer.start();
+    return true;}
+
+const QVector<CommandRef> &CommandStore::commands(const QString &category) {
+    static const QVector<CommandRef> none;
+    const auto it = m_categories.find(category);
+    if (it == m_categories.end()) return none;
+    QString error;
+    if (!materialize(it.key(), it.value(), &error)) emit categoryFailed(error);
+    evictShards(it.key());
+    return it->commands;}
+
+// Reads every category, sharded or not; error names a category file that
+// cannot be read.
+QMap<QString, QVector<CommandRef>> CommandStore::all(QString *error) {
+    QMap<QString, QVector<CommandRef>> commands;
+    for (auto it = m_categories.begin(); it != m_categories.end(); ++it) {
+        QString failed;
+        if (!materialize(it.key(), it.value(), &failed) && error) *error = failed;
+        commands.insert(it.key(), it->commands);}
+    closeSnapshot();
+    return commands;}
+
+CommandRef CommandStore::intern(const SystemCmd &cmd) {
+    return {m_strings.intern(cmd.command), m_strings.intern(cmd.description)};}
+
+QVector<CommandRef> CommandStore::intern(const QVector<SystemCmd> &commands) {
+    QVector<CommandRef> refs;
+    refs.reserve(commands.size());
+    for (const SystemCmd &cmd : commands) refs.append(intern(cmd));
+    return refs;}
+
+// Only called for categories that can be read: those in the snapshot, or
+// one change() already read.
+void CommandStore::apply(const CommandChange &change) {
+    Category &category = m_categories[change.category];
+    QString ignored;
+    materialize(change.category, category, &ignored);
+    QVector<CommandRef> &commands = category.commands;
+    const CommandRef cmd = intern(change.cmd);
+    const CommandRef replacement = intern(change.replacement);
+    const qsizetype at = commands.indexOf(cmd);
+    switch (change.kind) {
+    case CommandChange::Add:
+        if (at < 0) commands.append(cmd);
+        break;
+    case CommandChange::Remove:
+        if (at >= 0) commands.removeAt(at);
+        break;
+    case CommandChange::Replace:
+        if (replacement == cmd) break;
+        if (commands.contains(replacement)) {
+            if (at >= 0) commands.removeAt(at);
+        } else if (at >= 0) {
+            commands[at] = replacement;
+        } else {
+            commands.append(replacement);}
+        break;}}
+
+// replay: apply what the journal holds, skipping lines that do not parse,
+// such as one torn by a crash mid-append; otherwise start it empty.
+bool CommandStore::openJournal(bool replay, QString *error) {
+    auto journal = std::make_shared<Journal>();
+    journal->file.setFileName(journalPath(m_path));
+    m_journalRecords = 0;
+    bool torn = false;
+    if (replay) {
+        QFile in(journal->file.fileName());
+        if (in.open(QIODevice::ReadOnly)) {
+            while (!in.atEnd()) {
+                const QByteArray line = in.readLine();
+                torn = !line.endsWith('\n');
+                CommandChange change;
+                QString ignored;
+                if (!JsonIO::readCommandChange(line, &change, &ignored)) continue;
+                apply(change);
+                m_journalRecords++;}}}
+    const QIODevice::OpenMode mode = replay ? QIODevice::WriteOnly | QIODevice::Append : QIODevice::WriteOnly | QIODevice::Truncate;
+    if (!journal->file.open(mode) || (torn && !journal->file.write("\n"))) {
+        *error = QString("Cannot open %1: %2").arg(journal->file.fileName(), journal->file.errorString());
+        return false;}
+    m_journal = std::move(journal);
+    return true;}
+
+// The store handed to a compaction is an implicitly shared copy, so later
+// edits detach from it instead of racing with the writer.
+void CommandStore::startWrite() {
+    if (m_write.isRunning()) return;    // restarted when it finishes
+    if (m_sharded) {
+        const QMap<QString, QVector<CommandRef>> shards = takeDirtyShards();
+        if (!shards.isEmpty()) m_write.setFuture(QtConcurrent::run(&CommandStore::writeShards, m_path, shards, m_strings.view()));
+        return;}
+    if (!m_journal || (m_queued.isEmpty() && m_journal->unwritten.isEmpty())) return;
+    const QByteArray lines = std::exchange(m_queued, QByteArray());
+    if (m_journalRecords >= CompactAfter) {
+        m_journalRecords = 0;
+        m_write.setFuture(QtConcurrent::run(&CommandStore::compact, m_path, all(), m_strings.view(), m_journal, lines));
+    } else {
+        m_write.setFuture(QtConcurrent::run([journal = m_journal, lines]{ return WriteResult{append(journal, lines), QByteArray()}; }));}}
+
+// Copies of the changed categories, which count as written from here on.
+QMap<QString, QVector<CommandRef>> CommandStore::takeDirtyShards() {
+    QMap<QString, QVector<CommandRef>> shards;
+    for (auto it = m_categories.begin(); it != m_categories.end(); ++it) {
+        if (!it->dirty) continue;
+        it->dirty = false;
+        shards.insert(it.key(), it->commands);}
+    return shards;}
+
+void CommandStore::finishWrite(const WriteResult &result) {
+    if (!result.jsonHash.isEmpty()) m_jsonHash = result.jsonHash;
+    for (auto it = result.shardHashes.cbegin(); it != result.shardHashes.cend(); ++it) {
+        const auto category = m_categories.find(it.key());
+        if (category != m_categories.end()) category->shardHash = it.value();}
+    for (const QString &name : result.failedShards) {
+        const auto category = m_categories.find(name);
+        if (category != m_categories.end()) category->dirty = true;}
+    if (!result.error.isEmpty()) emit writeFailed(result.error);}
+
+// Waits for the running write and writes what is still queued, left over
+// from a failed append, or changed.
+void CommandStore::sync() {
+    m_quietTimer.stop();
+    m_write.waitForFinished();
+    if (m_sharded) {
+        const QMap<QString, QVector<CommandRef>> shards = takeDirtyShards();
+        if (!shards.isEmpty()) finishWrite(writeShards(m_path, shards, m_strings.view()));
+        return;}
+    if (m_journal && (!m_queued.isEmpty() || !m_journal->unwritten.isEmpty())) {
+        const QString error = append(m_journal, std::exchange(m_queued, QByteArray()));
+        if (!error.isEmpty()) emit writeFailed(error);}}
+
+// Worker thread, or the GUI thread in sync(). After a failed append the
+// lines are written again behind a newline, which ends one it may have torn.
+QString CommandStore::append(const std::shared_ptr<Journal> &journal, const QByteArray &lines) {
+    const QByteArray data = journal->unwritten.isEmpty() ? lines : "\n" + journal->unwritten + lines;
+    if (!journal->file.isOpen() || journal->file.write(data) != data.size() || !journal->file.flush()) {
+        journal->unwritten += lines;
+        return QString("%1: %2").arg(journal->file.fileName(), journal->file.errorString());}
+    journal->unwritten.clear();
+    return QString();}
+
+// Worker thread. commands already holds lines; they are only appended when
+// the store cannot be written.
+CommandStore::WriteResult CommandStore::compact(const QString &path, const QMap<QString, QVector<CommandRef>> &commands,
+                                               const CommandArena::View &strings, const std::shared_ptr<Journal> &journal,
+                                               const QByteArray &lines) {
+    const QByteArray json = JsonIO::writeCommandStore(commands, strings);
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size() || !file.commit()) {
+        const QString error = QString("%1: %2").arg(path, file.errorString());
+        append(journal, lines);
+        return {error, QByteArray()};}
+    const QByteArray hash = contentHash(json);
+    writeSnapshot(path, hash, commands, strings);
+    journal->unwritten.clear();
+    journal->file.close();
+    if (!journal->file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return {QString("%1: %2").arg(journal->file.fileName(), journal->file.errorString()), hash};}
+    return {QString(), hash};}
+
+// Worker thread, or the GUI thread in sync() and save(). Each category's
+// file is replaced on its own; the result names those that failed.
+CommandStore::WriteResult CommandStore::writeShards(const QString &dir, const QMap<QString, QVector<CommandRef>> &shards,
+                                                   const CommandArena::View &strings) {
+    WriteResult result;
+    for (auto it = shards.cbegin(); it != shards.cend(); ++it) {
+        const QByteArray json = JsonIO::writeCommandShard(it.value(), strings);
+        QSaveFile file(shardPath(dir, it.key()));
+        if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size() || !file.commit()) {
+            result.error = QString("%1: %2").arg(file.fileName(), file.errorString());
+            result.failedShards.append(it.key());
+            continue;}
+        result.shardHashes.insert(it.key(), contentHash(json));}
+    return result;}
+
+bool CommandStore::mapSnapshot(const QString &path) {
+    const QFileInfo source(path);
+    if (!source.isFile()) return false;
+    m_snapshot.setFileName(snapshotPath(path));
+    if (!m_snapshot.open(QIODevice::ReadOnly)) return false;
+    const qint64 size = m_snapshot.size();
+    m_map = size > 0 ? m_snapshot.map(0, size) : nullptr;
+    if (!m_map || !validSnapshot(m_map, size) || header(m_map)->sourceSize != source.size()) {
+        closeSnapshot();
+        return false;}
+    const qint64 modified = source.lastModified().toMSecsSinceEpoch();
+    if (header(m_map)->sourceModified != modified) {
+        // Touched but possibly unchanged, e.g. a config push rewriting the same library.
+        QFile json(path);
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        if (!json.open(QIODevice::ReadOnly) || !hash.addData(&json)
+            || hash.result() != QByteArray::fromRawData(header(m_map)->sourceHash, sizeof(SnapshotHeader::sourceHash))) {
+            closeSnapshot();
+            return false;}
+        QFile patch(m_snapshot.fileName());
+        if (patch.open(QIODevice::ReadWrite) && patch.seek(offsetof(SnapshotHeader, sourceModified))) {
+            patch.write(reinterpret_cast<const char *>(&modified), sizeof(modified));}}
+    m_jsonHash = QByteArray(header(m_map)->sourceHash, sizeof(SnapshotHeader::sourceHash));
+    const SnapshotCategory *table = categoryTable(m_map);
+    const QChar *strings = stringTable(m_map);
+    for (quint32 i = 0; i < header(m_map)->categoryCount; ++i) {
+        m_categories[QString(strings + table[i].name, table[i].nameLength)].snapshotIndex = int(i);}
+    return true;}
+
+// Only called once no category still points into the map.
+void CommandStore::closeSnapshot() {
+    if (m_map) m_snapshot.unmap(const_cast<uchar *>(m_map));
+    m_map = nullptr;
+    m_snapshot.close();}
+
+// Interns a category's strings from the snapshot or reads its file. A file that
+// cannot be read leaves the category unread, so it is never written over.
+bool CommandStore::materialize(const QString &name, Category &category, QString *error) {
+    category.lastUsed = ++m_useClock;
+    if (category.inShard) return readShard(name, category, error);
+    if (category.snapshotIndex < 0) return true;
+    const SnapshotCategory &c = categoryTable(m_map)[category.snapshotIndex];
+    const SnapshotEntry *entry = entryTable(m_map) + c.firstEntry;
+    const QChar *strings = stringTable(m_map);
+    category.commands.reserve(c.entryCount);
+    for (quint32 i = 0; i < c.entryCount; ++i, ++entry) {
+        category.commands.append({m_strings.intern(QStringView(strings + entry->command, entry->commandLength)),
+                                  m_strings.intern(QStringView(strings + entry->description, entry->descriptionLength))});}
+    category.snapshotIndex = -1;
+    return true;}
+
+bool CommandStore::readShard(const QString &name, Category &category, QString *error) {
+    QFile file(shardPath(m_path, name));
+    if (!file.open(QIODevice::ReadOnly)) {
+        *error = QString("%1: %2").arg(file.fileName(), file.errorString());
+        return false;}
+    const QByteArray json = file.readAll();
+    file.close();
+    QVector<SystemCmd> commands;
+    if (!JsonIO::readCommandShard(json, &commands, error)) {
+        *error = QString("%1: %2").arg(file.fileName(), *error);
+        return false;}
+    category.commands = intern(commands);
+    category.shardHash = contentHash(json);
+    category.inShard = false;
+    m_watcher.addPath(file.fileName());
+    return true;}
+
+// Drops the least recently used unchanged categories beyond MaxLoadedShards;
+// their files are read again on next use, and map to the same ids unless the
+// arena was compacted meanwhile. Not while a write runs, since a file may not
+// hold its category's last edits yet.
+void CommandStore::evictShards(const QString &keep) {
+    if (!m_sharded || m_write.isRunning()) return;
+    int loaded = 0;
+    for (const Category &category : std::as_const(m_categories)) loaded += category.inShard ? 0 : 1;
+    for (; loaded > MaxLoadedShards; --loaded) {
+        auto oldest = m_categories.end();
+        for (auto it = m_categories.begin(); it != m_categories.end(); ++it) {
+            if (it->inShard || it->dirty || it.key() == keep) continue;
+            if (oldest == m_categories.end() || it->lastUsed < oldest->lastUsed) oldest = it;}
+        if (oldest == m_categories.end()) return;
+        m_watcher.removePath(shardPath(m_path, oldest.key()));
+        oldest->commands = QVector<CommandRef>();
+        oldest->shardHash.clear();
+        oldest->inShard = true;
+        m_compactTimer.start();}}
+
+// A category holds at most two live strings per command, so once the arena
+// has more than twice that many, at least half of it is dead. Writes still
+// running keep the old blocks alive through their view.
+void CommandStore::compactStrings() {
+    qsizetype refs = 0;
+    for (const Category &category : std::as_const(m_categories)) refs += category.commands.size();
+    if (m_strings.count() < MinCompactStrings || m_strings.count() <= 4 * refs) return;
+    CommandArena strings;
+    for (Category &category : m_categories) {
+        for (CommandRef &cmd : category.commands) {
+            cmd = {strings.intern(m_strings.text(cmd.command)), strings.intern(m_strings.text(cmd.description))};}}
+    m_strings = std::move(strings);
+    emit stringsMoved();}
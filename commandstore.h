@@ -0,0 +1,170 @@
+#pragma once
+
+#include <QObject>
+#include <QFile>
+#include <QFileSystemWatcher>
+#include <QFutureWatcher>
+#include <QMap>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+#include <QVector>
+#include <memory>
+#include "commandarena.h"
+#include "systemcmd.h"
+
+// The command library behind the Categories and Commands docks. The JSON file
+// stays the source of truth; next to it a binary snapshot is kept in the cache
+// directory: a category table, an entry table and one UTF-16 string table,
+// all offsets. load() maps a snapshot that matches the JSON's size and mtime
+// (or, when only the mtime moved, its content hash) and reads just the
+// category names; a category's commands are interned on first use. A
+// missing or stale snapshot falls back to the JSON and is rewritten.
+//
+// In memory every command and description is interned once in a
+// CommandArena; a category holds only pairs of string ids, which views read
+// through text() without copying, and writers get a view of the arena.
+// Strings of categories dropped from memory, of removed commands and of
+// contents replaced by a reload stay interned until most of the arena is
+// dead; then the live ones are interned into a fresh arena, every id
+// changes, and stringsMoved() is emitted.
+//
+// Edits are not written into the JSON: each change is one line of
+// <file>.journal (see JsonIO::writeCommandChange()), and load() replays it.
+// change() only applies it in memory and queues the line; once no change
+// came for QuietMs the queued lines are appended on a worker thread, and
+// every CompactAfter changes the whole store is written there instead, to a
+// temporary file that is fsynced and renamed over the JSON (QSaveFile),
+// after which the journal starts empty. Writes run one at a time, in order;
+// load(), save(), reset() and the destructor wait for them and flush what
+// is still queued. Changes are idempotent, so a crash at any point leaves a
+// JSON and a journal that replay to the same store.
+//
+// The JSON is watched; when someone else rewrites it (a config push), it is
+// read again once it stayed quiet for ReloadDelayMs: read, hashed and parsed
+// on a worker thread, then interned here, the journal is replayed on top,
+// and reloaded() names the categories that differ.
+//
+// load() also takes a directory holding one <category>.json per category (see
+// JsonIO::writeCommandShard()), so teams can own separate files. Only the
+// file names are listed at startup; a category's file is read on first use,
+// and beyond MaxLoadedShards the least recently used unchanged ones are
+// dropped again. Such a store has no snapshot and no journal: after the quiet
+// time each changed category's file is replaced as a whole (QSaveFile).
+// The directory and the files read are watched; categories whose file
+// appeared, went away or changed are reloaded, unless they hold edits not
+// yet written, which then win.
+class CommandStore : public QObject {
+    Q_OBJECT
+public:
+    static constexpr int QuietMs = 500;
+    static constexpr int CompactAfter = 1000;
+    static constexpr int ReloadDelayMs = 300;
+    static constexpr int MaxLoadedShards = 32;
+    static constexpr int MinCompactStrings = 4096;
+    explicit CommandStore(QObject *parent = nullptr);
+    ~CommandStore();
+    // path: the JSON file, or a directory of category files.
+    bool load(const QString &path, QString *error);
+    // Writes the JSON and a fresh snapshot and empties the journal. To an
+    // existing directory, writes every category's file and continues sharded;
+    // a sharded store saved to its own directory only writes what changed.
+    bool save(const QString &path, QString *error);
+    void reset(const QStringList &categories);
+    QStringList categories() const { return m_categories.keys(); }
+    // The ids stay valid until the next load(), reset() or stringsMoved().
+    const QVector<CommandRef> &commands(const QString &category);
+    QStringView text(CommandArena::Id id) const { return m_strings.text(id); }
+    // Applies the change and queues it for the journal; creates its category
+    // when needed. Fails when no journal could be opened, or when the
+    // category's file cannot be read.
+    bool change(const CommandChange &change, QString *error);
+    bool fromSnapshot() const { return m_map != nullptr; }
+    bool sharded() const { return m_sharded; }
+
+signals:
+    // A background write failed; its lines stay queued and are retried.
+    void writeFailed(const QString &error);
+    // Categories added, removed, or changed among those already shown.
+    void reloaded(const QStringList &categories);
+    // The rewritten JSON does not parse; the store keeps what it had.
+    void reloadFailed(const QString &error);
+    // A category's file cannot be read; the category shows empty meanwhile.
+    void categoryFailed(const QString &error);
+    // The arena was compacted: every id changed, take the commands again.
+    void stringsMoved();
+
+private:
+    struct Category {
+        int snapshotIndex = -1;     // -1 once the commands are in memory
+        bool inShard = false;       // its file was not read yet, or was dropped
+        bool dirty = false;         // changed since its file was last written
+        quint64 lastUsed = 0;
+        QByteArray shardHash;       // of its file as last read or written here
+        QVector<CommandRef> commands;
+    };
+    // Used by one write task at a time, or by the GUI thread once they are done.
+    struct Journal {
+        QFile file;
+        QByteArray unwritten;   // lines a failed append left behind
+    };
+    // The JSON as a worker read it, for a reload.
+    struct SourceRead {
+        quint64 generation = 0;     // of the store when the read started
+        QByteArray hash;
+        bool changed = false;       // differs from what was last read or written here
+        QMap<QString, QVector<SystemCmd>> commands;
+        QString error;              // does not parse
+    };
+    struct WriteResult {
+        QString error;
+        QByteArray jsonHash;    // set when the JSON was rewritten
+        QMap<QString, QByteArray> shardHashes;  // of the category files written
+        QStringList failedShards;
+    };
+    QString m_path;
+    bool m_sharded = false;
+    quint64 m_useClock = 0;
+    QMap<QString, Category> m_categories;
+    CommandArena m_strings;
+    QFile m_snapshot;
+    const uchar *m_map = nullptr;
+    std::shared_ptr<Journal> m_journal;
+    int m_journalRecords = 0;
+    QByteArray m_queued;
+    QTimer m_quietTimer;
+    QFutureWatcher<WriteResult> m_write;
+    QFutureWatcher<SourceRead> m_read;
+    quint64 m_generation = 0;   // bumped by load(), save() and reset()
+    QByteArray m_jsonHash;      // of the JSON as last read or written here
+    QFileSystemWatcher m_watcher;
+    QTimer m_reloadTimer;
+    QTimer m_compactTimer;
+
+    bool mapSnapshot(const QString &path);
+    void closeSnapshot();
+    bool materialize(const QString &name, Category &category, QString *error);
+    bool readShard(const QString &name, Category &category, QString *error);
+    void evictShards(const QString &keep);
+    void compactStrings();
+    QMap<QString, QVector<CommandRef>> takeDirtyShards();
+    QMap<QString, QVector<CommandRef>> all(QString *error = nullptr);
+    CommandRef intern(const SystemCmd &cmd);
+    QVector<CommandRef> intern(const QVector<SystemCmd> &commands);
+    void apply(const CommandChange &change);
+    bool openJournal(bool replay, QString *error);
+    QMap<QString, QVector<CommandRef>> useJson(const QByteArray &hash, const QMap<QString, QVector<SystemCmd>> &commands);
+    void reload(const SourceRead &source, QStringList *changed);
+    void finishRead(const SourceRead &source);
+    static SourceRead readSource(const QString &path, const QByteArray &knownHash, quint64 generation);
+    void watch();
+    void checkSource();
+    void checkShards();
+    void startWrite();
+    void finishWrite(const WriteResult &result);
+    void sync();
+    static QString append(const std::shared_ptr<Journal> &journal, const QByteArray &lines);
+    static WriteResult compact(const QString &path, const QMap<QString, QVector<CommandRef>> &commands, const CommandArena::View &strings,
+                               const std::shared_ptr<Journal> &journal, const QByteArray &lines);
+    static WriteResult writeShards(const QString &dir, const QMap<QString, QVector<CommandRef>> &shards, const CommandArena::View &strings);
+};
@@ -0,0 +1,55 @@
+#include "commandtemplate.h"
+
+namespace {
+bool isNameChar(QChar c, bool first) {
+    if (c.isLetter() || c == QLatin1Char('_')) return true;
+    return !first && (c.isDigit() || c == QLatin1Char('.') || c == QLatin1Char('-') || c == QLatin1Char(':'));}
+
+bool isValidName(QStringView name) {
+    if (name.isEmpty()) return false;
+    for (qsizetype i = 0; i < name.size(); ++i) {
+        if (!isNameChar(name.at(i), i == 0)) return false;}
+    return true;}
+}
+
+CommandTemplate CommandTemplate::compile(const QString &source) {
+    CommandTemplate t;
+    t.m_source = source;
+    QString literal;
+    qsizetype pos = 0;
+    while (pos < source.size()) {
+        const qsizetype open = source.indexOf(QLatin1String("{{"), pos);
+        if (open < 0) break;
+        const qsizetype close = source.indexOf(QLatin1String("}}"), open + 2);
+        if (close < 0) break;
+        QStringView name = QStringView(source).mid(open + 2, close - open - 2).trimmed();
+        const bool raw = name.startsWith(QLatin1String("raw:"));
+        if (raw) name = name.mid(4);
+        if (!isValidName(name)) {
+            literal += QStringView(source).mid(pos, open + 2 - pos);
+            pos = open + 2;
+            continue;}
+        literal += QStringView(source).mid(pos, open - pos);
+        if (!literal.isEmpty()) {
+            t.m_segments.append({false, false, literal});
+            literal.clear();}
+        t.m_segments.append({true, raw, name.toString()});
+        t.m_hasVariables = true;
+        pos = close + 2;}
+    literal += QStringView(source).mid(pos);
+    if (!literal.isEmpty()) t.m_segments.append({false, false, literal});
+    return t;}
+
+void CommandTemplate::appendShellQuoted(QString *out, QStringView value) {
+    out->append(QLatin1Char('\''));
+    qsizetype from = 0;
+    for (qsizetype quote; (quote = value.indexOf(QLatin1Char('\''), from)) >= 0; from = quote + 1) {
+        out->append(value.mid(from, quote - from));
+        out->append(QLatin1String("'\\''"));}
+    out->append(value.mid(from));
+    out->append(QLatin1Char('\''));}
+
+bool CommandTemplate::references(QStringView name) const {
+    for (const Segment &seg : m_segments) {
+        if (seg.isVariable && seg.text == name) return true;}
+    return false;}
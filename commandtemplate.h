@@ -0,0 +1,50 @@
+#pragma once
+
+#include <QString>
+#include <QStringView>
+#include <QList>
+
+// A command string with {{name}} placeholders, split once into literal and
+// placeholder segments so expanding it is a sized append instead of a re-scan.
+// Placeholders the lookup does not know are kept verbatim. Values go into a
+// `bash -c` string, so each is inserted as one single-quoted shell word;
+// {{raw:name}} inserts the value as is, for templates that need shell syntax
+// from a trusted value.
+class CommandTemplate {
+public:
+    struct Segment {
+        bool isVariable = false;
+        bool raw = false;   // {{raw:name}}
+        QString text;       // literal text or variable name
+    };
+
+    CommandTemplate() = default;
+    static CommandTemplate compile(const QString &source);
+    const QString &source() const { return m_source; }
+    bool hasVariables() const { return m_hasVariables; }
+    bool references(QStringView name) const;
+    const QList<Segment> &segments() const { return m_segments; }
+    // 'value', with every ' written as '\''
+    static void appendShellQuoted(QString *out, QStringView value);
+
+    // lookup(const QString &name) -> const QString* (nullptr when unknown)
+    template <typename Lookup>
+    QString expand(Lookup &&lookup) const {
+        if (!m_hasVariables) return m_source;
+        QString result;
+        result.reserve(m_source.size());
+        for (const Segment &seg : m_segments) {
+            if (!seg.isVariable) {
+                result += seg.text;
+            } else if (const QString *value = lookup(seg.text)) {
+                if (seg.raw) result += *value;
+                else appendShellQuoted(&result, *value);
+            } else {
+                result += QLatin1String(seg.raw ? "{{raw:" : "{{") + seg.text + QLatin1String("}}");}}
+        return result;}
+
+private:
+    QString m_source;
+    QList<Segment> m_segments;
+    bool m_hasVariables = false;
+};
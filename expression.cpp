@@ -0,0 +1,328 @@
+#include "expression.h"
+#include <QVarLengthArray>
+#include <QtGlobal>
+
+bool ExprValue::truthy() const {
+    switch (type) {
+    case Null: return false;
+    case Bool:
+    case Number: return number != 0;
+    case String: return !string.isEmpty() && string != QLatin1String("0") && string != QLatin1String("false");}
+    return false;}
+
+double ExprValue::toNumber(bool *ok) const {
+    if (ok) *ok = true;
+    switch (type) {
+    case Null: return 0;
+    case Bool:
+    case Number: return number;
+    case String: return string.trimmed().toDouble(ok);}
+    return 0;}
+
+QString ExprValue::toString() const {
+    switch (type) {
+    case Null: return QString();
+    case Bool: return number != 0 ? QStringLiteral("true") : QStringLiteral("false");
+    case Number: return QString::number(number);
+    case String: return string;}
+    return QString();}
+
+namespace {
+struct Token {
+    enum Kind { End, Number, String, Name, Op, LParen, RParen, Error };
+    Kind kind = End;
+    QString text;
+    double number = 0;
+    qsizetype pos = 0;
+};
+
+class Lexer {
+public:
+    explicit Lexer(const QString &src) : m_src(src) {}
+    Token next() {
+        while (m_pos < m_src.size() && m_src.at(m_pos).isSpace()) m_pos++;
+        Token t;
+        t.pos = m_pos;
+        if (m_pos >= m_src.size()) return t;
+        const QChar c = m_src.at(m_pos);
+        if (c.isDigit()) {
+            const qsizetype start = m_pos;
+            while (m_pos < m_src.size() && (m_src.at(m_pos).isDigit() || m_src.at(m_pos) == '.')) m_pos++;
+            t.kind = Token::Number;
+            bool ok = false;
+            t.number = m_src.mid(start, m_pos - start).toDouble(&ok);
+            if (!ok) {
+                t.kind = Token::Error;
+                t.text = "malformed number";}
+            return t;}
+        if (c.isLetter() || c == '_') {
+            const qsizetype start = m_pos;
+            // Step ids may contain '-', elsewhere it is the minus operator.
+            const bool stepRef = QStringView(m_src).mid(start).startsWith(QLatin1String("steps."));
+            while (m_pos < m_src.size()) {
+                const QChar ch = m_src.at(m_pos);
+                if (!ch.isLetterOrNumber() && ch != '_' && ch != '.' && !(stepRef && ch == '-')) break;
+                m_pos++;}
+            t.kind = Token::Name;
+            t.text = m_src.mid(start, m_pos - start);
+            return t;}
+        if (c == '\'' || c == '"') {
+            m_pos++;
+            QString value;
+            while (m_pos < m_src.size() && m_src.at(m_pos) != c) {
+                if (m_src.at(m_pos) == '\\' && m_pos + 1 < m_src.size()) m_pos++;
+                value += m_src.at(m_pos++);}
+            if (m_pos >= m_src.size()) {
+                t.kind = Token::Error;
+                t.text = "unterminated string";
+                return t;}
+            m_pos++;
+            t.kind = Token::String;
+            t.text = value;
+            return t;}
+        if (c == '(') { m_pos++; t.kind = Token::LParen; return t; }
+        if (c == ')') { m_pos++; t.kind = Token::RParen; return t; }
+        static const char *const twoChar[] = {"==", "!=", "<=", ">=", "&&", "||", "=~"};
+        const QStringView rest = QStringView(m_src).mid(m_pos);
+        for (const char *op : twoChar) {
+            if (rest.startsWith(QLatin1String(op))) {
+                m_pos += 2;
+                t.kind = Token::Op;
+                t.text = QLatin1String(op);
+                return t;}}
+        if (QStringLiteral("!<>+-*/").contains(c)) {
+            m_pos++;
+            t.kind = Token::Op;
+            t.text = c;
+            return t;}
+        t.kind = Token::Error;
+        t.text = QString("unexpected character '%1'").arg(c);
+        return t;}
+private:
+    const QString &m_src;
+    qsizetype m_pos = 0;
+};
+}
+
+class ExpressionCompiler {
+public:
+    ExpressionCompiler(Expression &expr) : m_expr(expr), m_lexer(expr.m_source) { advance(); }
+    bool compile(QString *error) {
+        parseOr();
+        if (m_error.isEmpty() && m_tok.kind != Token::End) fail("unexpected trailing input");
+        if (!m_error.isEmpty()) {
+            if (error) *error = m_error;
+            return false;}
+        return true;}
+private:
+    using Op = Expression::Op;
+    Expression &m_expr;
+    Lexer m_lexer;
+    Token m_tok;
+    QString m_error;
+
+    void advance() {
+        m_tok = m_lexer.next();
+        if (m_tok.kind == Token::Error) fail(m_tok.text);}
+    void fail(const QString &msg) {
+        if (m_error.isEmpty()) m_error = QString("%1 at column %2").arg(msg).arg(m_tok.pos + 1);}
+    bool isOp(const char *op) const { return m_tok.kind == Token::Op && m_tok.text == QLatin1String(op); }
+    int emitOp(Op op, int arg = 0) {
+        m_expr.m_code.append(Expression::Instr{op, arg});
+        return m_expr.m_code.count() - 1;}
+    int addName(const QString &name) {
+        int i = m_expr.m_names.indexOf(name);
+        if (i < 0) {
+            m_expr.m_names.append(name);
+            i = m_expr.m_names.count() - 1;}
+        return i;}
+
+    void parseOr() {
+        parseAnd();
+        while (m_error.isEmpty() && isOp("||")) {
+            advance();
+            const int jump = emitOp(Op::JumpIfTrueOrPop);
+            parseAnd();
+            m_expr.m_code[jump].arg = m_expr.m_code.count();}}
+    void parseAnd() {
+        parseComparison();
+        while (m_error.isEmpty() && isOp("&&")) {
+            advance();
+            const int jump = emitOp(Op::JumpIfFalseOrPop);
+            parseComparison();
+            m_expr.m_code[jump].arg = m_expr.m_code.count();}}
+    void parseComparison() {
+        parseAdditive();
+        if (!m_error.isEmpty() || m_tok.kind != Token::Op) return;
+        if (isOp("=~")) {
+            advance();
+            if (m_tok.kind != Token::String) {
+                fail("=~ expects a string literal pattern");
+                return;}
+            QRegularExpression re(m_tok.text);
+            if (!re.isValid()) {
+                fail(QString("invalid pattern: %1").arg(re.errorString()));
+                return;}
+            re.optimize();
+            m_expr.m_regexes.append(re);
+            advance();
+            emitOp(Op::Match, m_expr.m_regexes.count() - 1);
+            return;}
+        static const struct { const char *text; Op op; } cmps[] = {
+            {"==", Op::Eq}, {"!=", Op::Ne}, {"<=", Op::Le}, {">=", Op::Ge}, {"<", Op::Lt}, {">", Op::Gt}};
+        for (const auto &c : cmps) {
+            if (isOp(c.text)) {
+                advance();
+                parseAdditive();
+                emitOp(c.op);
+                return;}}}
+    void parseAdditive() {
+        parseMultiplicative();
+        while (m_error.isEmpty() && (isOp("+") || isOp("-"))) {
+            const Op op = isOp("+") ? Op::Add : Op::Sub;
+            advance();
+            parseMultiplicative();
+            emitOp(op);}}
+    void parseMultiplicative() {
+        parseUnary();
+        while (m_error.isEmpty() && (isOp("*") || isOp("/"))) {
+            const Op op = isOp("*") ? Op::Mul : Op::Div;
+            advance();
+            parseUnary();
+            emitOp(op);}}
+    void parseUnary() {
+        if (isOp("-")) {
+            advance();
+            parseUnary();
+            emitOp(Op::Neg);
+            return;}
+        if (isOp("!")) {
+            advance();
+            parseUnary();
+            emitOp(Op::Not);
+            return;}
+        parsePrimary();}
+    void parsePrimary() {
+        if (!m_error.isEmpty()) return;
+        switch (m_tok.kind) {
+        case Token::Number:
+            m_expr.m_consts.append(ExprValue::fromNumber(m_tok.number));
+            emitOp(Op::PushConst, m_expr.m_consts.count() - 1);
+            advance();
+            return;
+        case Token::String:
+            m_expr.m_consts.append(ExprValue::fromString(m_tok.text));
+            emitOp(Op::PushConst, m_expr.m_consts.count() - 1);
+            advance();
+            return;
+        case Token::LParen:
+            advance();
+            parseOr();
+            if (m_tok.kind != Token::RParen) {
+                fail("expected ')'");
+                return;}
+            advance();
+            return;
+        case Token::Name:
+            parseName(m_tok.text);
+            advance();
+            return;
+        default:
+            fail("expected a value");}}
+    void parseName(const QString &name) {
+        if (name == QLatin1String("true") || name == QLatin1String("false")) {
+            m_expr.m_consts.append(ExprValue::fromBool(name == QLatin1String("true")));
+            emitOp(Op::PushConst, m_expr.m_consts.count() - 1);
+        } else if (name == QLatin1String("null")) {
+            m_expr.m_consts.append(ExprValue());
+            emitOp(Op::PushConst, m_expr.m_consts.count() - 1);
+        } else if (name == QLatin1String("exitCode")) {
+            emitOp(Op::LoadExitCode);
+        } else if (name == QLatin1String("failed")) {
+            emitOp(Op::LoadFailed);
+        } else if (name.startsWith(QLatin1String("env.")) && name.size() > 4) {
+            emitOp(Op::LoadEnv, addName(name.mid(4)));
+        } else if (name.startsWith(QLatin1String("var.")) && name.size() > 4) {
+            emitOp(Op::LoadVar, addName(name.mid(4)));
+        } else if (name.startsWith(QLatin1String("steps.")) && name.endsWith(QLatin1String(".exitCode")) && name.size() > 15) {
+            emitOp(Op::LoadStepExit, addName(name.mid(6, name.size() - 6 - 9)));
+        } else {
+            fail(QString("unknown name '%1'").arg(name));}}
+};
+
+Expression Expression::compile(const QString &source, QString *error) {
+    Expression expr;
+    expr.m_source = source;
+    ExpressionCompiler compiler(expr);
+    if (!compiler.compile(error)) return Expression();
+    return expr;}
+
+namespace {
+int compareValues(const ExprValue &a, const ExprValue &b) {
+    bool okA = false, okB = false;
+    const double na = a.toNumber(&okA);
+    const double nb = b.toNumber(&okB);
+    if (okA && okB && (a.type != ExprValue::String || b.type != ExprValue::String)) {
+        return na < nb ? -1 : (na > nb ? 1 : 0);}
+    return QString::compare(a.toString(), b.toString());}
+
+bool equalValues(const ExprValue &a, const ExprValue &b) {
+    if (a.type == ExprValue::Null || b.type == ExprValue::Null) return a.type == b.type;
+    return compareValues(a, b) == 0;}
+}
+
+ExprValue Expression::evaluate(const ExpressionContext &ctx) const {
+    QVarLengthArray<ExprValue, 16> stack;
+    for (int pc = 0; pc < m_code.count(); ++pc) {
+        const Instr &in = m_code.at(pc);
+        switch (in.op) {
+        case Op::PushConst: stack.append(m_consts.at(in.arg)); break;
+        case Op::LoadExitCode: stack.append(ExprValue::fromNumber(ctx.lastExitCode)); break;
+        case Op::LoadFailed: stack.append(ExprValue::fromBool(ctx.failed)); break;
+        case Op::LoadEnv: {
+            const QByteArray key = m_names.at(in.arg).toLocal8Bit();
+            stack.append(qEnvironmentVariableIsSet(key.constData())
+                         ? ExprValue::fromString(qEnvironmentVariable(key.constData())) : ExprValue());
+            break;}
+        case Op::LoadVar: {
+            const auto it = ctx.variables ? ctx.variables->constFind(m_names.at(in.arg)) : QHash<QString, QString>::const_iterator();
+            stack.append(ctx.variables && it != ctx.variables->constEnd() ? ExprValue::fromString(*it) : ExprValue());
+            break;}
+        case Op::LoadStepExit: {
+            const auto it = ctx.stepExitCodes ? ctx.stepExitCodes->constFind(m_names.at(in.arg)) : QHash<QString, int>::const_iterator();
+            stack.append(ctx.stepExitCodes && it != ctx.stepExitCodes->constEnd() ? ExprValue::fromNumber(*it) : ExprValue());
+            break;}
+        case Op::Not: stack.last() = ExprValue::fromBool(!stack.last().truthy()); break;
+        case Op::Neg: stack.last() = ExprValue::fromNumber(-stack.last().toNumber()); break;
+        case Op::JumpIfFalseOrPop:
+            if (!stack.last().truthy()) pc = in.arg - 1;
+            else stack.removeLast();
+            break;
+        case Op::JumpIfTrueOrPop:
+            if (stack.last().truthy()) pc = in.arg - 1;
+            else stack.removeLast();
+            break;
+        case Op::Match: {
+            const QString subject = stack.last().toString();
+            stack.last() = ExprValue::fromBool(m_regexes.at(in.arg).match(subject).hasMatch());
+            break;}
+        default: {
+            const ExprValue b = stack.last();
+            stack.removeLast();
+            ExprValue &a = stack.last();
+            switch (in.op) {
+            case Op::Add:
+                if (a.type == ExprValue::String || b.type == ExprValue::String) a = ExprValue::fromString(a.toString() + b.toString());
+                else a = ExprValue::fromNumber(a.toNumber() + b.toNumber());
+                break;
+            case Op::Sub: a = ExprValue::fromNumber(a.toNumber() - b.toNumber()); break;
+            case Op::Mul: a = ExprValue::fromNumber(a.toNumber() * b.toNumber()); break;
+            case Op::Div: a = b.toNumber() != 0 ? ExprValue::fromNumber(a.toNumber() / b.toNumber()) : ExprValue(); break;
+            case Op::Eq: a = ExprValue::fromBool(equalValues(a, b)); break;
+            case Op::Ne: a = ExprValue::fromBool(!equalValues(a, b)); break;
+            case Op::Lt: a = ExprValue::fromBool(compareValues(a, b) < 0); break;
+            case Op::Le: a = ExprValue::fromBool(compareValues(a, b) <= 0); break;
+            case Op::Gt: a = ExprValue::fromBool(compareValues(a, b) > 0); break;
+            case Op::Ge: a = ExprValue::fromBool(compareValues(a, b) >= 0); break;
+            default: break;}}}}
+    return stack.isEmpty() ? ExprValue() : stack.last();}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QHash>
+#include <QRegularExpression>
+
+struct ExprValue {
+    enum Type { Null, Bool, Number, String };
+    Type type = Null;
+    double number = 0;
+    QString string;
+    static ExprValue fromBool(bool b) { ExprValue v; v.type = Bool; v.number = b ? 1 : 0; return v; }
+    static ExprValue fromNumber(double n) { ExprValue v; v.type = Number; v.number = n; return v; }
+    static ExprValue fromString(const QString &s) { ExprValue v; v.type = String; v.string = s; return v; }
+    bool truthy() const;
+    double toNumber(bool *ok = nullptr) const;
+    QString toString() const;
+};
+
+// Everything a condition may look at while a workflow runs.
+struct ExpressionContext {
+    int lastExitCode = 0;
+    bool failed = false;
+    const QHash<QString, int> *stepExitCodes = nullptr;
+    const QHash<QString, QString> *variables = nullptr;
+};
+
+// Workflow condition language, compiled once into stack bytecode.
+//   literals: 12, 'text', "text", true, false, null
+//   names:    exitCode, failed, env.NAME, var.NAME, steps.ID.exitCode
+//   ops:      ! - * / + - == != < <= > >= =~ && || ( )
+class Expression {
+public:
+    Expression() = default;
+    static Expression compile(const QString &source, QString *error);
+    bool isValid() const { return !m_code.isEmpty(); }
+    const QString &source() const { return m_source; }
+    ExprValue evaluate(const ExpressionContext &ctx) const;
+    bool test(const ExpressionContext &ctx) const { return evaluate(ctx).truthy(); }
+
+private:
+    enum class Op : quint8 {
+        PushConst, LoadExitCode, LoadFailed, LoadEnv, LoadVar, LoadStepExit,
+        Not, Neg, Mul, Div, Add, Sub, Eq, Ne, Lt, Le, Gt, Ge, Match,
+        JumpIfFalseOrPop, JumpIfTrueOrPop
+    };
+    struct Instr {
+        Op op;
+        int arg;
+    };
+    QString m_source;
+    QList<Instr> m_code;
+    QList<ExprValue> m_consts;
+    QStringList m_names;
+    QList<QRegularExpression> m_regexes;
+    friend class ExpressionCompiler;
+};
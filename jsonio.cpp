@@ -0,0 +1,518 @@
+#include "jsonio.h"
+#include "nlohmann/json.hpp"
+#include <QJsonArray>
+#include <QJsonObject>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+using json = nlohmann::json;
+
+// Assembles a nested value that a reader keeps as data.
+class ValueBuilder {
+public:
+    bool active() const { return !m_levels.empty(); }
+    void begin(bool array) { m_levels.push_back(Level{array, QJsonArray(), QJsonObject(), QString()}); }
+    void key(const QString &key) { m_levels.back().key = key; }
+    void add(const QJsonValue &value) {
+        Level &level = m_levels.back();
+        if (level.array) level.items.append(value);
+        else level.fields.insert(level.key, value);}
+    // True once the outermost container is closed; *value then holds it.
+    bool end(QJsonValue *value) {
+        Level level = std::move(m_levels.back());
+        m_levels.pop_back();
+        *value = level.array ? QJsonValue(level.items) : QJsonValue(level.fields);
+        if (m_levels.empty()) return true;
+        add(*value);
+        return false;}
+private:
+    struct Level {
+        bool array;
+        QJsonArray items;
+        QJsonObject fields;
+        QString key;
+    };
+    std::vector<Level> m_levels;
+};
+
+// nlohmann::json SAX events reduced to the containers a reader walks. For
+// each container met inside a walked one the reader decides to walk it too,
+// take it whole as a QJsonValue, or skip it. Scalars and taken containers
+// arrive through onValue(), with currentKey() / currentIndex() saying where.
+class SaxReader {
+public:
+    virtual ~SaxReader() = default;
+    bool parse(const QByteArray &data, QString *error) {
+        if (json::sax_parse(data.constBegin(), data.constEnd(), this)) return true;
+        *error = m_error;
+        return false;}
+
+    // The SAX interface of nlohmann::json.
+    bool null() { return value(QJsonValue(QJsonValue::Null)); }
+    bool boolean(bool v) { return value(QJsonValue(v)); }
+    bool number_integer(json::number_integer_t v) { return value(QJsonValue(qint64(v))); }
+    bool number_unsigned(json::number_unsigned_t v) {
+        return value(v <= json::number_unsigned_t(std::numeric_limits<qint64>::max()) ? QJsonValue(qint64(v)) : QJsonValue(double(v)));}
+    bool number_float(json::number_float_t v, const json::string_t &) { return value(QJsonValue(double(v))); }
+    bool string(json::string_t &v) { return value(QJsonValue(QString::fromUtf8(v.data(), qsizetype(v.size())))); }
+    bool binary(json::binary_t &) { return value(QJsonValue(QJsonValue::Null)); }
+    bool start_object(std::size_t) { return begin(false); }
+    bool start_array(std::size_t) { return begin(true); }
+    bool end_object() { return end(); }
+    bool end_array() { return end(); }
+    bool key(json::string_t &k) {
+        if (m_skipped > 0) return true;
+        const QString name = internKey(k);
+        if (m_taken.active()) m_taken.key(name);
+        else m_walk.back().key = name;
+        return true;}
+    // what() reads "[json.exception.parse_error.101] parse error at line L, column C: ...".
+    bool parse_error(std::size_t, const std::string &, const json::exception &ex) {
+        const QString message = QString::fromUtf8(ex.what());
+        const qsizetype at = message.indexOf(QLatin1String(" at line "));
+        return fail(at >= 0 ? message.mid(at + 4) : message);}
+
+protected:
+    enum Mode { Walk, Take, Skip };
+    virtual Mode onBegin(bool array) = 0;
+    virtual bool onValue(const QJsonValue &value) = 0;
+    virtual bool onEnd() = 0;   // the innermost walked container is closing
+    int depth() const { return int(m_walk.size()); }
+    const QString &currentKey() const { return m_walk.back().key; }
+    int currentIndex() const { return m_walk.back().index; }
+    bool fail(const QString &message) {
+        m_error = message;
+        return false;}
+
+private:
+    struct Frame {
+        bool array;
+        QString key;
+        int index = 0;
+    };
+    std::vector<Frame> m_walk;
+    ValueBuilder m_taken;
+    int m_skipped = 0;
+    QString m_error;
+    // The same few keys repeat in every entry of a store or workflow; handing
+    // out one shared QString per distinct key saves an allocation per key.
+    static constexpr std::size_t MaxInternedKeys = 256;
+    std::unordered_map<std::string, QString> m_keys;
+
+    QString internKey(const json::string_t &k) {
+        const auto it = m_keys.find(k);
+        if (it != m_keys.end()) return it->second;
+        QString name = QString::fromUtf8(k.data(), qsizetype(k.size()));
+        if (m_keys.size() < MaxInternedKeys) m_keys.emplace(k, name);
+        return name;}
+
+    void advance() {
+        if (!m_walk.empty() && m_walk.back().array) m_walk.back().index++;}
+    bool deliver(const QJsonValue &v) {
+        const bool ok = onValue(v);
+        advance();
+        return ok;}
+    bool value(const QJsonValue &v) {
+        if (m_skipped > 0) return true;
+        if (m_taken.active()) {
+            m_taken.add(v);
+            return true;}
+        return deliver(v);}
+    bool begin(bool array) {
+        if (m_skipped > 0) {
+            m_skipped++;
+            return true;}
+        if (m_taken.active()) {
+            m_taken.begin(array);
+            return true;}
+        switch (onBegin(array)) {
+        case Walk:
+            m_walk.push_back(Frame{array, QString(), 0});
+            break;
+        case Take:
+            m_taken.begin(array);
+            break;
+        case Skip:
+            m_skipped = 1;
+            break;}
+        return m_error.isEmpty();}
+    bool end() {
+        if (m_skipped > 0) {
+            if (--m_skipped == 0) advance();
+            return true;}
+        if (m_taken.active()) {
+            QJsonValue v;
+            return m_taken.end(&v) ? deliver(v) : true;}
+        const bool ok = onEnd();
+        m_walk.pop_back();
+        advance();
+        return ok;}
+};
+
+// Steps are compiled as soon as their object closes, so a document is never
+// held in memory as a whole.
+class WorkflowReader : public SaxReader {
+public:
+    enum Shape { Document, Header, SingleStep };
+    WorkflowReader(Shape shape, WorkflowPlan *plan, WorkflowCmd *step) : m_shape(shape), m_plan(plan), m_step(step) {}
+    bool read(const QByteArray &data, QString *error) {
+        if (!parse(data, error)) return false;
+        if (m_shape == Document && m_rootObject && !m_hasSteps) {
+            *error = "Invalid JSON file: Root object has no \"steps\" array.";
+            return false;}
+        return true;}
+    bool foundHeader() const { return m_foundHeader; }
+
+protected:
+    Mode onBegin(bool array) override {
+        if (m_roles.isEmpty()) return beginRoot(array);
+        switch (m_roles.last()) {
+        case Wrapper:
+            if (array || currentKey() != QLatin1String("workflow")) return Skip;
+            m_foundHeader = true;
+            return enter(Root);
+        case Root:
+            if (!array) return Skip;
+            if (currentKey() == QLatin1String("steps") && m_shape == Document) {
+                m_section = &m_plan->steps;
+                m_hasSteps = true;
+            } else if (currentKey() == QLatin1String("onFailure")) {
+                m_section = &m_plan->onFailure;
+            } else if (currentKey() == QLatin1String("finally")) {
+                m_section = &m_plan->finally;
+            } else {
+                return Skip;}
+            m_sectionName = currentKey();
+            return enter(Section);
+        case Section:
+            if (array) return Skip;
+            m_stepIndex = currentIndex();
+            return enter(Step);
+        case Step:
+            return Take;}
+        return Skip;}
+
+    bool onValue(const QJsonValue &value) override {
+        if (m_roles.isEmpty()) {
+            if (m_shape == Header) return true;
+            return fail(m_shape == SingleStep ? QString("not a JSON object") : QString("Invalid JSON file: Root element is not an array."));}
+        switch (m_roles.last()) {
+        case Root:
+            if (currentKey() == QLatin1String("priority")) m_plan->priority = value.toInt(0);
+            else if (currentKey() == QLatin1String("intervalS")) m_plan->intervalS = value.toInt(0);
+            else if (currentKey() == QLatin1String("artifactQuotaMB")) m_plan->artifactQuotaMB = value.toInteger(2048);
+            return true;
+        case Step:
+            m_keys.set(currentKey(), value);
+            return true;
+        case Wrapper:
+        case Section:
+            break;}
+        return true;}
+
+    bool onEnd() override {
+        if (m_roles.takeLast() != Step) return true;
+        WorkflowCmd cmd;
+        QString error;
+        if (!WorkflowCmd::compile(m_keys, &cmd, &error)) {
+            return fail(m_shape == SingleStep ? error : QString("Invalid workflow: %1 step %2: %3").arg(m_sectionName).arg(m_stepIndex + 1).arg(error));}
+        if (m_shape == SingleStep) {
+            *m_step = std::move(cmd);
+            return true;}
+        if (cmd.isPiped()) {
+            const WorkflowCmd *prev = m_section->isEmpty() ? nullptr : &m_section->last();
+            if (!prev || prev->id != cmd.pipeFrom) {
+                return fail(QString("Invalid workflow: %1 step %2: pipeFrom '%3' must name the step directly before it.").arg(m_sectionName).arg(m_stepIndex + 1).arg(cmd.pipeFrom));}
+            if (!prev->canFeedPipe() || cmd.command.trimmed().isEmpty()) {
+                return fail(QString("Invalid workflow: %1 step %2: step '%3' cannot feed a pipe (forEach, waitForOutputLine, captureAs, artifacts or empty command).").arg(m_sectionName).arg(m_stepIndex + 1).arg(cmd.pipeFrom));}}
+        m_section->append(std::move(cmd));
+        return true;}
+
+private:
+    enum Role { Wrapper, Root, Section, Step };
+    Shape m_shape;
+    WorkflowPlan *m_plan;
+    WorkflowCmd *m_step;
+    QList<Role> m_roles;
+    QList<WorkflowCmd> *m_section = nullptr;
+    QString m_sectionName;
+    WorkflowStepKeys m_keys;
+    int m_stepIndex = 0;
+    bool m_rootObject = false;
+    bool m_hasSteps = false;
+    bool m_foundHeader = false;
+
+    Mode enter(Role role) {
+        if (role == Root) {
+            m_plan->priority = 0;
+            m_plan->intervalS = 0;
+            m_plan->artifactQuotaMB = 2048;}
+        if (role == Step) m_keys = WorkflowStepKeys();
+        m_roles.append(role);
+        return Walk;}
+
+    Mode beginRoot(bool array) {
+        switch (m_shape) {
+        case SingleStep:
+            if (!array) return enter(Step);
+            fail("not a JSON object");
+            return Skip;
+        case Header:
+            return array ? Skip : enter(Wrapper);
+        case Document:
+            break;}
+        if (!array) {
+            m_rootObject = true;
+            return enter(Root);}
+        m_section = &m_plan->steps;
+        m_sectionName = "steps";
+        m_hasSteps = true;
+        return enter(Section);}
+};
+
+// Entries without both "command" and "description" are dropped, and a
+// category whose value is not an array loads empty. A shard (one category's
+// file) is that array on its own; level() counts as if it sat in a store.
+class CommandStoreReader : public SaxReader {
+public:
+    explicit CommandStoreReader(QMap<QString, QVector<SystemCmd>> *commands) : m_commands(commands) {}
+    explicit CommandStoreReader(QVector<SystemCmd> *shard) : m_shard(shard) {}
+
+protected:
+    Mode onBegin(bool array) override {
+        switch (level()) {
+        case 0:
+            if (!array) return Walk;
+            fail("the root element must be an object of categories");
+            return Skip;
+        case 1:
+            if (m_shard) {
+                if (array) return Walk;
+                fail("the root element must be an array of commands");
+                return Skip;}
+            m_category = currentKey();
+            m_entries.clear();
+            if (array) return Walk;
+            m_commands->insert(m_category, {});
+            return Skip;
+        case 2:
+            if (array) return Skip;
+            m_cmd = SystemCmd();
+            m_fields = 0;
+            return Walk;
+        default:
+            return Skip;}}
+
+    bool onValue(const QJsonValue &value) override {
+        switch (level()) {
+        case 0:
+            return fail("the root element must be an object of categories");
+        case 1:
+            if (m_shard) return fail("the root element must be an array of commands");
+            m_commands->insert(currentKey(), {});
+            return true;
+        case 3: {
+            const bool isCommand = currentKey() == QLatin1String("command");
+            if (!isCommand && currentKey() != QLatin1String("description")) return true;
+            if (!value.isString() && m_shard) return fail(QString("\"%1\" must be a string").arg(currentKey()));
+            if (!value.isString()) return fail(QString("category '%1': \"%2\" must be a string").arg(m_category, currentKey()));
+            (isCommand ? m_cmd.command : m_cmd.description) = value.toString();
+            m_fields |= isCommand ? 1 : 2;
+            return true;}
+        default:
+            return true;}}
+
+    bool onEnd() override {
+        if (level() == 3 && m_fields == 3) m_entries.append(m_cmd);
+        else if (level() == 2 && m_shard) *m_shard = m_entries;
+        else if (level() == 2) m_commands->insert(m_category, m_entries);
+        return true;}
+
+private:
+    QMap<QString, QVector<SystemCmd>> *m_commands = nullptr;
+    QVector<SystemCmd> *m_shard = nullptr;
+    QString m_category;
+    QVector<SystemCmd> m_entries;
+    SystemCmd m_cmd;
+    int m_fields = 0;
+    int level() const { return depth() + (m_shard ? 1 : 0); }
+};
+
+class CommandChangeReader : public SaxReader {
+public:
+    explicit CommandChangeReader(CommandChange *change) : m_change(change) {}
+    bool read(const QByteArray &line, QString *error) {
+        if (!parse(line, error)) return false;
+        // One bit per key, in the order of keys below.
+        const int required = m_change->kind == CommandChange::Replace ? 0x3F : 0x0F;
+        if ((m_fields & required) == required) return true;
+        *error = "incomplete change record";
+        return false;}
+
+protected:
+    Mode onBegin(bool array) override {
+        if (depth() == 0 && !array) return Walk;
+        if (depth() == 0) fail("a change record must be an object");
+        return Skip;}
+
+    bool onValue(const QJsonValue &value) override {
+        if (depth() == 0) return fail("a change record must be an object");
+        static const QStringList keys = {"op", "category", "command", "description", "newCommand", "newDescription"};
+        const int field = int(keys.indexOf(currentKey()));
+        if (field < 0) return true;
+        if (!value.isString()) return fail(QString("\"%1\" must be a string").arg(currentKey()));
+        const QString text = value.toString();
+        switch (field) {
+        case 0:
+            if (text == QLatin1String("add")) m_change->kind = CommandChange::Add;
+            else if (text == QLatin1String("remove")) m_change->kind = CommandChange::Remove;
+            else if (text == QLatin1String("replace")) m_change->kind = CommandChange::Replace;
+            else return fail(QString("unknown op '%1'").arg(text));
+            break;
+        case 1: m_change->category = text; break;
+        case 2: m_change->cmd.command = text; break;
+        case 3: m_change->cmd.description = text; break;
+        case 4: m_change->replacement.command = text; break;
+        case 5: m_change->replacement.description = text; break;}
+        m_fields |= 1 << field;
+        return true;}
+
+    bool onEnd() override { return true; }
+
+private:
+    CommandChange *m_change;
+    int m_fields = 0;
+};
+
+// Escapes and encodes UTF-8 in one pass, without a temporary copy per string.
+// Unpaired surrogates are written as U+FFFD, as QString::toUtf8() does.
+void appendString(QByteArray *out, QStringView text) {
+    out->append('"');
+    for (qsizetype i = 0; i < text.size(); ++i) {
+        char32_t c = text.at(i).unicode();
+        if (QChar::isSurrogate(c)) {
+            if (QChar::isHighSurrogate(c) && i + 1 < text.size() && text.at(i + 1).isLowSurrogate()) {
+                c = QChar::surrogateToUcs4(char16_t(c), text.at(++i).unicode());
+            } else {
+                c = QChar::ReplacementCharacter;}}
+        if (c >= 0x80) {
+            if (c < 0x800) {
+                out->append(char(0xC0 | (c >> 6)));
+            } else {
+                if (c < 0x10000) {
+                    out->append(char(0xE0 | (c >> 12)));
+                } else {
+                    out->append(char(0xF0 | (c >> 18)));
+                    out->append(char(0x80 | ((c >> 12) & 0x3F)));}
+                out->append(char(0x80 | ((c >> 6) & 0x3F)));}
+            out->append(char(0x80 | (c & 0x3F)));
+            continue;}
+        switch (c) {
+        case '"': out->append("\\\""); break;
+        case '\\': out->append("\\\\"); break;
+        case '\b': out->append("\\b"); break;
+        case '\f': out->append("\\f"); break;
+        case '\n': out->append("\\n"); break;
+        case '\r': out->append("\\r"); break;
+        case '\t': out->append("\\t"); break;
+        default:
+            if (c < 0x20) {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", unsigned(c));
+                out->append(escaped);
+            } else {
+                out->append(char(c));}}}
+    out->append('"');}
+
+// Estimate for reserving the output of appendCommands().
+qsizetype commandsSize(const QVector<CommandRef> &commands, const CommandArena::View &strings) {
+    qsizetype size = 8;
+    for (const CommandRef &cmd : commands) size += strings.text(cmd.command).size() + strings.text(cmd.description).size() + 80;
+    return size;}
+
+// A category's array as dump(4) indents it at the given nesting level.
+void appendCommands(QByteArray *out, const QVector<CommandRef> &commands, const CommandArena::View &strings, int level) {
+    if (commands.isEmpty()) {
+        out->append("[]");
+        return;}
+    const QByteArray outer(4 * level, ' ');
+    const QByteArray entry = outer + "    ";
+    const QByteArray field = entry + "    ";
+    out->append("[\n");
+    for (qsizetype i = 0; i < commands.size(); ++i) {
+        if (i > 0) out->append(",\n");
+        out->append(entry).append("{\n").append(field).append("\"command\": ");
+        appendString(out, strings.text(commands.at(i).command));
+        out->append(",\n").append(field).append("\"description\": ");
+        appendString(out, strings.text(commands.at(i).description));
+        out->append('\n').append(entry).append('}');}
+    out->append('\n').append(outer).append(']');}
+}
+
+bool JsonIO::readWorkflow(const QByteArray &data, WorkflowPlan *plan, QString *error) {
+    return WorkflowReader(WorkflowReader::Document, plan, nullptr).read(data, error);}
+
+bool JsonIO::readStreamHeader(const QByteArray &line, WorkflowPlan *plan, bool *isHeader, QString *error) {
+    WorkflowReader reader(WorkflowReader::Header, plan, nullptr);
+    const bool ok = reader.read(line, error);
+    *isHeader = reader.foundHeader();
+    return ok;}
+
+bool JsonIO::readStep(const QByteArray &data, WorkflowCmd *cmd, QString *error) {
+    return WorkflowReader(WorkflowReader::SingleStep, nullptr, cmd).read(data, error);}
+
+bool JsonIO::readCommandStore(const QByteArray &data, QMap<QString, QVector<SystemCmd>> *commands, QString *error) {
+    return CommandStoreReader(commands).parse(data, error);}
+
+bool JsonIO::readCommandShard(const QByteArray &data, QVector<SystemCmd> *commands, QString *error) {
+    return CommandStoreReader(commands).parse(data, error);}
+
+bool JsonIO::readCommandChange(const QByteArray &line, CommandChange *change, QString *error) {
+    return CommandChangeReader(change).read(line, error);}
+
+QByteArray JsonIO::writeCommandChange(const CommandChange &change) {
+    static const char *const ops[] = {"add", "remove", "replace"};
+    QByteArray out = "{\"op\": \"";
+    out += ops[change.kind];
+    out += "\", \"category\": ";
+    appendString(&out, change.category);
+    out += ", \"command\": ";
+    appendString(&out, change.cmd.command);
+    out += ", \"description\": ";
+    appendString(&out, change.cmd.description);
+    if (change.kind == CommandChange::Replace) {
+        out += ", \"newCommand\": ";
+        appendString(&out, change.replacement.command);
+        out += ", \"newDescription\": ";
+        appendString(&out, change.replacement.description);}
+    out += "}\n";
+    return out;}
+
+// Same layout as nlohmann::json::dump(4), which wrote this file before.
+QByteArray JsonIO::writeCommandStore(const QMap<QString, QVector<CommandRef>> &commands, const CommandArena::View &strings) {
+    if (commands.isEmpty()) return "{}";
+    // Sized up front so a large store is written into one buffer.
+    qsizetype size = 4;
+    for (auto it = commands.cbegin(); it != commands.cend(); ++it) size += it.key().size() + 16 + commandsSize(it.value(), strings);
+    QByteArray out;
+    out.reserve(size);
+    out += "{\n";
+    for (auto it = commands.cbegin(); it != commands.cend(); ++it) {
+        if (it != commands.cbegin()) out += ",\n";
+        out += "    ";
+        appendString(&out, it.key());
+        out += ": ";
+        appendCommands(&out, it.value(), strings, 1);}
+    out += "\n}";
+    return out;}
+
+QByteArray JsonIO::writeCommandShard(const QVector<CommandRef> &commands, const CommandArena::View &strings) {
+    QByteArray out;
+    out.reserve(commandsSize(commands, strings) + 2);
+    appendCommands(&out, commands, strings, 0);
+    out += "\n";
+    return out;}
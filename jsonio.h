@@ -0,0 +1,38 @@
+#pragma once
+
+#include <QByteArray>
+#include <QMap>
+#include <QVector>
+#include <QString>
+#include "commandarena.h"
+#include "systemcmd.h"
+#include "workflowplan.h"
+
+// All JSON files of the application go through here. Reading uses the SAX
+// parser of the vendored nlohmann::json: values go straight into the structs
+// that use them, with no document tree in between and one UTF-8 to QString
+// conversion per string. Only values kept as data (forEach items, captureAs
+// and captureToFile objects) are assembled into QJsonValue.
+// Syntax errors read "line L, column C: message".
+class JsonIO {
+public:
+    // {"steps": [...], ...} or a bare array of steps. Appends the steps to plan;
+    // a root object also sets priority, intervalS and artifactQuotaMB. Step
+    // errors name the section and step number.
+    static bool readWorkflow(const QByteArray &data, WorkflowPlan *plan, QString *error);
+    // First line of an NDJSON workflow; *isHeader is false when it is not
+    // {"workflow": {...}} (usually because it is the first step).
+    static bool readStreamHeader(const QByteArray &line, WorkflowPlan *plan, bool *isHeader, QString *error);
+    static bool readStep(const QByteArray &data, WorkflowCmd *cmd, QString *error);
+    // {"category": [{"command": ..., "description": ...}, ...], ...}
+    static bool readCommandStore(const QByteArray &data, QMap<QString, QVector<SystemCmd>> *commands, QString *error);
+    static QByteArray writeCommandStore(const QMap<QString, QVector<CommandRef>> &commands, const CommandArena::View &strings);
+    // One category's file of a sharded store: [{"command": ..., "description": ...}, ...]
+    static bool readCommandShard(const QByteArray &data, QVector<SystemCmd> *commands, QString *error);
+    static QByteArray writeCommandShard(const QVector<CommandRef> &commands, const CommandArena::View &strings);
+    // One line of the command store journal:
+    // {"op": "add"|"remove"|"replace", "category": ..., "command": ..., "description": ...,
+    //  "newCommand": ..., "newDescription": ...}
+    static bool readCommandChange(const QByteArray &line, CommandChange *change, QString *error);
+    static QByteArray writeCommandChange(const CommandChange &change);
+};
@@ -1,7 +1,12 @@
 #include <QApplication>
 #include "mainwindow.h"
+#include "spawnhelper.h"
+#include "rootbroker.h"
+#include <cstring>
 
 int main(int argc, char *argv[]) {
+    if (argc > 1 && std::strcmp(argv[1], "--root-broker") == 0) return RootBroker::serve();
+    SpawnHelper::launch();
     QApplication a(argc, argv);
     a.setApplicationName("shoot_commands");
     a.setOrganizationName("shoot_commands");    
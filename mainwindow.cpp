@@ -1,14 +1,19 @@
 #include "mainwindow.h"
 #include "commandexecutor.h"
+#include "rootbroker.h"
 #include "settingsdialog.h"
 #include "sequencerunner.h"
-#include <fstream>
-#include <iostream>
+#include "workflowqueue.h"
+#include "workflowstepmodel.h"
+#include "scheduledcommand.h"
+#include "commandlistmodel.h"
 #include <QApplication>
 #include <QCoreApplication>
-#include <QStandardItemModel>
 #include <QSortFilterProxyModel>
 #include <QTreeView>
+#include <QFutureWatcher>
+#include <QtConcurrent/QtConcurrentMap>
+#include <QListView>
 #include <QDockWidget>
 #include <QListWidget>
 #include <QMenuBar>
@@ -34,10 +39,11 @@
 #include <QCloseEvent>
 #include <QMenu>
 #include <QContextMenuEvent>
-#include <QStandardItem>
 #include <QSpinBox>
 #include <QTabWidget>
-#include "nlohmann/json.hpp"
+#include <QTreeWidget>
+#include <QSignalBlocker>
+#include <QComboBox>
 
 class LogDialog : public QDialog {
 public:
@@ -80,25 +86,25 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
     resize(1100, 720);
     ensureJsonPathLocal();    
     m_executor = new CommandExecutor(this);    
-    // Manual Schedule Timer
-    m_commandTimer = new QTimer(this);
-    connect(m_commandTimer, &QTimer::timeout, this, &MainWindow::executeScheduledCommand);    
-    // Workflow Sequence Logic
-    m_sequenceRunner = new SequenceRunner(m_executor, this);
-    connect(m_sequenceRunner, &SequenceRunner::sequenceStarted, this, &MainWindow::onSequenceStarted);
-    connect(m_sequenceRunner, &SequenceRunner::sequenceFinished, this, &MainWindow::onSequenceFinished);
-    connect(m_sequenceRunner, &SequenceRunner::commandExecuting, this, &MainWindow::onWorkflowCommandExecuting);
-    connect(m_sequenceRunner, &SequenceRunner::logMessage, this, &MainWindow::handleWorkflowLog);    
-    // Interval Restart Logic (from snippet)
-    connect(m_sequenceRunner, &SequenceRunner::scheduleRestart, this, [this](int interval){
-        m_nextSequenceTime = QDateTime::currentDateTime().addSecs(interval);
-        if (m_sequenceIntervalTimer->isActive()) m_sequenceIntervalTimer->stop();
-        m_sequenceIntervalTimer->setInterval(interval * 1000);
-        m_sequenceIntervalTimer->start();
-    });
-    m_sequenceIntervalTimer = new QTimer(this);
-    m_sequenceIntervalTimer->setSingleShot(true);
-    connect(m_sequenceIntervalTimer, &QTimer::timeout, this, &MainWindow::startIntervalSequence);
+    // Manual Schedule
+    m_scheduledCommand = new ScheduledCommand(this);
+    connect(m_scheduledCommand, &ScheduledCommand::outputReceived, this, &MainWindow::onOutput);
+    connect(m_scheduledCommand, &ScheduledCommand::errorReceived, this, &MainWindow::onError);
+    connect(m_scheduledCommand, &ScheduledCommand::started, this, &MainWindow::onProcessStarted);
+    connect(m_scheduledCommand, &ScheduledCommand::finished, this, &MainWindow::onProcessFinished);
+    connect(m_scheduledCommand, &ScheduledCommand::logMessage, this, &MainWindow::handleWorkflowLog);
+    connect(m_scheduledCommand, &ScheduledCommand::countersChanged, this, &MainWindow::updateScheduleCounters);
+    // Workflow Queue Logic
+    m_workflowQueue = new WorkflowQueue(this);
+    m_workflowQueue->setMaxConcurrent(m_settings.value("maxConcurrentWorkflows", 4).toInt());
+    connect(m_workflowQueue, &WorkflowQueue::jobStarted, this, &MainWindow::onSequenceStarted);
+    connect(m_workflowQueue, &WorkflowQueue::jobFinished, this, &MainWindow::onSequenceFinished);
+    connect(m_workflowQueue, &WorkflowQueue::commandExecuting, this, &MainWindow::onWorkflowCommandExecuting);
+    connect(m_workflowQueue, &WorkflowQueue::jobOutput, this, &MainWindow::onWorkflowOutput);
+    connect(m_workflowQueue, &WorkflowQueue::jobError, this, &MainWindow::onWorkflowError);
+    connect(m_workflowQueue, &WorkflowQueue::logMessage, this, &MainWindow::handleWorkflowLog);    
+    connect(m_workflowQueue, &WorkflowQueue::jobsChanged, this, &MainWindow::refreshWorkflowJobList);
+    connect(m_workflowQueue, &WorkflowQueue::jobStateChanged, this, &MainWindow::updateWorkflowJobItem);
     m_displayTimer = new QTimer(this);
     m_displayTimer->setInterval(100);
     connect(m_displayTimer, &QTimer::timeout, this, &MainWindow::updateTimerDisplay);
@@ -117,8 +123,7 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
     m_dockCategories->setWidget(m_categoryList);
     m_dockCategories->setAllowedAreas(Qt::LeftDockWidgetArea | Qt::RightDockWidgetArea);
     addDockWidget(Qt::LeftDockWidgetArea, m_dockCategories);
-    m_commandModel = new QStandardItemModel(this);
-    m_commandModel->setHorizontalHeaderLabels(QStringList{"Command", "Description"});
+    m_commandModel = new CommandListModel(&m_commands, this);
     m_commandProxy = new QSortFilterProxyModel(this);
     m_commandProxy->setSourceModel(m_commandModel);
     m_commandProxy->setFilterCaseSensitivity(Qt::CaseInsensitive);
@@ -135,7 +140,7 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
     connect(m_commandView, &QTreeView::clicked, [this](const QModelIndex &idx){
         QModelIndex s = m_commandProxy->mapToSource(idx);
         if (s.isValid()) {
-            QString cmd = m_commandModel->item(s.row(), 0)->text();
+            QString cmd = m_commandModel->command(s.row());
             m_commandEdit->setText(cmd);
             if (m_dockControls) { m_dockControls->setVisible(true); m_dockControls->raise(); if (m_commandEdit) { m_commandEdit->setFocus(); m_commandEdit->selectAll(); } }}});
     m_commandView->setContextMenuPolicy(Qt::CustomContextMenu);
@@ -144,7 +149,7 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
         if (!idx.isValid()) return;
         QModelIndex s = m_commandProxy->mapToSource(idx);
         if (!s.isValid()) return;
-        QString cmd = m_commandModel->item(s.row(), 0)->text();
+        QString cmd = m_commandModel->command(s.row());
         QMenu menu(this);
         menu.addAction("Execute", [this, cmd](){ m_commandEdit->setText(cmd); runCommand(); });
         menu.addAction("Edit", [this, s](){ m_commandView->selectionModel()->clear(); m_commandView->setCurrentIndex(m_commandProxy->mapFromSource(s)); editCommand(); });
@@ -186,23 +191,35 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
     dlg->move(this->x() + this->width() + 20, this->y());
     dlg->show();
     m_detachedLogDialog = dlg;
+    connect(&m_commands, &CommandStore::writeFailed, this, [this](const QString &error){
+        appendLog(QString("Cannot save command changes: %1").arg(error), "#FF6565");});
+    connect(&m_commands, &CommandStore::reloadFailed, this, [this](const QString &error){
+        appendLog(QString("Cannot reload %1: %2. Keeping the loaded commands.").arg(m_jsonFile, error), "#FF6565");});
+    connect(&m_commands, &CommandStore::categoryFailed, this, [this](const QString &error){
+        appendLog(QString("Cannot read category: %1").arg(error), "#FF6565");});
+    connect(&m_commands, &CommandStore::reloaded, this, [this](const QStringList &categories){
+        if (categories.isEmpty()) return;
+        appendLog(QString("Reloaded %1: changed categories: %2").arg(m_jsonFile, categories.join(", ")), "#BDBDBD");
+        syncCategoryList();
+        QListWidgetItem *current = m_categoryList->currentItem();
+        if (current && categories.contains(current->text())) m_commandModel->refresh();});
     loadCommands();
     populateCategoryList();
     if (m_categoryList->count() > 0) m_categoryList->setCurrentRow(0);
     if (!m_settings.contains("windowState")) {
         restoreDefaultLayout();}
     restoreWindowStateFromSettings();
+    applyRootBrokerSetting();
     m_commandView->installEventFilter(this);
     m_categoryList->installEventFilter(this);
     if (m_commandEdit) m_commandEdit->installEventFilter(this);
     if (m_displayTimer) m_displayTimer->start();}
 
 MainWindow::~MainWindow() {
-    if (m_commandTimer && m_commandTimer->isActive()) m_commandTimer->stop();
-    if (m_sequenceIntervalTimer && m_sequenceIntervalTimer->isActive()) m_sequenceIntervalTimer->stop();
+    if (m_scheduledCommand) m_scheduledCommand->stop();
     if (m_displayTimer && m_displayTimer->isActive()) m_displayTimer->stop();
-    saveCommands();
-    saveWindowStateToSettings();}
+    saveWindowStateToSettings();
+    CommandExecutor::disableRootBroker();}
 
 void MainWindow::setupMenus() {
     QMenu *file = menuBar()->addMenu("&File");
@@ -217,7 +234,9 @@ void MainWindow::setupMenus() {
     connect(removeAct, &QAction::triggered, this, &MainWindow::removeCommand);    
     file->addSeparator();    
     QAction *loadAct = file->addAction("Load commands…");
+    QAction *loadDirAct = file->addAction("Load command directory…");
     QAction *saveAct = file->addAction("Save commands as…");    
+    QAction *saveDirAct = file->addAction("Save commands to directory…");
     file->addSeparator();    
     QAction *quitAct = file->addAction("Quit");
     connect(loadAct, &QAction::triggered, this, [this]{
@@ -227,6 +246,17 @@ void MainWindow::setupMenus() {
             m_jsonFile = fn;
             loadCommands();
             populateCategoryList();}});
+    connect(loadDirAct, &QAction::triggered, this, [this]{
+        QString dir = QFileDialog::getExistingDirectory(this, tr("Load command directory"), "/usr/local/etc/shoot_commands");
+        if (!dir.isEmpty()) {
+            m_jsonFile = dir;
+            loadCommands();
+            populateCategoryList();}});
+    connect(saveDirAct, &QAction::triggered, this, [this]{
+        QString dir = QFileDialog::getExistingDirectory(this, tr("Save commands to directory"), "/usr/local/etc/shoot_commands");
+        if (!dir.isEmpty()) {
+            m_jsonFile = dir;
+            saveCommands();}});
     connect(saveAct, &QAction::triggered, this, [this]{
         QDir startDir = QDir("/usr/local/etc/shoot_commands");
         QString fn = QFileDialog::getSaveFileName(this, tr("Save JSON"), startDir.filePath("shoot_commands.json"), tr("JSON files (*.json);;All files (*)"));
@@ -259,29 +289,54 @@ QWidget* MainWindow::createWorkflowTabWidget() {
     loadRunLayout->addWidget(m_showJsonBtn);
     QPushButton *runBtn = new QPushButton("Run Sequence");
     runBtn->setStyleSheet("background-color: #4CAF50; color: black;");
-    connect(runBtn, &QPushButton::clicked, m_sequenceRunner, &SequenceRunner::startSequence);
+    connect(runBtn, &QPushButton::clicked, this, &MainWindow::runSelectedWorkflows);
     loadRunLayout->addWidget(runBtn);
     QPushButton *stopBtn = new QPushButton("Stop Sequence");
     stopBtn->setStyleSheet("background-color: #FF0000; color: black;");
     connect(stopBtn, &QPushButton::clicked, this, &MainWindow::stopIntervalSequence);
     loadRunLayout->addWidget(stopBtn);    
+    QPushButton *removeBtn = new QPushButton("Remove");
+    connect(removeBtn, &QPushButton::clicked, this, &MainWindow::removeSelectedWorkflows);
+    loadRunLayout->addWidget(removeBtn);
     mainLayout->addLayout(loadRunLayout);
+    m_workflowJobList = new QTreeWidget();
+    m_workflowJobList->setHeaderLabels(QStringList{"Workflow", "Priority", "Interval", "State", "Next run"});
+    m_workflowJobList->setRootIsDecorated(false);
+    m_workflowJobList->setSelectionMode(QAbstractItemView::ExtendedSelection);
+    m_workflowJobList->header()->setSectionResizeMode(0, QHeaderView::Stretch);
+    connect(m_workflowJobList, &QTreeWidget::itemSelectionChanged, this, &MainWindow::onWorkflowJobSelected);
+    mainLayout->addWidget(m_workflowJobList, 1);
     auto intervalLayout = new QHBoxLayout();    
     m_sequenceIntervalToggle = new QCheckBox("Interval (s):");
-    connect(m_sequenceIntervalToggle, &QCheckBox::toggled, m_sequenceRunner, &SequenceRunner::setIntervalToggle);
+    connect(m_sequenceIntervalToggle, &QCheckBox::toggled, this, &MainWindow::applyWorkflowSchedule);
     intervalLayout->addWidget(m_sequenceIntervalToggle);
     m_sequenceIntervalSpinBox = new QSpinBox();
     m_sequenceIntervalSpinBox->setRange(1, 86400);
     m_sequenceIntervalSpinBox->setValue(60);
     m_sequenceIntervalSpinBox->setMaximumWidth(70);
-    connect(m_sequenceIntervalSpinBox, QOverload<int>::of(&QSpinBox::valueChanged), m_sequenceRunner, &SequenceRunner::setIntervalValue);
+    connect(m_sequenceIntervalSpinBox, QOverload<int>::of(&QSpinBox::valueChanged), this, &MainWindow::applyWorkflowSchedule);
     intervalLayout->addWidget(m_sequenceIntervalSpinBox);
+    intervalLayout->addWidget(new QLabel("Priority:"));
+    m_workflowPrioritySpinBox = new QSpinBox();
+    m_workflowPrioritySpinBox->setRange(-100, 100);
+    m_workflowPrioritySpinBox->setMaximumWidth(60);
+    connect(m_workflowPrioritySpinBox, QOverload<int>::of(&QSpinBox::valueChanged), this, [this](int value){
+        for (int id : selectedWorkflowJobs()) m_workflowQueue->setPriority(id, value);});
+    intervalLayout->addWidget(m_workflowPrioritySpinBox);
+    intervalLayout->addWidget(new QLabel("Parallel:"));
+    m_workflowParallelSpinBox = new QSpinBox();
+    m_workflowParallelSpinBox->setRange(1, 64);
+    m_workflowParallelSpinBox->setValue(m_workflowQueue->maxConcurrent());
+    m_workflowParallelSpinBox->setMaximumWidth(60);
+    connect(m_workflowParallelSpinBox, QOverload<int>::of(&QSpinBox::valueChanged), this, [this](int value){
+        m_workflowQueue->setMaxConcurrent(value);
+        m_settings.setValue("maxConcurrentWorkflows", value);});
+    intervalLayout->addWidget(m_workflowParallelSpinBox);
     m_sequenceTimerDisplay = new QLabel("Timer Stopped");
     m_sequenceTimerDisplay->setStyleSheet("color: black; margin-left: 10px;");
     intervalLayout->addWidget(m_sequenceTimerDisplay);
     intervalLayout->addStretch(1);    
     mainLayout->addLayout(intervalLayout);
-    mainLayout->addStretch(1);    
     return w;}
 
 void MainWindow::setupWorkflowDock() {
@@ -319,13 +374,34 @@ QWidget* MainWindow::createControlsWidget() {
     QPushButton *stopTimerBtn = new QPushButton("Stop Timer");
     stopTimerBtn->setStyleSheet("background-color: #FF0000; color: black;");
     connect(stopTimerBtn, &QPushButton::clicked, [this]{
-        if (m_commandTimer->isActive()) {
-            m_commandTimer->stop();
+        if (m_scheduledCommand->isActive()) {
+            m_scheduledCommand->stop();
             appendLog("Scheduled command timer stopped by user.", "#E68D8D");
         } else {
             appendLog("Timer is not currently running.", "#BDBDBD");}});
     timeLayout->addWidget(stopTimerBtn);
     mainLayout->addLayout(timeLayout);
+    auto overlapLayout = new QHBoxLayout();
+    overlapLayout->addWidget(new QLabel("Overlap:"));
+    m_overlapPolicyCombo = new QComboBox();
+    m_overlapPolicyCombo->addItem("Skip if running", ScheduledCommand::SkipIfRunning);
+    m_overlapPolicyCombo->addItem("Queue one", ScheduledCommand::QueueOne);
+    m_overlapPolicyCombo->addItem("Allow N concurrent", ScheduledCommand::AllowConcurrent);
+    m_overlapPolicyCombo->addItem("Kill previous", ScheduledCommand::KillPrevious);
+    m_overlapPolicyCombo->setCurrentIndex(qMax(0, m_overlapPolicyCombo->findData(m_settings.value("scheduleOverlapPolicy", int(ScheduledCommand::SkipIfRunning)).toInt())));
+    overlapLayout->addWidget(m_overlapPolicyCombo);
+    m_overlapMaxSpinBox = new QSpinBox();
+    m_overlapMaxSpinBox->setRange(1, 32);
+    m_overlapMaxSpinBox->setValue(m_settings.value("scheduleOverlapMax", 2).toInt());
+    m_overlapMaxSpinBox->setMaximumWidth(60);
+    overlapLayout->addWidget(m_overlapMaxSpinBox);
+    m_scheduleCountersLabel = new QLabel();
+    overlapLayout->addWidget(m_scheduleCountersLabel);
+    overlapLayout->addStretch(1);
+    connect(m_overlapPolicyCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &MainWindow::applyOverlapPolicy);
+    connect(m_overlapMaxSpinBox, QOverload<int>::of(&QSpinBox::valueChanged), this, &MainWindow::applyOverlapPolicy);
+    mainLayout->addLayout(overlapLayout);
+    applyOverlapPolicy();
     auto btnLayout = new QHBoxLayout();
     m_rootToggle = new QCheckBox("run as root (su -)");
     m_rootToggle->setChecked(m_isRootShell);        
@@ -364,99 +440,187 @@ QWidget* MainWindow::createControlsWidget() {
 
 void MainWindow::loadWorkflowFile() {
     QDir startDir = QDir("/usr/local/etc/shoot_commands");
-    QStringList fns = QFileDialog::getOpenFileNames(this, tr("Load Workflow JSON(s)"), startDir.path(), tr("JSON files (*.json);;All files (*)"));
+    QStringList fns = QFileDialog::getOpenFileNames(this, tr("Load Workflow JSON(s)"), startDir.path(), tr("Workflow files (*.json *.ndjson *.jsonl);;All files (*)"));
     if (fns.isEmpty()) return;
-
+    // Files are read, parsed and validated on the thread pool; jobs are added
+    // afterwards in the order the files were selected.
+    if (fns.count() > 1) appendLog(QString("Loading %1 workflow files...").arg(fns.count()), "#BDBDBD");
+    auto *watcher = new QFutureWatcher<WorkflowLoader::Result>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher]{
+        watcher->deleteLater();
+        addLoadedWorkflows(watcher->future().results());});
+    watcher->setFuture(QtConcurrent::mapped(fns, [](const QString &fn) { return WorkflowLoader::load(fn); }));}
+
+void MainWindow::addLoadedWorkflows(const QList<WorkflowLoader::Result> &results) {
     int successfulLoads = 0;
     QStringList loadedFileNames;
-    for (int i = 0; i < fns.count(); ++i) {
-        const QString &fn = fns.at(i);
-        bool clearExisting = (i == 0);
-        if (m_sequenceRunner->loadWorkflow(fn, clearExisting)) {    
+    for (const WorkflowLoader::Result &result : results) {
+        if (m_workflowQueue->addJob(result) > 0) {    
              successfulLoads++;
-             loadedFileNames.append(QFileInfo(fn).fileName());
+             loadedFileNames.append(QFileInfo(result.path).fileName());
         } else {
-             appendLog(QString("Error loading workflow from: %1").arg(fn), "#F44336");}}
+             appendLog(QString("Error loading workflow from: %1").arg(result.path), "#F44336");}}
     if (successfulLoads > 0) {
-         if (fns.count() == 1) {
-             appendLog(QString("Workflow loaded successfully from: %1.").arg(fns.first()), "#8BC34A");
+         if (results.count() == 1) {
+             appendLog(QString("Workflow loaded successfully from: %1.").arg(results.first().path), "#8BC34A");
          } else {
              appendLog(QString("Successfully loaded %1 workflow files. Files: %2.").arg(successfulLoads).arg(loadedFileNames.join(", ")), "#8BC34A");}}}
 
 void MainWindow::showLoadedWorkflow() {
-    QStringList commands = m_sequenceRunner->getCommandsAsText();
+    QList<int> ids = selectedWorkflowJobs();
+    if (ids.isEmpty()) ids = m_workflowQueue->jobIds();
     QDialog dialog(this);
     dialog.setWindowTitle("Current Workflow Commands");
     dialog.resize(600, 400);
     QVBoxLayout *layout = new QVBoxLayout(&dialog);
-    QTextEdit *textEdit = new QTextEdit();
-    textEdit->setReadOnly(true);
-    textEdit->setFontFamily("Monospace");
-    QString content = "--- TOTAL COMMANDS: " + QString::number(commands.count()) + " ---\n\n";
-    if (commands.isEmpty()) {
-        content += "No commands loaded.";
-    } else {
-        for (int i = 0; i < commands.count(); ++i) {
-            content += QString("[%1] %2\n").arg(i + 1, 2, 10, QChar('0')).arg(commands.at(i));}}
-    textEdit->setText(content);    
-    layout->addWidget(textEdit);
+    if (ids.isEmpty()) {
+        layout->addWidget(new QLabel("No workflows loaded."));}
+    // Rows are rendered on demand, so streamed workflows with millions of
+    // steps open as fast as small ones.
+    WorkflowStepModel *model = new WorkflowStepModel(&dialog);
+    for (int id : ids) {
+        const WorkflowJob *job = m_workflowQueue->job(id);
+        if (job) model->addWorkflow(job->name, job->runner->plan());}
+    connect(m_workflowQueue, &WorkflowQueue::planReplaced, model, [model](int, const WorkflowPlan *previous, std::shared_ptr<const WorkflowPlan> plan){
+        model->replaceWorkflow(previous, std::move(plan));});
+    QListView *view = new QListView();
+    view->setUniformItemSizes(true);
+    view->setFont(QFont("Monospace"));
+    view->setSelectionMode(QAbstractItemView::ExtendedSelection);
+    view->setModel(model);
+    layout->addWidget(view);
     QPushButton *closeButton = new QPushButton("Close");
     connect(closeButton, &QPushButton::clicked, &dialog, &QDialog::accept);
     layout->addWidget(closeButton);
     dialog.exec();}
 
 void MainWindow::updateTimerDisplay() {
-    if (m_sequenceIntervalTimer && m_sequenceTimerDisplay) {
-        if (!m_sequenceIntervalTimer->isActive()) {
-            m_sequenceTimerDisplay->setText("Timer Stopped");
-            return;}
-        QDateTime now = QDateTime::currentDateTime();
-        qint64 msToNext = now.msecsTo(m_nextSequenceTime);
-        if (msToNext <= 0) {
-            m_sequenceTimerDisplay->setText("Running / Delay");
-            return;}
-        int totalSeconds = msToNext / 1000;
-        int seconds = totalSeconds % 60;
-        int minutes = (totalSeconds / 60) % 60;
-        int hours = totalSeconds / 3600;
-        QString display = QString("Next run in: %1:%2:%3")
-                              .arg(hours, 2, 10, QChar('0'))
-                              .arg(minutes, 2, 10, QChar('0'))
-                              .arg(seconds, 2, 10, QChar('0'));
-        m_sequenceTimerDisplay->setText(display);}}
-
-void MainWindow::startIntervalSequence() {
-    appendLog("--- WORKFLOW INTERVAL SEQUENCE RESTARTING ---", "#4CAF50");
-    m_sequenceRunner->startSequence();
-}
+    if (!m_workflowJobList || !m_sequenceTimerDisplay) return;
+    const QDateTime now = QDateTime::currentDateTime();
+    for (int id : m_workflowQueue->jobIds()) {
+        const WorkflowJob *job = m_workflowQueue->job(id);
+        if (job->state == WorkflowJob::Scheduled) updateWorkflowJobItem(id);}
+    const QList<int> ids = selectedWorkflowJobs();
+    const WorkflowJob *job = ids.count() == 1 ? m_workflowQueue->job(ids.first()) : nullptr;
+    if (!job || job->state != WorkflowJob::Scheduled) {
+        m_sequenceTimerDisplay->setText(job && job->state == WorkflowJob::Running ? "Running / Delay" : "Timer Stopped");
+        return;}
+    qint64 msToNext = now.msecsTo(job->nextRun);
+    if (msToNext <= 0) {
+        m_sequenceTimerDisplay->setText("Running / Delay");
+        return;}
+    int totalSeconds = msToNext / 1000;
+    int seconds = totalSeconds % 60;
+    int minutes = (totalSeconds / 60) % 60;
+    int hours = totalSeconds / 3600;
+    QString display = QString("Next run in: %1:%2:%3")
+                          .arg(hours, 2, 10, QChar('0'))
+                          .arg(minutes, 2, 10, QChar('0'))
+                          .arg(seconds, 2, 10, QChar('0'));
+    m_sequenceTimerDisplay->setText(display);}
+
+QList<int> MainWindow::selectedWorkflowJobs() const {
+    QList<int> ids;
+    if (!m_workflowJobList) return ids;
+    for (QTreeWidgetItem *item : m_workflowJobList->selectedItems()) ids.append(item->data(0, Qt::UserRole).toInt());
+    return ids;}
+
+QTreeWidgetItem *MainWindow::workflowJobItem(int jobId) const {
+    for (int i = 0; i < m_workflowJobList->topLevelItemCount(); ++i) {
+        QTreeWidgetItem *item = m_workflowJobList->topLevelItem(i);
+        if (item->data(0, Qt::UserRole).toInt() == jobId) return item;}
+    return nullptr;}
+
+void MainWindow::refreshWorkflowJobList() {
+    const QList<int> selected = selectedWorkflowJobs();
+    m_workflowJobList->clear();
+    for (int id : m_workflowQueue->jobIds()) {
+        auto item = new QTreeWidgetItem(m_workflowJobList);
+        item->setData(0, Qt::UserRole, id);
+        item->setToolTip(0, m_workflowQueue->job(id)->filePath);
+        updateWorkflowJobItem(id);
+        if (selected.contains(id)) item->setSelected(true);}
+    if (selected.isEmpty() && m_workflowJobList->topLevelItemCount() > 0) {
+        m_workflowJobList->topLevelItem(m_workflowJobList->topLevelItemCount() - 1)->setSelected(true);}}
+
+void MainWindow::updateWorkflowJobItem(int jobId) {
+    QTreeWidgetItem *item = workflowJobItem(jobId);
+    const WorkflowJob *job = m_workflowQueue->job(jobId);
+    if (!item || !job) return;
+    item->setText(0, job->name);
+    item->setText(1, QString::number(job->priority));
+    item->setText(2, job->intervalS > 0 ? QString("%1 s").arg(job->intervalS) : QString("-"));
+    item->setText(3, job->state == WorkflowJob::Running
+                         ? QString("Running (%1 commands)").arg(job->runner->commandCount())
+                         : job->stateText());
+    if (job->state == WorkflowJob::Scheduled) {
+        const qint64 s = qMax<qint64>(0, QDateTime::currentDateTime().secsTo(job->nextRun));
+        item->setText(4, QString("%1:%2:%3").arg(s / 3600, 2, 10, QChar('0')).arg((s / 60) % 60, 2, 10, QChar('0')).arg(s % 60, 2, 10, QChar('0')));
+    } else {
+        item->setText(4, QString());}
+    if (item->isSelected() && selectedWorkflowJobs().count() == 1) onWorkflowJobSelected();}
+
+void MainWindow::onWorkflowJobSelected() {
+    const QList<int> ids = selectedWorkflowJobs();
+    if (ids.count() != 1) return;
+    const WorkflowJob *job = m_workflowQueue->job(ids.first());
+    if (!job) return;
+    const QSignalBlocker b1(m_sequenceIntervalToggle);
+    const QSignalBlocker b2(m_sequenceIntervalSpinBox);
+    const QSignalBlocker b3(m_workflowPrioritySpinBox);
+    m_sequenceIntervalToggle->setChecked(job->intervalS > 0);
+    if (job->intervalS > 0) m_sequenceIntervalSpinBox->setValue(job->intervalS);
+    m_workflowPrioritySpinBox->setValue(job->priority);}
+
+void MainWindow::applyWorkflowSchedule() {
+    const int seconds = m_sequenceIntervalToggle->isChecked() ? m_sequenceIntervalSpinBox->value() : 0;
+    for (int id : selectedWorkflowJobs()) m_workflowQueue->setInterval(id, seconds);}
+
+void MainWindow::runSelectedWorkflows() {
+    QList<int> ids = selectedWorkflowJobs();
+    if (ids.isEmpty()) ids = m_workflowQueue->jobIds();
+    if (ids.isEmpty()) {
+        appendLog("No workflows loaded. Please load a workflow file.", "#F44336");
+        return;}
+    for (int id : ids) m_workflowQueue->enqueue(id);}
 
 void MainWindow::stopIntervalSequence() {
-    m_sequenceRunner->stopSequence(true);
-    if (m_sequenceIntervalTimer->isActive()) {
-        m_sequenceIntervalTimer->stop();}
-    if (m_sequenceIntervalToggle->isChecked()) {
-         m_sequenceIntervalToggle->setChecked(false);}
+    QList<int> ids = selectedWorkflowJobs();
+    if (ids.isEmpty()) ids = m_workflowQueue->jobIds();
+    for (int id : ids) m_workflowQueue->stopJob(id);
+    onWorkflowJobSelected();
     updateTimerDisplay();
     appendLog("--- MANUAL INTERVAL STOP ---", "#F44336");}
 
-void MainWindow::onSequenceStarted() {
-    appendLog("--- HEADLESS SEQUENCE STARTED ---", "#4CAF50");
+void MainWindow::removeSelectedWorkflows() {
+    for (int id : selectedWorkflowJobs()) m_workflowQueue->removeJob(id);}
+
+void MainWindow::onSequenceStarted(int jobId) {
+    const WorkflowJob *job = m_workflowQueue->job(jobId);
+    appendLog(QString("--- HEADLESS SEQUENCE STARTED: %1 ---").arg(job ? job->name : QString()), "#4CAF50");
     if (m_dockWorkflow) {
         m_dockWorkflow->setVisible(true);
         m_dockWorkflow->raise();}}
 
-void MainWindow::onSequenceFinished(bool success) {
+void MainWindow::onSequenceFinished(int jobId, bool success) {
+    const WorkflowJob *job = m_workflowQueue->job(jobId);
+    const QString name = job ? job->name : QString();
     if (success) {
-        appendLog("--- HEADLESS SEQUENCE FINISHED SUCCESSFULLY ---", "#4CAF50");
+        appendLog(QString("--- HEADLESS SEQUENCE FINISHED SUCCESSFULLY: %1 ---").arg(name), "#4CAF50");
     } else {
-        appendLog("--- HEADLESS SEQUENCE TERMINATED WITH ERROR ---", "#F44336");
-        if (m_sequenceIntervalToggle->isChecked()) {
-            m_sequenceIntervalToggle->setChecked(false);}
-        if (m_sequenceIntervalTimer->isActive()) {
-            m_sequenceIntervalTimer->stop();}}}
+        appendLog(QString("--- HEADLESS SEQUENCE TERMINATED WITH ERROR: %1 ---").arg(name), "#F44336");}}
+
+void MainWindow::onWorkflowCommandExecuting(const QString &job, const QString &cmd, int index, int total) {
+    appendLog(QString(">> HEADLESS %1 [%2/%3]: %4").arg(job).arg(index+1).arg(total).arg(cmd), "#00BCD4");}
+
+void MainWindow::onWorkflowOutput(const QString &job, const QString &text) {
+    const QStringList lines = text.split('\n');
+    for (const QString &l : lines) if (!l.trimmed().isEmpty()) appendLog(QString("[%1] %2").arg(job, l.trimmed()), "#A9FFAC");}
 
-void MainWindow::onWorkflowCommandExecuting(const QString &cmd, int index, int total) {
-    appendLog(QString(">> HEADLESS [%1/%2]: %3").arg(index+1).arg(total).arg(cmd), "#00BCD4");}
+void MainWindow::onWorkflowError(const QString &job, const QString &text) {
+    const QStringList lines = text.split('\n');
+    for (const QString &l : lines) if (!l.trimmed().isEmpty()) appendLog(QString("!!! [%1] %2").arg(job, l.trimmed()), "#FF6565");
+    logErrorToFile(text);}
 
 void MainWindow::handleWorkflowLog(const QString &text, const QString &color) {
     appendLog(text, color);}
@@ -472,91 +636,74 @@ void MainWindow::onScheduleButtonClicked() {
     if (safeMode && isDestructiveCommand(cmdText)) {
         QMessageBox::warning(this, "Safe mode", "Application is in Safe Mode. Destructive commands are blocked from scheduling.");
         return;}
-    if (m_commandTimer->isActive()) {
-        m_commandTimer->stop();
+    if (isDestructiveCommand(cmdText)) {
+        auto reply = QMessageBox::question(this, "Confirm", QString("Command looks destructive:\n%1\nSchedule it anyway?").arg(cmdText), QMessageBox::Yes | QMessageBox::No);
+        if (reply != QMessageBox::Yes) return;}
+    if (m_scheduledCommand->isActive()) {
         appendLog("Previous scheduled command canceled.", "#FFAA66");}
-    m_scheduledCommand = cmdText;
-    m_commandTimer->setSingleShot(!periodic);
-    m_commandTimer->setInterval(interval * 1000);
+    QString program;
+    QStringList args;
+    CommandExecutor::shellInvocation(cmdText, m_isRootShell, &program, &args);
     if (periodic) {
-        appendLog(QString("Scheduled periodic command: %1 (every %2 s)").arg(cmdText).arg(interval), "#4CAF50");
+        appendLog(QString("Scheduled periodic command: %1 (every %2 s, overlap: %3)").arg(cmdText).arg(interval).arg(ScheduledCommand::policyName(m_scheduledCommand->overlapPolicy())), "#4CAF50");
     } else {
         appendLog(QString("Scheduled one-shot command: %1 (in %2 s)").arg(cmdText).arg(interval), "#00BCD4");}
-    m_commandTimer->start();}
-
-void MainWindow::executeScheduledCommand() {
-    const QString cmdToRun = m_scheduledCommand;
-    if (m_commandTimer->isSingleShot()) {
-        m_commandTimer->stop();}
-    m_commandEdit->setText(cmdToRun);
-    runCommand();}
+    m_scheduledCommand->start(program, args, interval * 1000, periodic);}
+
+void MainWindow::applyOverlapPolicy() {
+    const auto policy = static_cast<ScheduledCommand::OverlapPolicy>(m_overlapPolicyCombo->currentData().toInt());
+    m_overlapMaxSpinBox->setEnabled(policy == ScheduledCommand::AllowConcurrent);
+    m_scheduledCommand->setOverlapPolicy(policy, m_overlapMaxSpinBox->value());
+    m_settings.setValue("scheduleOverlapPolicy", int(policy));
+    m_settings.setValue("scheduleOverlapMax", m_overlapMaxSpinBox->value());
+    updateScheduleCounters();}
+
+void MainWindow::updateScheduleCounters() {
+    if (!m_scheduleCountersLabel) return;
+    m_scheduleCountersLabel->setText(QString("Skipped: %1  Late: %2  Killed: %3")
+                                         .arg(m_scheduledCommand->skippedTicks())
+                                         .arg(m_scheduledCommand->lateTicks())
+                                         .arg(m_scheduledCommand->killedRuns()));}
 
 void MainWindow::loadCommands() {
-    m_commands.clear();
-    std::ifstream ifs(m_jsonFile.toStdString());
-    if (!ifs.is_open()) {
-        QStringList cats = {
-            "System", "systemctl", "config"};
-        for (const QString &c: cats) m_commands.insert(c, {});
+    const QStringList cats = { "System", "systemctl", "config" };
+    m_commandModel->setCategory(QString());
+    if (!QFileInfo::exists(m_jsonFile)) {
+        m_commands.reset(cats);
         saveCommands();
         return;}
-    try {
-        nlohmann::json j;
-        ifs >> j;            
-        for (auto it = j.begin(); it != j.end(); ++it) {
-            const QString category = QString::fromStdString(it.key());
-            QVector<SystemCmd> vec;            
-            if (it.value().is_array()) {
-                for (const auto& cmd_obj : it.value()) {
-                    if (cmd_obj.is_object() && cmd_obj.contains("command") && cmd_obj.contains("description")) {
-                        SystemCmd c;
-                        c.command = QString::fromStdString(cmd_obj.at("command").get<std::string>());
-                        c.description = QString::fromStdString(cmd_obj.at("description").get<std::string>());
-                        vec.append(c);}}}
-            m_commands.insert(category, vec);}
-    } catch (const nlohmann::json::exception& e) {
-        QMessageBox::warning(this, "Error JSON", QString("Cannot parse JSON file: %1\nError: %2").arg(m_jsonFile).arg(e.what()));
-        QStringList cats = { "System", "systemctl", "config" };
-        for (const QString &c: cats) m_commands.insert(c, {});
+    QString error;
+    if (!m_commands.load(m_jsonFile, &error)) {
+        QMessageBox::warning(this, "Error JSON", QString("Cannot parse JSON file: %1\nError: %2").arg(m_jsonFile).arg(error));
+        m_commands.reset(cats);
         return;}}
 
 void MainWindow::saveCommands() {
-    nlohmann::json j_root = nlohmann::json::object();
-    for (auto it = m_commands.begin(); it != m_commands.end(); ++it) {
-        nlohmann::json j_array = nlohmann::json::array();
-        for (const SystemCmd &c: it.value()) {
-            j_array.push_back({
-                {"command", c.command.toStdString()},
-                {"description", c.description.toStdString()}});}
-        j_root[it.key().toStdString()] = j_array;}
     QFileInfo fileInfo(m_jsonFile);
     QString dirPath = fileInfo.absolutePath();
     QDir dir;
     if (!dir.mkpath(dirPath)) {
         QMessageBox::critical(this, "Error Save JSON", QString("Cannot create directory: %1. Check permissions (or run as root).").arg(dirPath));
         return;}
-    try {
-        std::ofstream ofs(m_jsonFile.toStdString());
-        if (ofs.is_open()) {
-            ofs << j_root.dump(4);
-            ofs.close();
-        } else {
-            QMessageBox::critical(this, "Error Save JSON", QString("Cannot write JSON: %1. Check permissions (or run as root).").arg(m_jsonFile));}
-    } catch (const std::exception& e) {
-        QMessageBox::warning(this, "Error JSON Save", QString("Cannot save JSON file: %1").arg(e.what()));}}
+    QString error;
+    if (!m_commands.save(m_jsonFile, &error)) {
+        QMessageBox::critical(this, "Error Save JSON", QString("Cannot write JSON: %1. Check permissions (or run as root).").arg(m_jsonFile));}}
 
 void MainWindow::populateCategoryList() {
     m_categoryList->clear();
-    for (auto it = m_commands.constBegin(); it != m_commands.constEnd(); ++it) m_categoryList->addItem(it.key());
+    m_categoryList->addItems(m_commands.categories());
 }
 
+// Adds and removes only the categories that changed, keeping the selection.
+void MainWindow::syncCategoryList() {
+    const QStringList categories = m_commands.categories();
+    for (int i = m_categoryList->count() - 1; i >= 0; --i) {
+        if (!categories.contains(m_categoryList->item(i)->text())) delete m_categoryList->takeItem(i);}
+    for (int i = 0; i < categories.size(); ++i) {
+        if (i >= m_categoryList->count() || m_categoryList->item(i)->text() != categories.at(i)) m_categoryList->insertItem(i, categories.at(i));}}
+
 void MainWindow::populateCommandList(const QString &category) {
-    m_commandModel->removeRows(0, m_commandModel->rowCount());
-    auto vec = m_commands.value(category);
-    for (const SystemCmd &c: vec) {
-        QList<QStandardItem*> row;
-        row << new QStandardItem(c.command) << new QStandardItem(c.description);
-        m_commandModel->appendRow(row);}
+    m_commandModel->setCategory(category);
     m_commandView->resizeColumnToContents(1);}
 
 void MainWindow::onCategoryChanged(QListWidgetItem *current, QListWidgetItem *) {
@@ -569,7 +716,7 @@ void MainWindow::onCommandSelected(const QModelIndex &current, const QModelIndex
     if (!current.isValid()) return;
     QModelIndex s = m_commandProxy->mapToSource(current);
     if (s.isValid()) {
-        QString cmd = m_commandModel->item(s.row(), 0)->text();
+        QString cmd = m_commandModel->command(s.row());
         m_commandEdit->setText(cmd);
         if (m_dockControls) { m_dockControls->setVisible(true); m_dockControls->raise(); if (m_commandEdit) { m_commandEdit->setFocus(); m_commandEdit->selectAll(); } }}}
 
@@ -577,7 +724,7 @@ void MainWindow::onCommandDoubleClicked(const QModelIndex &index) {
     if (!index.isValid()) return;
     QModelIndex s = m_commandProxy->mapToSource(index);
     if (s.isValid()) {
-        QString cmd = m_commandModel->item(s.row(), 0)->text();
+        QString cmd = m_commandModel->command(s.row());
         m_commandEdit->setText(cmd);
         runCommand();}}
 
@@ -593,21 +740,16 @@ void MainWindow::runCommand() {
         if (reply != QMessageBox::Yes) return;}
     if (m_inputHistory.isEmpty() || m_inputHistory.last() != cmdText) m_inputHistory.append(cmdText);
     m_inputHistoryIndex = -1;
-    QString program;
-    QStringList args;        
     if (m_isRootShell) {
-        program = "/usr/bin/sudo";  
-        args << "-n" << "bash" << "-c" << cmdText;            
         appendLog(QString(">>> root: %1").arg(cmdText), "#FF0000");
     } else {
-        program = "/bin/bash";  
-        args << "-c" << cmdText;
         appendLog(QString(">>> user: %1").arg(cmdText), "#FFE066");}
-    m_executor->runSystemCommand(program, args);}
+    m_executor->runShellCommand(cmdText, m_isRootShell);}
 
 void MainWindow::stopCommand() {
     if (m_executor) {
         m_executor->stop();
+        m_scheduledCommand->stopProcesses();
         appendLog("Process stopped by user.", "#FFAA66");}}
 
 void MainWindow::onOutput(const QString &text) {
@@ -630,17 +772,15 @@ void MainWindow::addCommand() {
     if (!ok) return;
     QString category = m_categoryList->currentItem() ? m_categoryList->currentItem()->text() : QString();
     if (category.isEmpty()) { QMessageBox::warning(this, "No category", "Select a category first."); return; }
-    m_commands[category].append({cmd, desc});
-    populateCommandList(category);
-    saveCommands();}
+    applyCommandChange({CommandChange::Add, category, {cmd, desc}, {}});}
 
 void MainWindow::editCommand() {
     QModelIndex idx = m_commandView->currentIndex();
     if (!idx.isValid()) return;
     QModelIndex s = m_commandProxy->mapToSource(idx);
     if (!s.isValid()) return;
-    QString cmd = m_commandModel->item(s.row(), 0)->text();
-    QString desc = m_commandModel->item(s.row(), 1)->text();
+    QString cmd = m_commandModel->command(s.row());
+    QString desc = m_commandModel->description(s.row());
     bool ok;
     QString ncmd = QInputDialog::getText(this, "Edit command", "Command:", QLineEdit::Normal, cmd, &ok);
     if (!ok) return;
@@ -648,25 +788,25 @@ void MainWindow::editCommand() {
     if (!ok) return;
     QString category = m_categoryList->currentItem() ? m_categoryList->currentItem()->text() : QString();
     if (category.isEmpty()) return;
-    auto &vec = m_commands[category];
-    for (int i=0;i<vec.size();++i) {
-        if (vec[i].command == cmd && vec[i].description == desc) { vec[i].command = ncmd; vec[i].description = ndesc; break; }}
-    populateCommandList(category);
-    saveCommands();}
+    applyCommandChange({CommandChange::Replace, category, {cmd, desc}, {ncmd, ndesc}});}
 
 void MainWindow::removeCommand() {
     QModelIndex idx = m_commandView->currentIndex();
     if (!idx.isValid()) return;
     QModelIndex s = m_commandProxy->mapToSource(idx);
     if (!s.isValid()) return;
-    QString cmd = m_commandModel->item(s.row(), 0)->text();
+    QString cmd = m_commandModel->command(s.row());
+    QString desc = m_commandModel->description(s.row());
     QString category = m_categoryList->currentItem() ? m_categoryList->currentItem()->text() : QString();
     if (category.isEmpty()) return;
-    auto &vec = m_commands[category];
-    for (int i=0;i<vec.size();++i) {
-        if (vec[i].command == cmd) { vec.removeAt(i); break; }}
-    populateCommandList(category);
-    saveCommands();}
+    applyCommandChange({CommandChange::Remove, category, {cmd, desc}, {}});}
+
+void MainWindow::applyCommandChange(const CommandChange &change) {
+    QString error;
+    if (!m_commands.change(change, &error)) {
+        QMessageBox::critical(this, "Error Save JSON", QString("Cannot record the change in %1: %2").arg(m_jsonFile, error));
+        return;}
+    populateCommandList(change.category);}
 
 void MainWindow::onProcessFinished(int exitCode, QProcess::ExitStatus) {
     appendLog(QString("Process finished. Exit code: %1").arg(exitCode), "#BDBDBD");
@@ -717,8 +857,21 @@ void MainWindow::restoreDefaultLayout() {
 void MainWindow::showSettingsDialog() {
     SettingsDialog dlg(this);
     dlg.setSafeMode(m_settings.value("safeMode", false).toBool());
+    dlg.setRootBroker(m_settings.value("rootBroker", false).toBool());
     if (dlg.exec() == QDialog::Accepted) {
-        m_settings.setValue("safeMode", dlg.safeMode());}}
+        m_settings.setValue("safeMode", dlg.safeMode());
+        m_settings.setValue("rootBroker", dlg.rootBroker());
+        applyRootBrokerSetting();}}
+
+void MainWindow::applyRootBrokerSetting() {
+    if (!m_settings.value("rootBroker", false).toBool()) {
+        CommandExecutor::disableRootBroker();
+        return;}
+    RootBroker *broker = CommandExecutor::enableRootBroker();
+    connect(broker, &RootBroker::stateChanged, this, &MainWindow::onRootBrokerStateChanged, Qt::UniqueConnection);}
+
+void MainWindow::onRootBrokerStateChanged(bool ready, const QString &message) {
+    appendLog(message, ready ? "#4CAF50" : "#FFAA66");}
 
 void MainWindow::restoreWindowStateFromSettings() {
     if (m_settings.contains("geometry")) restoreGeometry(m_settings.value("geometry").toByteArray());
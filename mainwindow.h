@@ -1,7 +1,7 @@
 #ifndef MAINWINDOW_H
 #define MAINWINDOW_H
 
-#include "systemcmd.h"
+#include "commandstore.h"
 #include <QMainWindow>
 #include <QMap>
 #include <QVector>
@@ -11,7 +11,7 @@
 #include <QCheckBox>
 #include <QTimer>
 #include <QDateTime>
-#include "nlohmann/json.hpp"
+#include "workflowloader.h"
 
 class QListWidget;
 class QListWidgetItem;
@@ -19,15 +19,19 @@ class QLineEdit;
 class QTextEdit;
 class QDockWidget;
 class QTreeView;
-class QStandardItemModel;
+class CommandListModel;
 class QSortFilterProxyModel;
 class QPushButton;
 class QSpinBox;
 class CommandExecutor;
 class QAction;
 class LogDialog;
-class SequenceRunner;
 class QLabel;
+class QTreeWidget;
+class QTreeWidgetItem;
+class WorkflowQueue;
+class ScheduledCommand;
+class QComboBox;
 
 class MainWindow : public QMainWindow {
     Q_OBJECT
@@ -59,18 +63,27 @@ private slots:
     // General UI Slots
     void restoreDefaultLayout();
     void showSettingsDialog();    
+    void onRootBrokerStateChanged(bool ready, const QString &message);
     // Manual Scheduler Slots
     void onScheduleButtonClicked();
-    void executeScheduledCommand();
+    void applyOverlapPolicy();
+    void updateScheduleCounters();
     // Workflow / Sequence Slots
     void loadWorkflowFile();
-    void onSequenceStarted();
-    void onSequenceFinished(bool success);
-    void onWorkflowCommandExecuting(const QString &cmd, int index, int total);
+    void onSequenceStarted(int jobId);
+    void onSequenceFinished(int jobId, bool success);
+    void onWorkflowCommandExecuting(const QString &job, const QString &cmd, int index, int total);
+    void onWorkflowOutput(const QString &job, const QString &text);
+    void onWorkflowError(const QString &job, const QString &text);
     void handleWorkflowLog(const QString &text, const QString &color);
     void showLoadedWorkflow();
-    void startIntervalSequence();
+    void runSelectedWorkflows();
     void stopIntervalSequence();
+    void removeSelectedWorkflows();
+    void onWorkflowJobSelected();
+    void applyWorkflowSchedule();
+    void refreshWorkflowJobList();
+    void updateWorkflowJobItem(int jobId);
     void updateTimerDisplay();
 
 private:
@@ -82,7 +95,7 @@ private:
     QDockWidget *m_dockWorkflow = nullptr;    
     QListWidget *m_categoryList = nullptr;
     QTreeView *m_commandView = nullptr;
-    QStandardItemModel *m_commandModel = nullptr;
+    CommandListModel *m_commandModel = nullptr;
     QSortFilterProxyModel *m_commandProxy = nullptr;
     QLineEdit *m_commandEdit = nullptr;
     QTextEdit *m_log = nullptr;    
@@ -96,20 +109,22 @@ private:
     QSpinBox *m_intervalSpinBox = nullptr;
     QCheckBox *m_periodicToggle = nullptr;
     QPushButton *m_scheduleBtn = nullptr;
-    QTimer *m_commandTimer = nullptr;
-    QString m_scheduledCommand;
+    QComboBox *m_overlapPolicyCombo = nullptr;
+    QSpinBox *m_overlapMaxSpinBox = nullptr;
+    QLabel *m_scheduleCountersLabel = nullptr;
+    ScheduledCommand *m_scheduledCommand = nullptr;
     // Workflow Widgets & Logic
-    SequenceRunner *m_sequenceRunner = nullptr;
-    QStringList m_workflowQueue; 
-    QTimer *m_sequenceIntervalTimer = nullptr; 
+    WorkflowQueue *m_workflowQueue = nullptr;
+    QTreeWidget *m_workflowJobList = nullptr;
     QTimer *m_displayTimer = nullptr;          
-    QDateTime m_nextSequenceTime;
     QCheckBox *m_sequenceIntervalToggle = nullptr;
     QSpinBox *m_sequenceIntervalSpinBox = nullptr;
+    QSpinBox *m_workflowPrioritySpinBox = nullptr;
+    QSpinBox *m_workflowParallelSpinBox = nullptr;
     QLabel *m_sequenceTimerDisplay = nullptr;
     QPushButton *m_showJsonBtn = nullptr;
     // Data & Core
-    QMap<QString, QVector<SystemCmd>> m_commands;
+    CommandStore m_commands;
     CommandExecutor *m_executor = nullptr;
     QString m_jsonFile = QStringLiteral("shoot_commands.json");
     QStringList m_inputHistory;
@@ -129,15 +144,21 @@ private:
     void setupWorkflowDock();
     void populateCategoryList();
     void populateCommandList(const QString &category);
+    void syncCategoryList();
     void appendLog(const QString &text, const QString &color = QString());
     void logErrorToFile(const QString &text);
     bool isDestructiveCommand(const QString &cmd);
     void ensureJsonPathLocal();
     void setupMenus();
     void navigateHistory(int direction);
+    void applyRootBrokerSetting();
+    void addLoadedWorkflows(const QList<WorkflowLoader::Result> &results);
+    void applyCommandChange(const CommandChange &change);
     void restoreWindowStateFromSettings();
     void saveWindowStateToSettings();
     QModelIndex currentCommandModelIndex() const;
+    QList<int> selectedWorkflowJobs() const;
+    QTreeWidgetItem *workflowJobItem(int jobId) const;
 };
 
 #endif // MAINWINDOW_H
@@ -0,0 +1,131 @@
+#include "matrixrunner.h"
+#include "commandexecutor.h"
+#include <QDir>
+#include <QJsonValue>
+
+QString MatrixSpec::describe() const {
+    const QString suffix = backend == CommandExecutor::EpollBackend ? QStringLiteral(", epoll") : QString();
+    switch (source) {
+    case None: return QString();
+    case Inline: return QString("forEach %1 items, max %2 parallel%3").arg(items.count()).arg(maxParallel).arg(suffix);
+    case File: return QString("forEach line of %1, max %2 parallel%3").arg(path).arg(maxParallel).arg(suffix);
+    case StepOutput: return QString("forEach output line of step '%1', max %2 parallel%3").arg(stepId).arg(maxParallel).arg(suffix);}
+    return QString();}
+
+void MatrixSpec::resolvePath(const QString &dir) {
+    if (source == File && QDir::isRelativePath(path)) path = QDir(dir).absoluteFilePath(path);}
+
+bool JsonArrayItemSource::next(QString *item) {
+    if (m_pos >= m_items.count()) return false;
+    const QJsonValue v = m_items.at(m_pos++);
+    *item = v.isString() ? v.toString() : v.toVariant().toString();
+    return true;}
+
+bool FileLineItemSource::next(QString *item) {
+    while (!m_file.atEnd()) {
+        const QString line = QString::fromUtf8(m_file.readLine()).trimmed();
+        if (!line.isEmpty()) {
+            *item = line;
+            return true;}}
+    return false;}
+
+bool TextLineItemSource::next(QString *item) {
+    while (m_pos < m_text.size()) {
+        qsizetype nl = m_text.indexOf('\n', m_pos);
+        if (nl < 0) nl = m_text.size();
+        const QStringView line = QStringView(m_text).mid(m_pos, nl - m_pos).trimmed();
+        m_pos = nl + 1;
+        if (!line.isEmpty()) {
+            *item = line.toString();
+            return true;}}
+    return false;}
+
+MatrixRunner::MatrixRunner(QObject *parent) : QObject(parent) {}
+
+MatrixRunner::~MatrixRunner() {
+    m_running = false;
+    for (CommandExecutor *ex : m_executors) ex->disconnect(this);}
+
+void MatrixRunner::start(const CommandTemplate &command, bool asRoot, bool stopOnError, int maxParallel,
+                         std::unique_ptr<MatrixItemSource> source, CommandExecutor::Backend backend) {
+    stop();
+    if (backend != m_backend) {
+        // The pool is idle after stop(); rebuild it for the other backend.
+        for (CommandExecutor *ex : m_executors) {
+            ex->disconnect(this);
+            ex->deleteLater();}
+        m_executors.clear();
+        m_backend = backend;}
+    m_command = command;
+    m_asRoot = asRoot;
+    m_stopOnError = stopOnError;
+    m_maxParallel = qMax(1, maxParallel);
+    m_source = std::move(source);
+    m_running = true;
+    m_exhausted = false;
+    m_halted = false;
+    m_launched = 0;
+    m_succeeded = 0;
+    m_failed = 0;
+    m_firstFailure = 0;
+    fill();}
+
+void MatrixRunner::stop() {
+    if (!m_running) return;
+    m_running = false;
+    for (CommandExecutor *ex : m_executors) ex->stop();
+    m_active.clear();
+    m_source.reset();}
+
+void MatrixRunner::fill() {
+    if (m_filling) return;
+    m_filling = true;
+    while (m_running && !m_exhausted && !m_halted && m_active.count() < m_maxParallel) {
+        QString item;
+        if (!m_source->next(&item)) {
+            m_exhausted = true;
+            break;}
+        const QString index = QString::number(m_launched++);
+        const QString command = m_command.expand([&](const QString &name) -> const QString * {
+            if (name == u"item") return &item;
+            if (name == u"index") return &index;
+            if (m_variables) {
+                const auto it = m_variables->constFind(name);
+                if (it != m_variables->cend()) return &it.value();}
+            return nullptr;});
+        CommandExecutor *ex = idleExecutor();
+        m_active.insert(ex, item);
+        ex->runShellCommand(command, m_asRoot);}
+    m_filling = false;
+    if (m_running && m_active.isEmpty() && (m_exhausted || m_halted)) {
+        m_running = false;
+        m_source.reset();
+        emit logMessage(QString("forEach finished: %1 succeeded, %2 failed%3.")
+                            .arg(m_succeeded).arg(m_failed).arg(m_halted ? ", remaining items skipped" : ""),
+                        m_failed ? "#F44336" : "#4CAF50");
+        emit finished(m_failed ? m_firstFailure : 0);}}
+
+void MatrixRunner::onRunFinished(CommandExecutor *executor, int exitCode) {
+    if (!m_running || !m_active.contains(executor)) return;
+    const QString item = m_active.take(executor);
+    if (exitCode == 0) {
+        m_succeeded++;
+    } else {
+        if (m_failed++ == 0) m_firstFailure = exitCode;
+        emit logMessage(QString("forEach item '%1' failed with code %2.").arg(item).arg(exitCode), "#FF6565");
+        if (m_stopOnError) m_halted = true;}
+    const int done = m_succeeded + m_failed;
+    if (done % 100 == 0) {
+        emit logMessage(QString("forEach progress: %1 done, %2 running.").arg(done).arg(m_active.count()), "#BDBDBD");}
+    fill();}
+
+CommandExecutor *MatrixRunner::idleExecutor() {
+    for (CommandExecutor *ex : m_executors) {
+        if (!m_active.contains(ex)) return ex;}
+    auto ex = new CommandExecutor(this, m_backend);
+    connect(ex, &CommandExecutor::outputReceived, this, &MatrixRunner::outputReceived);
+    connect(ex, &CommandExecutor::errorReceived, this, &MatrixRunner::errorReceived);
+    connect(ex, &CommandExecutor::finished, this, [this, ex](int exitCode, QProcess::ExitStatus){
+        onRunFinished(ex, exitCode);});
+    m_executors.append(ex);
+    return ex;}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <QObject>
+#include <QProcess>
+#include <QJsonArray>
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <memory>
+#include "commandtemplate.h"
+#include "commandexecutor.h"
+
+struct MatrixSpec {
+    enum Source { None, Inline, File, StepOutput };
+    Source source = None;
+    QJsonArray items;    // Inline
+    QString path;        // File: one item per line
+    QString stepId;      // StepOutput: lines of an earlier step's stdout
+    int maxParallel = 4;
+    CommandExecutor::Backend backend = CommandExecutor::defaultBackend();
+    QString describe() const;
+    // A relative File path names a file next to the workflow, in dir.
+    void resolvePath(const QString &dir);
+};
+
+// Yields matrix items one at a time so large lists are never expanded up front.
+class MatrixItemSource {
+public:
+    virtual ~MatrixItemSource() = default;
+    virtual bool next(QString *item) = 0;
+};
+
+class JsonArrayItemSource : public MatrixItemSource {
+public:
+    explicit JsonArrayItemSource(const QJsonArray &items) : m_items(items) {}
+    bool next(QString *item) override;
+private:
+    QJsonArray m_items;
+    qsizetype m_pos = 0;
+};
+
+class FileLineItemSource : public MatrixItemSource {
+public:
+    explicit FileLineItemSource(const QString &path) : m_file(path) {}
+    bool open() { return m_file.open(QIODevice::ReadOnly | QIODevice::Text); }
+    bool next(QString *item) override;
+private:
+    QFile m_file;
+};
+
+class TextLineItemSource : public MatrixItemSource {
+public:
+    explicit TextLineItemSource(const QString &text) : m_text(text) {}
+    bool next(QString *item) override;
+private:
+    QString m_text;
+    qsizetype m_pos = 0;
+};
+
+// Runs one templated command per item with at most maxParallel processes in flight.
+// finished() carries 0 when every expansion succeeded, otherwise the first failing exit code.
+class MatrixRunner : public QObject {
+    Q_OBJECT
+public:
+    explicit MatrixRunner(QObject *parent = nullptr);
+    ~MatrixRunner();
+    void start(const CommandTemplate &command, bool asRoot, bool stopOnError, int maxParallel,
+               std::unique_ptr<MatrixItemSource> source,
+               CommandExecutor::Backend backend = CommandExecutor::defaultBackend());
+    void stop();
+    bool isRunning() const { return m_running; }
+    // Extra {{name}} values (captured workflow variables); must outlive the run.
+    void setVariables(const QHash<QString, QString> *variables) { m_variables = variables; }
+
+signals:
+    void outputReceived(const QString &text);
+    void errorReceived(const QString &text);
+    void logMessage(const QString &text, const QString &color);
+    void finished(int exitCode);
+
+private:
+    CommandTemplate m_command;
+    std::unique_ptr<MatrixItemSource> m_source;
+    const QHash<QString, QString> *m_variables = nullptr;
+    QList<CommandExecutor *> m_executors;
+    QHash<CommandExecutor *, QString> m_active;   // executor -> item it is running
+    bool m_running = false;
+    bool m_asRoot = false;
+    bool m_stopOnError = true;
+    bool m_exhausted = false;
+    bool m_halted = false;
+    bool m_filling = false;
+    int m_maxParallel = 4;
+    CommandExecutor::Backend m_backend = CommandExecutor::defaultBackend();
+    int m_launched = 0;
+    int m_succeeded = 0;
+    int m_failed = 0;
+    int m_firstFailure = 0;
+    void fill();
+    void onRunFinished(CommandExecutor *executor, int exitCode);
+    CommandExecutor *idleExecutor();
+};
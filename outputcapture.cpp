@@ -0,0 +1,114 @@
+#include "outputcapture.h"
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QJsonValue>
+
+OutputCapture OutputCapture::fromJson(const QJsonValue &value, QString *error) {
+    OutputCapture c;
+    if (value.isString()) {
+        c.m_name = value.toString();
+        c.m_mode = All;
+    } else if (value.isObject()) {
+        const QJsonObject obj = value.toObject();
+        c.m_name = obj.value("name").toString();
+        if (obj.contains("regex")) {
+            c.m_mode = Regex;
+            c.m_regex.setPattern(obj.value("regex").toString());
+            c.m_regex.setPatternOptions(QRegularExpression::MultilineOption);
+            c.m_group = obj.value("group").toInt(c.m_regex.captureCount() > 0 ? 1 : 0);
+            if (!c.m_regex.isValid()) {
+                *error = QString("invalid captureAs regex '%1': %2").arg(c.m_regex.pattern(), c.m_regex.errorString());
+                return OutputCapture();}
+            if (c.m_group < 0 || c.m_group > c.m_regex.captureCount()) {
+                *error = QString("captureAs group %1 does not exist in '%2'").arg(c.m_group).arg(c.m_regex.pattern());
+                return OutputCapture();}
+        } else if (obj.contains("jsonPath")) {
+            c.m_mode = JsonPath;
+            c.m_pathSource = obj.value("jsonPath").toString();
+            if (!parsePath(c.m_pathSource, &c.m_path)) {
+                *error = QString("invalid captureAs jsonPath '%1'").arg(c.m_pathSource);
+                return OutputCapture();}
+        } else {
+            c.m_mode = obj.value("lastLine").toBool(false) ? LastLine : All;}
+    } else {
+        *error = "captureAs must be a variable name or an object";
+        return OutputCapture();}
+    if (c.m_name.isEmpty()) {
+        *error = "captureAs needs a variable name";
+        return OutputCapture();}
+    return c;}
+
+// "a.b[2].c" -> key a, key b, index 2, key c
+bool OutputCapture::parsePath(const QString &path, QList<PathToken> *tokens) {
+    qsizetype pos = 0;
+    if (path.startsWith(QLatin1Char('$'))) pos = 1;
+    while (pos < path.size()) {
+        const QChar c = path.at(pos);
+        if (c == QLatin1Char('.')) {
+            pos++;
+            continue;}
+        PathToken token;
+        if (c == QLatin1Char('[')) {
+            const qsizetype close = path.indexOf(QLatin1Char(']'), pos);
+            if (close < 0) return false;
+            bool ok = false;
+            token.index = QStringView(path).mid(pos + 1, close - pos - 1).toInt(&ok);
+            if (!ok || token.index < 0) return false;
+            pos = close + 1;
+        } else {
+            qsizetype end = pos;
+            while (end < path.size() && path.at(end) != QLatin1Char('.') && path.at(end) != QLatin1Char('[')) end++;
+            token.key = path.mid(pos, end - pos);
+            pos = end;}
+        tokens->append(token);}
+    return !tokens->isEmpty();}
+
+QString OutputCapture::describe() const {
+    switch (m_mode) {
+    case None: return QString();
+    case All: return QString("capture stdout as %1").arg(m_name);
+    case LastLine: return QString("capture last line as %1").arg(m_name);
+    case Regex: return QString("capture /%1/ group %2 as %3").arg(m_regex.pattern()).arg(m_group).arg(m_name);
+    case JsonPath: return QString("capture %1 as %2").arg(m_pathSource, m_name);}
+    return QString();}
+
+bool OutputCapture::extract(const QString &output, QString *value) const {
+    switch (m_mode) {
+    case None:
+        return false;
+    case All:
+        *value = output.trimmed();
+        return true;
+    case LastLine: {
+        qsizetype end = output.size();
+        while (end > 0) {
+            const qsizetype nl = output.lastIndexOf(QLatin1Char('\n'), end - 1);
+            const QStringView line = QStringView(output).mid(nl + 1, end - nl - 1).trimmed();
+            if (!line.isEmpty()) {
+                *value = line.toString();
+                return true;}
+            end = nl < 0 ? 0 : nl;}
+        return false;}
+    case Regex: {
+        const QRegularExpressionMatch match = m_regex.match(output);
+        if (!match.hasMatch()) return false;
+        *value = match.captured(m_group);
+        return true;}
+    case JsonPath: {
+        QJsonParseError err;
+        const QJsonDocument doc = QJsonDocument::fromJson(output.toUtf8(), &err);
+        if (err.error != QJsonParseError::NoError) return false;
+        QJsonValue current = doc.isArray() ? QJsonValue(doc.array()) : QJsonValue(doc.object());
+        for (const PathToken &token : m_path) {
+            if (token.index >= 0) {
+                if (!current.isArray() || token.index >= current.toArray().count()) return false;
+                current = current.toArray().at(token.index);
+            } else {
+                if (!current.isObject() || !current.toObject().contains(token.key)) return false;
+                current = current.toObject().value(token.key);}}
+        if (current.isString()) *value = current.toString();
+        else if (current.isObject()) *value = QString::fromUtf8(QJsonDocument(current.toObject()).toJson(QJsonDocument::Compact));
+        else if (current.isArray()) *value = QString::fromUtf8(QJsonDocument(current.toArray()).toJson(QJsonDocument::Compact));
+        else *value = current.toVariant().toString();
+        return true;}}
+    return false;}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <QString>
+#include <QList>
+#include <QJsonObject>
+#include <QRegularExpression>
+
+// "captureAs" on a workflow step: which part of the step's stdout becomes a
+// variable. Patterns and JSON paths are parsed once when the workflow loads.
+//   "captureAs": "NAME"                                   whole stdout, trimmed
+//   "captureAs": {"name": "NAME", "lastLine": true}       last non-empty line
+//   "captureAs": {"name": "NAME", "regex": "...", "group": 1}
+//   "captureAs": {"name": "NAME", "jsonPath": "data.items[0].id"}
+class OutputCapture {
+public:
+    enum Mode { None, All, LastLine, Regex, JsonPath };
+
+    OutputCapture() = default;
+    static OutputCapture fromJson(const QJsonValue &value, QString *error);
+    bool isValid() const { return m_mode != None; }
+    const QString &name() const { return m_name; }
+    QString describe() const;
+    bool extract(const QString &output, QString *value) const;
+
+private:
+    struct PathToken {
+        QString key;
+        int index = -1;   // >= 0 for [n]
+    };
+    Mode m_mode = None;
+    QString m_name;
+    QRegularExpression m_regex;
+    int m_group = 1;
+    QString m_pathSource;
+    QList<PathToken> m_path;
+    static bool parsePath(const QString &path, QList<PathToken> *tokens);
+};
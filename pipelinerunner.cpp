@@ -0,0 +1,19 @@
+#include "pipelinerunner.h"
+
+PipelineRunner::PipelineRunner(QObject *parent) : QObject(parent), m_executor(nullptr, CommandExecutor::QProcessBackend) {
+    connect(&m_executor, &CommandExecutor::outputReceived, this, &PipelineRunner::outputReceived);
+    connect(&m_executor, &CommandExecutor::errorReceived, this, &PipelineRunner::errorReceived);
+    connect(&m_executor, &CommandExecutor::finished, this, [this](int exitCode, QProcess::ExitStatus){
+        if (!m_running) return;
+        m_running = false;
+        emit finished(exitCode);});}
+
+void PipelineRunner::start(const QList<PipelineStage> &stages) {
+    stop();
+    m_running = true;
+    m_executor.runPipeline(stages);}
+
+void PipelineRunner::stop() {
+    if (!m_running) return;
+    m_running = false;
+    m_executor.stop();}
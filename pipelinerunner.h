@@ -0,0 +1,31 @@
+#pragma once
+
+#include <QObject>
+#include <QList>
+#include "commandexecutor.h"
+
+// Runs stages concurrently with each stage's stdout connected to the next
+// stage's stdin through a kernel pipe, so a slow consumer throttles its
+// producer and nothing is buffered in this process. stderr of every stage and
+// stdout of the last stage are forwarded. finished() follows pipefail: the
+// rightmost non-zero exit code, or 0. The stages live on the executor thread
+// (see CommandExecutor::runPipeline) and always use the QProcess backend.
+class PipelineRunner : public QObject {
+    Q_OBJECT
+public:
+    explicit PipelineRunner(QObject *parent = nullptr);
+    void start(const QList<PipelineStage> &stages);
+    // Kills every stage; finished() is not emitted.
+    void stop();
+    bool isRunning() const { return m_running; }
+    const QList<int> &exitCodes() const { return m_executor.stageExitCodes(); }
+
+signals:
+    void outputReceived(const QString &text);
+    void errorReceived(const QString &text);
+    void finished(int exitCode);
+
+private:
+    CommandExecutor m_executor;
+    bool m_running = false;
+};
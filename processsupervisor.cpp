@@ -0,0 +1,333 @@
+#include "processsupervisor.h"
+#include "spawnhelper.h"
+#include <QSocketNotifier>
+#include <QTimer>
+#include <QFile>
+#include <QElapsedTimer>
+#include <vector>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+namespace {
+enum FdKind { StdoutFd = 0, StderrFd = 1, ExitFd = 2, HelperFd = 3 };
+constexpr int ReadChunk = 64 * 1024;
+constexpr int MaxEvents = 256;
+
+QString errnoText(int err) { return QString::fromLocal8Bit(std::strerror(err)); }
+
+// Each child needs up to three fds in this process; the default soft limit of
+// 1024 would cap fan-out at a few hundred.
+void raiseFdLimit() {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+}
+
+ProcessSupervisor::ProcessSupervisor(QObject *parent) : QObject(parent) {}
+
+ProcessSupervisor::~ProcessSupervisor() {
+    for (auto it = m_children.begin(); it != m_children.end(); ++it) {
+        ::kill(it->pid, SIGKILL);
+        if (!it->viaHelper) waitpid(it->pid, nullptr, WNOHANG);
+        closeFd(&it->outFd);
+        closeFd(&it->errFd);
+        closeFd(&it->pidfd);
+    }
+    if (m_epoll >= 0) ::close(m_epoll);
+}
+
+bool ProcessSupervisor::ensureEpoll() {
+    if (m_epoll >= 0) return true;
+    m_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll < 0) return false;
+    raiseFdLimit();
+    m_readBuffer.resize(ReadChunk);
+    if (SpawnHelper::isRunning()) watch(SpawnHelper::socketFd(), 0, HelperFd);
+    m_notifier = new QSocketNotifier(m_epoll, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &ProcessSupervisor::onEpollReadable);
+    return true;
+}
+
+void ProcessSupervisor::watch(int fd, quint64 key, int kind) {
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.u64 = (key << 2) | quint64(kind);
+    epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev);
+}
+
+void ProcessSupervisor::closeFd(int *fd) {
+    if (*fd < 0) return;
+    if (m_epoll >= 0) epoll_ctl(m_epoll, EPOLL_CTL_DEL, *fd, nullptr);
+    ::close(*fd);
+    *fd = -1;
+}
+
+// The child's stdin/stdout/stderr are opened here, then handed to the spawn
+// helper when it runs, or to a local posix_spawn otherwise.
+void ProcessSupervisor::start(const std::shared_ptr<ProcessChannel> &channel, quint64 run, const QString &program,
+                              const QStringList &args, const ProcessRedirects &redirects) {
+    if (!ensureEpoll()) {
+        channel->post({ProcessEvent::FailedToStart, run, errnoText(errno)});
+        return;
+    }
+    const bool pipeOut = redirects.stdoutFile.isEmpty();
+    const bool pipeErr = redirects.stderrFile.isEmpty() && !redirects.mergeStderr;
+    const int fileFlags = O_WRONLY | O_CREAT | O_CLOEXEC | (redirects.append ? O_APPEND : O_TRUNC);
+    int fds[3] = {-1, -1, -1};
+    int outRead = -1;
+    int errRead = -1;
+    int err = 0;
+    auto openOutput = [&](bool usePipe, const QString &path, int *readEnd) {
+        if (!usePipe) return ::open(QFile::encodeName(path).constData(), fileFlags, 0666);
+        int p[2];
+        if (pipe2(p, O_CLOEXEC) != 0) return -1;
+        // Only our read end is non-blocking; the child writes to a blocking pipe as usual.
+        fcntl(p[0], F_SETFL, O_NONBLOCK);
+        *readEnd = p[0];
+        return p[1];
+    };
+    fds[0] = ::open(QFile::encodeName(redirects.stdinFile.isEmpty() ? QStringLiteral("/dev/null") : redirects.stdinFile).constData(),
+                    O_RDONLY | O_CLOEXEC);
+    if (fds[0] >= 0) fds[1] = openOutput(pipeOut, redirects.stdoutFile, &outRead);
+    if (fds[1] >= 0) fds[2] = redirects.mergeStderr ? fcntl(fds[1], F_DUPFD_CLOEXEC, 3) : openOutput(pipeErr, redirects.stderrFile, &errRead);
+    if (fds[2] < 0) err = errno;
+
+    QList<QByteArray> argv;
+    argv.append(QFile::encodeName(program));
+    for (const QString &arg : args) argv.append(arg.toLocal8Bit());
+    pid_t pid = -1;
+    bool viaHelper = false;
+    if (!err && SpawnHelper::isRunning()) {
+        err = SpawnHelper::spawn(argv, fds, &pid, [this](pid_t exited, int status){ onHelperExit(exited, status); });
+        viaHelper = err == 0;
+        if (err == ENOTCONN || err == ECONNRESET || err == E2BIG) err = 0;   // helper unusable: spawn here
+    }
+    if (!err && !viaHelper) err = spawnLocal(argv, fds, &pid);
+    for (int fd : fds) if (fd >= 0) ::close(fd);
+    if (err) {
+        if (outRead >= 0) ::close(outRead);
+        if (errRead >= 0) ::close(errRead);
+        channel->post({ProcessEvent::FailedToStart, run, errnoText(err)});
+        return;
+    }
+
+    Child child;
+    child.channel = channel;
+    child.run = run;
+    child.pid = pid;
+    child.outFd = outRead;
+    child.errFd = errRead;
+    child.viaHelper = viaHelper;
+    // A helper child is not ours to wait for; its exit arrives as a helper message.
+    if (!viaHelper) child.pidfd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+    const quint64 key = m_nextKey++;
+    if (child.outFd >= 0) watch(child.outFd, key, StdoutFd);
+    if (child.errFd >= 0) watch(child.errFd, key, StderrFd);
+    if (child.pidfd >= 0) {
+        watch(child.pidfd, key, ExitFd);
+    } else if (!viaHelper) {
+        if (!m_reapTimer) {
+            m_reapTimer = new QTimer(this);
+            m_reapTimer->setInterval(50);
+            connect(m_reapTimer, &QTimer::timeout, this, &ProcessSupervisor::pollWithoutPidfd);
+        }
+        m_reapTimer->start();
+    }
+    m_children.insert(key, child);
+    m_byPid.insert(pid, key);
+    m_current.insert(channel.get(), key);
+    channel->post({ProcessEvent::Started, run});
+}
+
+int ProcessSupervisor::spawnLocal(const QList<QByteArray> &argv, const int fds[3], pid_t *pid) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    for (int i = 0; i < 3; ++i) posix_spawn_file_actions_adddup2(&actions, fds[i], i);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t none;
+    sigset_t defaults;
+    sigemptyset(&none);
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    std::vector<char *> args;
+    for (const QByteArray &arg : argv) args.push_back(const_cast<char *>(arg.constData()));
+    args.push_back(nullptr);
+    const int rc = posix_spawnp(pid, args[0], &actions, &attr, args.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    return rc;
+}
+
+// Level-triggered: anything not handled in this pass is reported again.
+void ProcessSupervisor::onEpollReadable() {
+    epoll_event events[MaxEvents];
+    const int n = epoll_wait(m_epoll, events, MaxEvents, 0);
+    for (int i = 0; i < n; ++i) {
+        const quint64 key = events[i].data.u64 >> 2;
+        const int kind = int(events[i].data.u64 & 3);
+        if (kind == HelperFd) {
+            if (!SpawnHelper::processMessages(0, [this](pid_t pid, int status){ onHelperExit(pid, status); })) {
+                onHelperLost();
+            }
+            continue;
+        }
+        if (!m_children.contains(key)) continue;
+        if (kind == ExitFd) reap(key, 0);
+        else readPipe(key, kind);
+    }
+}
+
+void ProcessSupervisor::onHelperExit(pid_t pid, int status) {
+    const auto it = m_byPid.constFind(pid);
+    if (it != m_byPid.cend()) finish(it.value(), true, status);
+}
+
+// Children of a dead helper can no longer be waited for; report them as crashed.
+void ProcessSupervisor::onHelperLost() {
+    const QList<quint64> keys = m_children.keys();
+    for (quint64 key : keys) {
+        if (m_children.value(key).viaHelper) finish(key, false, 0);
+    }
+}
+
+void ProcessSupervisor::pollWithoutPidfd() {
+    bool waiting = false;
+    const QList<quint64> keys = m_children.keys();
+    for (quint64 key : keys) {
+        const Child &child = m_children[key];
+        if (child.pidfd >= 0 || child.viaHelper) continue;
+        if (!reap(key, 0)) waiting = true;
+    }
+    if (!waiting) m_reapTimer->stop();
+}
+
+bool ProcessSupervisor::readPipe(quint64 key, int kind) {
+    Child &child = m_children[key];
+    int *fd = kind == StdoutFd ? &child.outFd : &child.errFd;
+    if (*fd < 0) return false;
+    const ssize_t n = ::read(*fd, m_readBuffer.data(), ReadChunk);
+    if (n > 0) {
+        child.channel->post({kind == StdoutFd ? ProcessEvent::Stdout : ProcessEvent::Stderr, child.run,
+                             QString::fromUtf8(m_readBuffer.constData(), n)});
+        return true;
+    }
+    if (n == 0 || (errno != EAGAIN && errno != EINTR)) closeFd(fd);
+    return false;
+}
+
+// Collects the child if it has exited (waiting up to timeoutMs), posts its
+// remaining output and finished(), and forgets it.
+bool ProcessSupervisor::reap(quint64 key, int timeoutMs) {
+    const Child &child = m_children[key];
+    if (child.viaHelper) {
+        QElapsedTimer timer;
+        timer.start();
+        const auto onExit = [this](pid_t pid, int status){ onHelperExit(pid, status); };
+        while (m_children.contains(key)) {
+            const int left = timeoutMs - int(timer.elapsed());
+            if (left < 0) return false;
+            if (!SpawnHelper::processMessages(left, onExit)) onHelperLost();
+        }
+        return true;
+    }
+    int status = 0;
+    pid_t r = 0;
+    if (child.pidfd >= 0) {
+        if (timeoutMs > 0) {
+            pollfd p{child.pidfd, POLLIN, 0};
+            poll(&p, 1, timeoutMs);
+        }
+        r = waitpid(child.pid, &status, WNOHANG);
+    } else {
+        for (int waited = 0; (r = waitpid(child.pid, &status, WNOHANG)) == 0 && waited < timeoutMs; waited += 10) {
+            usleep(10000);
+        }
+    }
+    if (r == 0) return false;
+    finish(key, r > 0, status);
+    return true;
+}
+
+void ProcessSupervisor::finish(quint64 key, bool collected, int status) {
+    // Bounded, so a grandchild that keeps the pipe open cannot stall us here.
+    for (int i = 0; i < 16 && readPipe(key, StdoutFd); ++i) {}
+    for (int i = 0; i < 16 && readPipe(key, StderrFd); ++i) {}
+    Child &child = m_children[key];
+    closeFd(&child.outFd);
+    closeFd(&child.errFd);
+    closeFd(&child.pidfd);
+    ProcessEvent event;
+    event.kind = ProcessEvent::Finished;
+    event.run = child.run;
+    if (collected && WIFEXITED(status)) {
+        event.exitCode = WEXITSTATUS(status);
+    } else {
+        event.exitCode = collected && WIFSIGNALED(status) ? WTERMSIG(status) : -1;
+        event.exitStatus = QProcess::CrashExit;
+    }
+    child.channel->post(std::move(event));
+    ProcessChannel *channel = child.channel.get();
+    if (m_current.value(channel) == key) m_current.remove(channel);
+    m_byPid.remove(child.pid);
+    m_children.remove(key);
+}
+
+void ProcessSupervisor::stop(ProcessChannel *channel) {
+    const auto it = m_current.constFind(channel);
+    if (it == m_current.cend()) return;
+    const quint64 key = it.value();
+    ::kill(m_children.value(key).pid, SIGKILL);
+    if (!reap(key, 1000)) m_current.remove(channel);
+}
+
+void ProcessSupervisor::detach(ProcessChannel *channel) {
+    m_current.remove(channel);
+}
+
+// Their exits are reaped through epoll as usual.
+void ProcessSupervisor::killDetached(ProcessChannel *channel) {
+    const quint64 current = m_current.value(channel);
+    for (auto it = m_children.cbegin(); it != m_children.cend(); ++it) {
+        if (it->channel.get() == channel && it.key() != current) ::kill(it->pid, SIGKILL);
+    }
+}
+
+// The executor is going away: kill everything it started, detached runs included.
+void ProcessSupervisor::release(ProcessChannel *channel) {
+    m_current.remove(channel);
+    const QList<quint64> keys = m_children.keys();
+    for (quint64 key : keys) {
+        Child &child = m_children[key];
+        if (child.channel.get() != channel) continue;
+        ::kill(child.pid, SIGKILL);
+        if (reap(key, 1000)) continue;
+        Child &stuck = m_children[key];
+        closeFd(&stuck.outFd);
+        closeFd(&stuck.errFd);
+        closeFd(&stuck.pidfd);
+        m_byPid.remove(stuck.pid);
+        m_children.remove(key);
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <QObject>
+#include <QHash>
+#include <QStringList>
+#include <memory>
+#include <sys/types.h>
+#include "commandexecutor.h"
+
+class QSocketNotifier;
+class QTimer;
+
+// Backend for CommandExecutor::EpollBackend. Children are started with
+// posix_spawn (through SpawnHelper when it runs), their stdout/stderr are non-blocking pipes and their exit is
+// observed through a pidfd; all of those fds sit in a single epoll set watched
+// by one QSocketNotifier. A child costs a few fds and a small struct instead of
+// a QProcess with its own notifiers, so thousands can run at once.
+// Lives on the executor thread; every method must be called there.
+class ProcessSupervisor : public QObject {
+    Q_OBJECT
+public:
+    explicit ProcessSupervisor(QObject *parent = nullptr);
+    ~ProcessSupervisor();
+    void start(const std::shared_ptr<ProcessChannel> &channel, quint64 run, const QString &program,
+               const QStringList &args, const ProcessRedirects &redirects);
+    void stop(ProcessChannel *channel);
+    void detach(ProcessChannel *channel);
+    void killDetached(ProcessChannel *channel);
+    void release(ProcessChannel *channel);
+
+private slots:
+    void onEpollReadable();
+    void pollWithoutPidfd();
+
+private:
+    struct Child {
+        std::shared_ptr<ProcessChannel> channel;
+        quint64 run = 0;
+        pid_t pid = -1;
+        int pidfd = -1;
+        int outFd = -1;
+        int errFd = -1;
+        bool viaHelper = false;
+    };
+    int m_epoll = -1;
+    QSocketNotifier *m_notifier = nullptr;
+    QTimer *m_reapTimer = nullptr;   // only for kernels without pidfd_open
+    quint64 m_nextKey = 1;
+    QHash<quint64, Child> m_children;
+    QHash<ProcessChannel *, quint64> m_current;
+    QHash<pid_t, quint64> m_byPid;
+    QByteArray m_readBuffer;
+    bool ensureEpoll();
+    void watch(int fd, quint64 key, int kind);
+    bool readPipe(quint64 key, int kind);
+    bool reap(quint64 key, int timeoutMs);
+    void finish(quint64 key, bool collected, int status);
+    void onHelperExit(pid_t pid, int status);
+    void onHelperLost();
+    static int spawnLocal(const QList<QByteArray> &argv, const int fds[3], pid_t *pid);
+    void closeFd(int *fd);
+};
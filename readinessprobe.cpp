@@ -0,0 +1,177 @@
+#include "readinessprobe.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QFileSystemWatcher>
+#include <QSocketNotifier>
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+namespace {
+QString errnoText() { return QString::fromLocal8Bit(std::strerror(errno)); }
+}
+
+QString ReadinessWait::describe() const {
+    switch (kind) {
+    case File: return QString("file %1").arg(path);
+    case Port: return QString("localhost port %1").arg(port);
+    case ProcessExit: return pid > 0 ? QString("exit of pid %1").arg(pid) : QString("exit of pid from %1").arg(path);}
+    return QString();}
+
+ReadinessProbe::ReadinessProbe(QObject *parent) : QObject(parent) {
+    m_timeoutTimer.setSingleShot(true);
+    m_retryTimer.setSingleShot(true);
+    connect(&m_timeoutTimer, &QTimer::timeout, this, &ReadinessProbe::onTimeout);
+    connect(&m_retryTimer, &QTimer::timeout, this, &ReadinessProbe::onRetry);}
+
+ReadinessProbe::~ReadinessProbe() {
+    releaseFd();}
+
+void ReadinessProbe::start(const ReadinessWait &wait, int timeoutMs) {
+    cancel();
+    m_wait = wait;
+    m_active = true;
+    m_retryDelayMs = 0;
+    if (timeoutMs > 0) {
+        m_timeoutTimer.setInterval(timeoutMs);
+        m_timeoutTimer.start();}
+    switch (wait.kind) {
+    case ReadinessWait::File: checkFile(); break;
+    case ReadinessWait::Port: tryConnect(); break;
+    case ReadinessWait::ProcessExit: startProcessExit(); break;}}
+
+void ReadinessProbe::cancel() {
+    if (!m_active) return;
+    m_active = false;
+    m_timeoutTimer.stop();
+    m_retryTimer.stop();
+    releaseFd();
+    if (m_watcher) {
+        m_watcher->disconnect(this);
+        m_watcher->deleteLater();
+        m_watcher = nullptr;}}
+
+void ReadinessProbe::finish(bool ok, const QString &reason) {
+    if (!m_active) return;
+    cancel();
+    if (ok) emit ready();
+    else emit failed(reason);}
+
+void ReadinessProbe::releaseFd() {
+    if (m_notifier) {
+        m_notifier->setEnabled(false);
+        m_notifier->deleteLater();
+        m_notifier = nullptr;}
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;}}
+
+void ReadinessProbe::onRetry() {
+    if (!m_active) return;
+    if (m_wait.kind == ReadinessWait::Port) {
+        tryConnect();
+    } else if (m_wait.kind == ReadinessWait::ProcessExit) {
+        if (::kill(static_cast<pid_t>(m_wait.pid), 0) != 0 && errno == ESRCH) finish(true);
+        else m_retryTimer.start(100);}}
+
+void ReadinessProbe::onTimeout() {
+    finish(false, QString("Timed out waiting for %1").arg(m_wait.describe()));}
+
+// --- File ---
+
+void ReadinessProbe::checkFile() {
+    if (!m_active) return;
+    if (QFileInfo::exists(m_wait.path)) {
+        finish(true);
+        return;}
+    watchNearestDirectory();
+    // The file may have appeared between the check and the watch being armed.
+    if (m_active && QFileInfo::exists(m_wait.path)) finish(true);}
+
+void ReadinessProbe::watchNearestDirectory() {
+    QDir dir = QFileInfo(m_wait.path).absoluteDir();
+    while (!dir.exists() && !dir.isRoot()) {
+        if (!dir.cdUp()) break;}
+    const QString target = dir.absolutePath();
+    if (!m_watcher) {
+        m_watcher = new QFileSystemWatcher(this);
+        connect(m_watcher, &QFileSystemWatcher::directoryChanged, this, &ReadinessProbe::checkFile);}
+    if (m_watcher->directories() == QStringList{target}) return;
+    if (!m_watcher->directories().isEmpty()) m_watcher->removePaths(m_watcher->directories());
+    if (!m_watcher->addPath(target)) {
+        finish(false, QString("Cannot watch directory: %1").arg(target));}}
+
+// --- Port ---
+
+void ReadinessProbe::tryConnect() {
+    if (!m_active) return;
+    releaseFd();
+    m_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_fd < 0) {
+        finish(false, QString("socket() failed: %1").arg(errnoText()));
+        return;}
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(m_wait.port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(m_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0) {
+        finish(true);
+        return;}
+    if (errno == EINPROGRESS) {
+        m_notifier = new QSocketNotifier(m_fd, QSocketNotifier::Write, this);
+        connect(m_notifier, &QSocketNotifier::activated, this, &ReadinessProbe::onConnectWritable);
+        return;}
+    releaseFd();
+    m_retryDelayMs = qBound(5, m_retryDelayMs * 2, 250);
+    m_retryTimer.start(m_retryDelayMs);}
+
+void ReadinessProbe::onConnectWritable() {
+    if (!m_active || m_fd < 0) return;
+    int err = 0;
+    socklen_t len = sizeof(err);
+    ::getsockopt(m_fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err == 0) {
+        finish(true);
+        return;}
+    releaseFd();
+    m_retryDelayMs = qBound(5, m_retryDelayMs * 2, 250);
+    m_retryTimer.start(m_retryDelayMs);}
+
+// --- Process exit ---
+
+void ReadinessProbe::startProcessExit() {
+    qint64 pid = m_wait.pid;
+    if (pid <= 0) {
+        QFile f(m_wait.path);
+        if (!f.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            // No pid file means nothing is running that we would have to wait for.
+            finish(true);
+            return;}
+        pid = QString::fromLatin1(f.readAll()).trimmed().toLongLong();}
+    if (pid <= 0) {
+        finish(false, QString("Invalid pid for %1").arg(m_wait.describe()));
+        return;}
+    m_fd = static_cast<int>(::syscall(SYS_pidfd_open, static_cast<pid_t>(pid), 0));
+    if (m_fd >= 0) {
+        m_notifier = new QSocketNotifier(m_fd, QSocketNotifier::Read, this);
+        connect(m_notifier, &QSocketNotifier::activated, this, &ReadinessProbe::onPidfdReadable);
+        return;}
+    if (errno == ESRCH) {
+        finish(true);
+        return;}
+    // Kernels without pidfd (< 5.3): fall back to probing with signal 0.
+    m_wait.pid = pid;
+    m_retryTimer.start(100);}
+
+void ReadinessProbe::onPidfdReadable() {
+    finish(true);}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QTimer>
+
+class QFileSystemWatcher;
+class QSocketNotifier;
+
+struct ReadinessWait {
+    enum Kind { File, Port, ProcessExit };
+    Kind kind = File;
+    QString path;      // File: watched path, ProcessExit: optional pid file
+    quint16 port = 0;  // Port: localhost TCP port
+    qint64 pid = 0;    // ProcessExit: pid (0 = read from path)
+    QString describe() const;
+};
+
+// Waits for a single precondition without polling where the kernel offers
+// a notification: inotify (QFileSystemWatcher) for files, pidfd for process exit.
+// Ports have no such notification, so a non-blocking connect is retried with backoff.
+class ReadinessProbe : public QObject {
+    Q_OBJECT
+public:
+    explicit ReadinessProbe(QObject *parent = nullptr);
+    ~ReadinessProbe();
+    void start(const ReadinessWait &wait, int timeoutMs);
+    void cancel();
+    bool isActive() const { return m_active; }
+
+signals:
+    void ready();
+    void failed(const QString &reason);
+
+private slots:
+    void checkFile();
+    void tryConnect();
+    void onRetry();
+    void onConnectWritable();
+    void onPidfdReadable();
+    void onTimeout();
+
+private:
+    ReadinessWait m_wait;
+    bool m_active = false;
+    QTimer m_timeoutTimer;
+    QTimer m_retryTimer;
+    int m_retryDelayMs = 0;
+    QFileSystemWatcher *m_watcher = nullptr;
+    QSocketNotifier *m_notifier = nullptr;
+    int m_fd = -1;
+    void watchNearestDirectory();
+    void startProcessExit();
+    void finish(bool ok, const QString &reason = QString());
+    void releaseFd();
+};
@@ -0,0 +1,530 @@
+#include "rootbroker.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QList>
+#include <QRegularExpression>
+#include <QSocketNotifier>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+std::atomic<bool> RootBroker::s_ready{false};
+
+namespace {
+enum FrameType : quint32 {
+    RunFrame = 1,       // GUI -> broker, payload: the shell command
+    KillFrame = 2,
+    HelloFrame = 16,    // broker -> GUI
+    StartedFrame,
+    StdoutFrame,
+    StderrFrame,
+    ExitedFrame,        // payload: qint32 wait status
+    RejectedFrame       // payload: the reason
+};
+
+struct FrameHeader {
+    quint32 type;
+    quint32 id;
+    quint32 size;
+};
+
+constexpr quint32 MaxFrame = 16 << 20;
+constexpr int ReadChunk = 64 * 1024;
+const char AllowlistPath[] = "/etc/shoot_commands/root-allowlist";
+
+QString errnoText(int err) { return QString::fromLocal8Bit(std::strerror(err)); }
+
+bool writeAll(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        const ssize_t n = ::write(fd, data, size);
+        if (n >= 0) {
+            data += n;
+            size -= size_t(n);
+        } else if (errno == EAGAIN) {
+            pollfd p{fd, POLLOUT, 0};
+            if (poll(&p, 1, 5000) <= 0) return false;
+        } else if (errno != EINTR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool writeFrame(int fd, quint32 type, quint32 id, const QByteArray &payload) {
+    const FrameHeader header{type, id, quint32(payload.size())};
+    QByteArray frame(reinterpret_cast<const char *>(&header), sizeof(header));
+    frame += payload;
+    return writeAll(fd, frame.constData(), size_t(frame.size()));
+}
+
+// Reads the frame at *pos if it is complete and advances *pos past it.
+bool nextFrame(const QByteArray &buffer, qsizetype *pos, FrameHeader *header, QByteArray *payload, bool *corrupt) {
+    const qsizetype headerSize = sizeof(FrameHeader);
+    if (buffer.size() - *pos < headerSize) return false;
+    std::memcpy(header, buffer.constData() + *pos, sizeof(FrameHeader));
+    if (header->size > MaxFrame) {
+        *corrupt = true;
+        return false;
+    }
+    if (buffer.size() - *pos - headerSize < qsizetype(header->size)) return false;
+    *payload = buffer.mid(*pos + headerSize, header->size);
+    *pos += headerSize + header->size;
+    return true;
+}
+
+// '*' stands for any text without shell separators, redirections or
+// substitutions, so "systemctl restart *" does not also admit
+// "systemctl restart x; rm -rf /".
+QRegularExpression allowPattern(const QString &pattern) {
+    QString rx = QStringLiteral("\\A");
+    for (const QChar c : pattern) {
+        rx += c == QLatin1Char('*') ? QStringLiteral("[^;&|`$<>()\\n]*") : QRegularExpression::escape(QString(c));
+    }
+    return QRegularExpression(rx + QStringLiteral("\\z"));
+}
+
+// Without the file the broker admits what `sudo -n bash -c` already did. A file
+// that is not root-owned or is writable by others is refused outright.
+bool loadAllowlist(QList<QRegularExpression> *patterns, bool *restricted, QString *error) {
+    struct stat st;
+    if (::stat(AllowlistPath, &st) != 0) {
+        if (errno != ENOENT) {
+            *error = QString("%1: %2").arg(QString::fromLatin1(AllowlistPath), errnoText(errno));
+            return false;
+        }
+        *restricted = false;
+        return true;
+    }
+    if (st.st_uid != 0 || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+        *error = QString("%1 must be owned by root and not writable by group or others").arg(QString::fromLatin1(AllowlistPath));
+        return false;
+    }
+    QFile file(QString::fromLatin1(AllowlistPath));
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        *error = QString("%1: %2").arg(QString::fromLatin1(AllowlistPath), file.errorString());
+        return false;
+    }
+    while (!file.atEnd()) {
+        const QString line = QString::fromUtf8(file.readLine()).trimmed();
+        if (line.isEmpty() || line.startsWith(QLatin1Char('#'))) continue;
+        patterns->append(allowPattern(line));
+    }
+    *restricted = true;
+    return true;
+}
+
+struct BrokerChild {
+    pid_t pid = -1;
+    int outFd = -1;
+    int errFd = -1;
+};
+
+// Each command gets its own process group so a kill reaches whatever bash started.
+int spawnShell(const QByteArray &command, BrokerChild *child) {
+    int out[2];
+    int err[2];
+    if (pipe2(out, O_CLOEXEC) != 0) return errno;
+    if (pipe2(err, O_CLOEXEC) != 0) {
+        const int e = errno;
+        ::close(out[0]);
+        ::close(out[1]);
+        return e;
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, out[1], 1);
+    posix_spawn_file_actions_adddup2(&actions, err[1], 2);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t none;
+    sigset_t defaults;
+    sigemptyset(&none);
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    sigaddset(&defaults, SIGCHLD);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP);
+    char *argv[] = {const_cast<char *>("/bin/bash"), const_cast<char *>("-c"), const_cast<char *>(command.constData()), nullptr};
+    const int rc = posix_spawn(&child->pid, argv[0], &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    ::close(out[1]);
+    ::close(err[1]);
+    if (rc != 0) {
+        ::close(out[0]);
+        ::close(err[0]);
+        return rc;
+    }
+    fcntl(out[0], F_SETFL, O_NONBLOCK);
+    fcntl(err[0], F_SETFL, O_NONBLOCK);
+    child->outFd = out[0];
+    child->errFd = err[0];
+    return 0;
+}
+}
+
+// Runs as root with fd 0/1 connected to the GUI. Every accepted command is
+// logged to syslog (authpriv) since sudo now only logs the broker itself.
+// Lines of /etc/shoot_commands/root-allowlist are whole-command patterns
+// where '*' matches an argument list; '#' starts a comment.
+int RootBroker::serve() {
+    if (geteuid() != 0) {
+        std::fprintf(stderr, "root broker: must be started through sudo\n");
+        return 1;
+    }
+    QList<QRegularExpression> allowed;
+    bool restricted = false;
+    QString error;
+    if (!loadAllowlist(&allowed, &restricted, &error)) {
+        std::fprintf(stderr, "root broker: %s\n", qPrintable(error));
+        return 1;
+    }
+    std::signal(SIGPIPE, SIG_IGN);
+    fcntl(0, F_SETFD, FD_CLOEXEC);
+    fcntl(1, F_SETFD, FD_CLOEXEC);
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, nullptr);
+    const int sigfd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (sigfd < 0) return 1;
+    const char *sudoUser = std::getenv("SUDO_USER");
+    const char *user = sudoUser ? sudoUser : "?";
+    openlog("shoot_commands-root", LOG_PID, LOG_AUTHPRIV);
+    if (!writeFrame(1, HelloFrame, 0, QByteArray())) return 1;
+
+    QHash<quint32, BrokerChild> children;
+    QByteArray inbox;
+    QByteArray chunk(ReadChunk, Qt::Uninitialized);
+    const auto forward = [&](quint32 id, int *fd, quint32 type) {
+        if (*fd < 0) return false;
+        const ssize_t n = ::read(*fd, chunk.data(), ReadChunk);
+        if (n > 0) {
+            writeFrame(1, type, id, QByteArray(chunk.constData(), n));
+            return true;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+            ::close(*fd);
+            *fd = -1;
+        }
+        return false;
+    };
+    bool connected = true;
+    while (connected) {
+        QList<pollfd> pfds{{0, POLLIN, 0}, {sigfd, POLLIN, 0}};
+        QList<quint32> owners{0, 0};
+        for (auto it = children.cbegin(); it != children.cend(); ++it) {
+            for (int fd : {it->outFd, it->errFd}) {
+                if (fd < 0) continue;
+                pfds.append({fd, POLLIN, 0});
+                owners.append(it.key());
+            }
+        }
+        if (poll(pfds.data(), nfds_t(pfds.size()), -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (qsizetype i = 2; i < pfds.size(); ++i) {
+            if (!pfds[i].revents) continue;
+            const auto it = children.find(owners[i]);
+            if (it == children.end()) continue;
+            if (pfds[i].fd == it->outFd) forward(it.key(), &it->outFd, StdoutFrame);
+            else if (pfds[i].fd == it->errFd) forward(it.key(), &it->errFd, StderrFrame);
+        }
+        if (pfds[1].revents & POLLIN) {
+            signalfd_siginfo info;
+            while (::read(sigfd, &info, sizeof(info)) > 0) {}
+            for (auto it = children.begin(); it != children.end();) {
+                int status = 0;
+                if (waitpid(it->pid, &status, WNOHANG) != it->pid) {
+                    ++it;
+                    continue;
+                }
+                // Bounded, so a grandchild that keeps the pipe open cannot stall us here.
+                for (int i = 0; i < 16 && forward(it.key(), &it->outFd, StdoutFrame); ++i) {}
+                for (int i = 0; i < 16 && forward(it.key(), &it->errFd, StderrFrame); ++i) {}
+                if (it->outFd >= 0) ::close(it->outFd);
+                if (it->errFd >= 0) ::close(it->errFd);
+                const qint32 value = status;
+                writeFrame(1, ExitedFrame, it.key(), QByteArray(reinterpret_cast<const char *>(&value), sizeof(value)));
+                it = children.erase(it);
+            }
+        }
+        if (!(pfds[0].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+        const qsizetype old = inbox.size();
+        inbox.resize(old + ReadChunk);
+        const ssize_t n = ::read(0, inbox.data() + old, ReadChunk);
+        inbox.resize(old + qMax<ssize_t>(n, 0));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;   // the GUI is gone
+        qsizetype pos = 0;
+        FrameHeader header;
+        QByteArray payload;
+        bool corrupt = false;
+        while (nextFrame(inbox, &pos, &header, &payload, &corrupt)) {
+            if (header.type == KillFrame) {
+                const auto it = children.constFind(header.id);
+                if (it != children.cend()) ::kill(-it->pid, SIGKILL);
+                continue;
+            }
+            if (header.type != RunFrame) continue;
+            const QString command = QString::fromUtf8(payload).trimmed();
+            bool permitted = !restricted;
+            for (qsizetype i = 0; !permitted && i < allowed.size(); ++i) permitted = allowed.at(i).match(command).hasMatch();
+            if (!permitted || payload.contains('\0')) {
+                syslog(LOG_WARNING, "%s: rejected: %s", user, payload.constData());
+                connected = writeFrame(1, RejectedFrame, header.id, QByteArray("command is not in ") + AllowlistPath);
+                continue;
+            }
+            BrokerChild child;
+            const int rc = spawnShell(payload, &child);
+            if (rc != 0) {
+                connected = writeFrame(1, RejectedFrame, header.id, errnoText(rc).toUtf8());
+                continue;
+            }
+            syslog(LOG_NOTICE, "%s: %s", user, payload.constData());
+            children.insert(header.id, child);
+            connected = writeFrame(1, StartedFrame, header.id, QByteArray());
+        }
+        inbox.remove(0, pos);
+        if (corrupt) break;
+    }
+    for (const BrokerChild &child : std::as_const(children)) ::kill(-child.pid, SIGKILL);
+    return 0;
+}
+
+RootBroker::RootBroker(QObject *parent) : QObject(parent) {}
+
+RootBroker::~RootBroker() {
+    shutdown();
+}
+
+// The broker's stderr stays ours, so sudo's own complaints reach the terminal.
+void RootBroker::launch() {
+    if (m_socket >= 0) return;
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) {
+        emit stateChanged(false, QString("Root helper: %1").arg(errnoText(errno)));
+        return;
+    }
+    const QByteArray self = QFile::encodeName(QCoreApplication::applicationFilePath());
+    char *argv[] = {const_cast<char *>("/usr/bin/sudo"), const_cast<char *>("-n"), const_cast<char *>(self.constData()),
+                    const_cast<char *>("--root-broker"), nullptr};
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, sv[1], 0);
+    posix_spawn_file_actions_adddup2(&actions, sv[1], 1);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t none;
+    sigset_t defaults;
+    sigemptyset(&none);
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    const int rc = posix_spawn(&m_sudoPid, argv[0], &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    ::close(sv[1]);
+    if (rc != 0) {
+        ::close(sv[0]);
+        m_sudoPid = -1;
+        emit stateChanged(false, QString("Root helper: cannot run sudo: %1").arg(errnoText(rc)));
+        return;
+    }
+    m_socket = sv[0];
+    fcntl(m_socket, F_SETFL, O_NONBLOCK);
+    m_greeted = false;
+    m_notifier = new QSocketNotifier(m_socket, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &RootBroker::onReadable);
+    emit stateChanged(false, "Starting root helper (sudo -n ... --root-broker).");
+}
+
+void RootBroker::shutdown() {
+    if (m_socket >= 0) lost("Root helper stopped.");
+}
+
+void RootBroker::start(const std::shared_ptr<ProcessChannel> &channel, quint64 run, const QString &command) {
+    const quint32 id = m_nextId++;
+    if (m_socket < 0 || !sendFrame(RunFrame, id, command.toUtf8())) {
+        channel->post({ProcessEvent::FailedToStart, run, QStringLiteral("root helper is not running")});
+        return;
+    }
+    m_runs.insert(id, {channel, run});
+    m_current.insert(channel.get(), id);
+}
+
+void RootBroker::stop(ProcessChannel *channel) {
+    const auto it = m_current.constFind(channel);
+    if (it == m_current.cend()) return;
+    const quint32 id = it.value();
+    if (!sendFrame(KillFrame, id) || !waitFor(id, 1000)) m_current.remove(channel);
+}
+
+void RootBroker::detach(ProcessChannel *channel) {
+    m_current.remove(channel);
+}
+
+// Their exit replies arrive as usual.
+void RootBroker::killDetached(ProcessChannel *channel) {
+    const quint32 current = m_current.value(channel);
+    for (auto it = m_runs.cbegin(); it != m_runs.cend(); ++it) {
+        if (it->channel.get() != channel || it.key() == current) continue;
+        if (m_socket < 0 || !sendFrame(KillFrame, it.key())) break;
+    }
+}
+
+// The executor is going away: kill everything it started, detached runs included.
+void RootBroker::release(ProcessChannel *channel) {
+    m_current.remove(channel);
+    QList<quint32> ids;
+    for (auto it = m_runs.cbegin(); it != m_runs.cend(); ++it) {
+        if (it->channel.get() == channel) ids.append(it.key());
+    }
+    for (quint32 id : ids) m_runs.remove(id);
+    for (quint32 id : ids) {
+        if (m_socket < 0 || !sendFrame(KillFrame, id)) break;
+    }
+}
+
+void RootBroker::onReadable() {
+    const bool open = readAvailable();
+    processFrames();
+    if (open || m_socket < 0) return;
+    lost(m_greeted ? QStringLiteral("Root helper exited; root commands use sudo again.")
+                   : QStringLiteral("Root helper could not start: sudo -n needs a NOPASSWD rule for '%1 --root-broker'. "
+                                    "Root commands keep using sudo.").arg(QCoreApplication::applicationFilePath()));
+}
+
+// Bounded, so a command flooding its output cannot keep this thread here;
+// the notifier is level-triggered and fires again.
+bool RootBroker::readAvailable() {
+    for (int i = 0; i < 16; ++i) {
+        const qsizetype old = m_inbox.size();
+        m_inbox.resize(old + ReadChunk);
+        const ssize_t n = ::recv(m_socket, m_inbox.data() + old, ReadChunk, 0);
+        m_inbox.resize(old + qMax<ssize_t>(n, 0));
+        if (n > 0) continue;
+        return n < 0 && (errno == EAGAIN || errno == EINTR);
+    }
+    return true;
+}
+
+void RootBroker::processFrames() {
+    qsizetype pos = 0;
+    FrameHeader header;
+    QByteArray payload;
+    bool corrupt = false;
+    while (nextFrame(m_inbox, &pos, &header, &payload, &corrupt)) handleFrame(header.type, header.id, payload);
+    m_inbox.remove(0, pos);
+    if (corrupt) lost("Root helper sent a malformed reply; root commands use sudo again.");
+}
+
+void RootBroker::handleFrame(quint32 type, quint32 id, const QByteArray &payload) {
+    if (type == HelloFrame) {
+        m_greeted = true;
+        s_ready.store(true, std::memory_order_release);
+        emit stateChanged(true, "Root helper ready; root commands no longer start sudo one by one.");
+        return;
+    }
+    const auto it = m_runs.constFind(id);
+    if (it == m_runs.cend()) return;   // released, or a kill raced with its exit
+    const Run run = it.value();
+    const auto forget = [&]{
+        m_runs.remove(id);
+        if (m_current.value(run.channel.get()) == id) m_current.remove(run.channel.get());
+    };
+    switch (type) {
+    case StartedFrame:
+        run.channel->post({ProcessEvent::Started, run.run});
+        break;
+    case StdoutFrame:
+        run.channel->post({ProcessEvent::Stdout, run.run, QString::fromUtf8(payload)});
+        break;
+    case StderrFrame:
+        run.channel->post({ProcessEvent::Stderr, run.run, QString::fromUtf8(payload)});
+        break;
+    case ExitedFrame: {
+        qint32 status = 0;
+        if (payload.size() == qsizetype(sizeof(status))) std::memcpy(&status, payload.constData(), sizeof(status));
+        ProcessEvent event;
+        event.kind = ProcessEvent::Finished;
+        event.run = run.run;
+        if (WIFEXITED(status)) {
+            event.exitCode = WEXITSTATUS(status);
+        } else {
+            event.exitCode = WIFSIGNALED(status) ? WTERMSIG(status) : -1;
+            event.exitStatus = QProcess::CrashExit;
+        }
+        run.channel->post(std::move(event));
+        forget();
+        break;
+    }
+    case RejectedFrame:
+        run.channel->post({ProcessEvent::FailedToStart, run.run, QString::fromUtf8(payload)});
+        forget();
+        break;
+    }
+}
+
+bool RootBroker::sendFrame(quint32 type, quint32 id, const QByteArray &payload) {
+    if (writeFrame(m_socket, type, id, payload)) return true;
+    lost("Root helper stopped responding; root commands use sudo again.");
+    return false;
+}
+
+// Handles replies until run id has finished or timeoutMs passed.
+bool RootBroker::waitFor(quint32 id, int timeoutMs) {
+    QElapsedTimer timer;
+    timer.start();
+    while (m_runs.contains(id)) {
+        const int left = timeoutMs - int(timer.elapsed());
+        if (left < 0) return false;
+        pollfd p{m_socket, POLLIN, 0};
+        if (poll(&p, 1, left) <= 0) continue;
+        const bool open = readAvailable();
+        processFrames();
+        if (!open && m_socket >= 0) lost("Root helper exited; root commands use sudo again.");
+    }
+    return true;
+}
+
+// Closing our end makes the broker kill its children and exit. Runs still in
+// flight are reported as crashed.
+void RootBroker::lost(const QString &message) {
+    s_ready.store(false, std::memory_order_release);
+    delete m_notifier;
+    m_notifier = nullptr;
+    ::close(m_socket);
+    m_socket = -1;
+    m_inbox.clear();
+    if (m_sudoPid > 0) {
+        for (int waited = 0; waitpid(m_sudoPid, nullptr, WNOHANG) == 0 && waited < 1000; waited += 10) usleep(10000);
+        m_sudoPid = -1;
+    }
+    for (const Run &run : std::as_const(m_runs)) {
+        run.channel->post({ProcessEvent::Finished, run.run, QString(), -1, QProcess::CrashExit});
+    }
+    m_runs.clear();
+    m_current.clear();
+    emit stateChanged(false, message);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <QObject>
+#include <QHash>
+#include <QByteArray>
+#include <atomic>
+#include <memory>
+#include <sys/types.h>
+#include "commandexecutor.h"
+
+class QSocketNotifier;
+
+// Optional long-lived root helper. `sudo -n shoot_commands --root-broker` is
+// started once; its stdin/stdout are one end of a socketpair carrying framed
+// requests (run a shell command, kill it) and replies (started, output chunks,
+// wait status). Root commands then skip sudo's PAM/policy start-up per run.
+// Commands may be limited by /etc/shoot_commands/root-allowlist (see serve()).
+// The GUI side lives on the executor thread; every method except isReady()
+// must be called there.
+class RootBroker : public QObject {
+    Q_OBJECT
+public:
+    // Entry point of the `--root-broker` process; returns its exit code.
+    static int serve();
+    // True between the broker's hello and the loss of its socket.
+    static bool isReady() { return s_ready.load(std::memory_order_acquire); }
+
+    explicit RootBroker(QObject *parent = nullptr);
+    ~RootBroker();
+    void launch();
+    void shutdown();
+    void start(const std::shared_ptr<ProcessChannel> &channel, quint64 run, const QString &command);
+    void stop(ProcessChannel *channel);
+    void detach(ProcessChannel *channel);
+    void killDetached(ProcessChannel *channel);
+    void release(ProcessChannel *channel);
+
+signals:
+    void stateChanged(bool ready, const QString &message);
+
+private slots:
+    void onReadable();
+
+private:
+    struct Run {
+        std::shared_ptr<ProcessChannel> channel;
+        quint64 run = 0;
+    };
+    static std::atomic<bool> s_ready;
+    int m_socket = -1;
+    pid_t m_sudoPid = -1;
+    bool m_greeted = false;
+    quint32 m_nextId = 1;
+    QSocketNotifier *m_notifier = nullptr;
+    QByteArray m_inbox;
+    QHash<quint32, Run> m_runs;
+    QHash<ProcessChannel *, quint32> m_current;
+    bool readAvailable();
+    void processFrames();
+    void handleFrame(quint32 type, quint32 id, const QByteArray &payload);
+    bool sendFrame(quint32 type, quint32 id, const QByteArray &payload = QByteArray());
+    bool waitFor(quint32 id, int timeoutMs);
+    void lost(const QString &message);
+};
@@ -0,0 +1,122 @@
+#include "scheduledcommand.h"
+#include "commandexecutor.h"
+
+ScheduledCommand::ScheduledCommand(QObject *parent) : QObject(parent) {
+    m_timer.setTimerType(Qt::PreciseTimer);
+    connect(&m_timer, &QTimer::timeout, this, &ScheduledCommand::onTick);}
+
+ScheduledCommand::~ScheduledCommand() {
+    for (CommandExecutor *ex : m_executors) ex->disconnect(this);}
+
+QString ScheduledCommand::policyName(OverlapPolicy policy) {
+    switch (policy) {
+    case SkipIfRunning: return "skip if running";
+    case QueueOne: return "queue one";
+    case AllowConcurrent: return "allow concurrent";
+    case KillPrevious: return "kill previous";}
+    return QString();}
+
+void ScheduledCommand::start(const QString &program, const QStringList &args, int intervalMs, bool periodic) {
+    m_timer.stop();
+    m_program = program;
+    m_args = args;
+    m_intervalMs = intervalMs;
+    m_queuedDueMs = -1;
+    m_skippedTicks = 0;
+    m_lateTicks = 0;
+    m_killedRuns = 0;
+    m_clock.start();
+    m_nextDueMs = intervalMs;
+    m_timer.setSingleShot(!periodic);
+    m_timer.setInterval(intervalMs);
+    m_timer.start();
+    emit countersChanged();}
+
+void ScheduledCommand::stop() {
+    m_timer.stop();
+    m_queuedDueMs = -1;}
+
+void ScheduledCommand::stopProcesses() {
+    m_queuedDueMs = -1;
+    for (CommandExecutor *ex : m_executors) ex->stop();}
+
+void ScheduledCommand::setOverlapPolicy(OverlapPolicy policy, int maxConcurrent) {
+    m_policy = policy;
+    m_maxConcurrent = qMax(1, maxConcurrent);
+    if (policy != QueueOne) m_queuedDueMs = -1;}
+
+int ScheduledCommand::runningCount() const {
+    int count = 0;
+    for (const CommandExecutor *ex : m_executors) {
+        if (ex->isRunning()) count++;}
+    return count;}
+
+void ScheduledCommand::onTick() {
+    const qint64 dueMs = m_nextDueMs;
+    m_nextDueMs += m_intervalMs;
+    // A stalled event loop delivers one tick for several missed periods; count them as skipped.
+    const qint64 now = m_clock.elapsed();
+    if (m_intervalMs > 0 && now - m_nextDueMs >= 0) {
+        const qint64 missed = (now - m_nextDueMs) / m_intervalMs + 1;
+        m_skippedTicks += static_cast<int>(missed);
+        m_nextDueMs += missed * m_intervalMs;}
+    const int running = runningCount();
+    if (running == 0) {
+        launch(dueMs);
+        return;}
+    switch (m_policy) {
+    case SkipIfRunning:
+        m_skippedTicks++;
+        emit logMessage(QString("Scheduled tick skipped: previous run still in progress (%1 skipped).").arg(m_skippedTicks), "#FFAA66");
+        break;
+    case QueueOne:
+        if (m_queuedDueMs >= 0) {
+            m_skippedTicks++;
+            emit logMessage("Scheduled tick skipped: one run is already queued.", "#FFAA66");
+        } else {
+            m_queuedDueMs = dueMs;
+            emit logMessage("Scheduled tick queued until the previous run finishes.", "#FFC107");}
+        break;
+    case AllowConcurrent:
+        if (running < m_maxConcurrent) {
+            launch(dueMs);
+            return;}
+        m_skippedTicks++;
+        emit logMessage(QString("Scheduled tick skipped: %1 concurrent runs already in progress.").arg(running), "#FFAA66");
+        break;
+    case KillPrevious:
+        for (CommandExecutor *ex : m_executors) {
+            if (ex->isRunning()) {
+                m_killedRuns++;
+                ex->stop();}}
+        emit logMessage("Previous scheduled run killed by the next tick.", "#FFAA66");
+        launch(dueMs);
+        return;}
+    emit countersChanged();}
+
+void ScheduledCommand::launch(qint64 dueMs) {
+    const qint64 lateness = m_clock.elapsed() - dueMs;
+    if (lateness > qMax(250, m_intervalMs / 10)) {
+        m_lateTicks++;
+        emit logMessage(QString("Scheduled run started %1 ms late.").arg(lateness), "#FFC107");}
+    emit countersChanged();
+    emit logMessage(QString(">>> scheduled: %1").arg(m_args.isEmpty() ? m_program : m_args.last()), "#FFE066");
+    idleExecutor()->runSystemCommand(m_program, m_args);}
+
+CommandExecutor *ScheduledCommand::idleExecutor() {
+    for (CommandExecutor *ex : m_executors) {
+        if (!ex->isRunning()) return ex;}
+    auto ex = new CommandExecutor(this);
+    connect(ex, &CommandExecutor::outputReceived, this, &ScheduledCommand::outputReceived);
+    connect(ex, &CommandExecutor::errorReceived, this, &ScheduledCommand::errorReceived);
+    connect(ex, &CommandExecutor::started, this, &ScheduledCommand::started);
+    connect(ex, &CommandExecutor::finished, this, &ScheduledCommand::onRunFinished);
+    m_executors.append(ex);
+    return ex;}
+
+void ScheduledCommand::onRunFinished(int exitCode, QProcess::ExitStatus exitStatus) {
+    emit finished(exitCode, exitStatus);
+    if (m_policy == QueueOne && m_queuedDueMs >= 0 && runningCount() == 0) {
+        const qint64 dueMs = m_queuedDueMs;
+        m_queuedDueMs = -1;
+        launch(dueMs);}}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <QObject>
+#include <QProcess>
+#include <QStringList>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QList>
+
+class CommandExecutor;
+
+// A command fired by a (periodic) timer. Each run gets its own executor, so a tick
+// never tears down the previous run implicitly; what happens when a tick arrives
+// while runs are still in flight is decided by the overlap policy.
+class ScheduledCommand : public QObject {
+    Q_OBJECT
+public:
+    enum OverlapPolicy { SkipIfRunning, QueueOne, AllowConcurrent, KillPrevious };
+    explicit ScheduledCommand(QObject *parent = nullptr);
+    ~ScheduledCommand();
+    void start(const QString &program, const QStringList &args, int intervalMs, bool periodic);
+    void stop();
+    void stopProcesses();
+    bool isActive() const { return m_timer.isActive(); }
+    void setOverlapPolicy(OverlapPolicy policy, int maxConcurrent = 1);
+    OverlapPolicy overlapPolicy() const { return m_policy; }
+    int runningCount() const;
+    int skippedTicks() const { return m_skippedTicks; }
+    int lateTicks() const { return m_lateTicks; }
+    int killedRuns() const { return m_killedRuns; }
+    static QString policyName(OverlapPolicy policy);
+
+signals:
+    void outputReceived(const QString &text);
+    void errorReceived(const QString &text);
+    void started();
+    void finished(int exitCode, QProcess::ExitStatus exitStatus);
+    void countersChanged();
+    void logMessage(const QString &text, const QString &color);
+
+private slots:
+    void onTick();
+
+private:
+    QTimer m_timer;
+    QElapsedTimer m_clock;
+    QList<CommandExecutor *> m_executors;
+    QString m_program;
+    QStringList m_args;
+    OverlapPolicy m_policy = SkipIfRunning;
+    int m_maxConcurrent = 1;
+    int m_intervalMs = 0;
+    qint64 m_nextDueMs = 0;
+    qint64 m_queuedDueMs = -1;   // due time of the single run held back by QueueOne
+    int m_skippedTicks = 0;
+    int m_lateTicks = 0;
+    int m_killedRuns = 0;
+    void launch(qint64 dueMs);
+    void onRunFinished(int exitCode, QProcess::ExitStatus exitStatus);
+    CommandExecutor *idleExecutor();
+};
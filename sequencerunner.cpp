@@ -1,9 +1,8 @@
 #include "sequencerunner.h"
 #include "commandexecutor.h"
-#include "nlohmann/json.hpp"
 #include <QFile>
+#include <QFileInfo>
 #include <QTextStream>
-#include <QJsonDocument>
 #include <QJsonArray>
 #include <QJsonObject>
 #include <QTimer>
@@ -12,66 +11,88 @@
 SequenceRunner::SequenceRunner(CommandExecutor *executor, QObject *parent)
     : QObject(parent), m_executor(executor) {
     m_delayTimer.setSingleShot(true);
+    m_readyLineTimer.setSingleShot(true);
     connect(&m_delayTimer, &QTimer::timeout, this, &SequenceRunner::onDelayTimeout);
-    connect(m_executor, &CommandExecutor::finished, this, &SequenceRunner::onCommandFinished);}
+    connect(&m_readyLineTimer, &QTimer::timeout, this, &SequenceRunner::onReadyLineTimeout);
+    connect(&m_probe, &ReadinessProbe::ready, this, &SequenceRunner::onProbeReady);
+    connect(&m_probe, &ReadinessProbe::failed, this, &SequenceRunner::onProbeFailed);
+    m_matrix.setVariables(&m_variables);
+    connect(&m_artifacts, &ArtifactStore::quotaExceeded, this, &SequenceRunner::onArtifactQuotaExceeded);
+    connect(&m_artifacts, &ArtifactStore::artifactClosed, this, &SequenceRunner::onArtifactClosed);
+    connect(&m_pipeline, &PipelineRunner::finished, this, &SequenceRunner::onPipelineFinished);
+    connect(&m_pipeline, &PipelineRunner::outputReceived, this, &SequenceRunner::outputReceived);
+    connect(&m_pipeline, &PipelineRunner::outputReceived, this, &SequenceRunner::onCommandOutput);
+    connect(&m_pipeline, &PipelineRunner::errorReceived, this, &SequenceRunner::errorReceived);
+    connect(&m_matrix, &MatrixRunner::finished, this, &SequenceRunner::onMatrixFinished);
+    connect(&m_matrix, &MatrixRunner::logMessage, this, &SequenceRunner::logMessage);
+    connect(&m_matrix, &MatrixRunner::outputReceived, this, &SequenceRunner::outputReceived);
+    connect(&m_matrix, &MatrixRunner::errorReceived, this, &SequenceRunner::errorReceived);
+    connect(m_executor, &CommandExecutor::finished, this, &SequenceRunner::onCommandFinished);
+    connect(m_executor, &CommandExecutor::outputReceived, this, &SequenceRunner::outputReceived);
+    connect(m_executor, &CommandExecutor::errorReceived, this, &SequenceRunner::errorReceived);
+    connect(m_executor, &CommandExecutor::outputReceived, this, &SequenceRunner::onCommandOutput);}
 
-WorkflowCmd SequenceRunner::parseCommandFromJson(const QJsonObject &obj) {
-    WorkflowCmd cmd;
-    cmd.command = obj.value("command").toString();
-    cmd.delayAfterMs = obj.value("delayAfterMs").toInt(1000);
-    cmd.runAsRoot = obj.value("runAsRoot").toBool(false);
-    cmd.stopOnError = obj.value("stopOnError").toBool(true);
-    return cmd;}
+std::unique_ptr<MatrixItemSource> SequenceRunner::createItemSource(const MatrixSpec &spec) {
+    switch (spec.source) {
+    case MatrixSpec::Inline:
+        return std::make_unique<JsonArrayItemSource>(spec.items);
+    case MatrixSpec::File: {
+        auto source = std::make_unique<FileLineItemSource>(spec.path);
+        if (!source->open()) return nullptr;
+        return source;}
+    case MatrixSpec::StepOutput:
+        return std::make_unique<TextLineItemSource>(m_stepOutputs.value(spec.stepId));
+    case MatrixSpec::None:
+        break;}
+    return nullptr;}
 
 bool SequenceRunner::loadWorkflow(const QString &filePath, bool clearExisting) {
-    QFile file(filePath);
-    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        emit logMessage(QString("Cannot open file: %1").arg(filePath), "#F44336");
-        return false;}
-    QByteArray data = file.readAll();
-    QJsonDocument doc = QJsonDocument::fromJson(data);
-    file.close();
-    if (!doc.isArray()) {
-        emit logMessage("Invalid JSON file: Root element is not an array.", "#F44336");
+    return setPlan(WorkflowLoader::load(filePath, clearExisting ? nullptr : m_plan));}
+
+bool SequenceRunner::setPlan(const WorkflowLoader::Result &loaded) {
+    if (!loaded.plan) {
+        emit logMessage(loaded.message, "#F44336");
         return false;}
-    if (clearExisting) {
-        m_commands.clear();}    
-    QJsonArray array = doc.array();
-    for (const QJsonValue &value : array) {
-        if (value.isObject()) {
-            m_commands.append(parseCommandFromJson(value.toObject()));}}    
-    emit logMessage(QString("Loaded %1 commands. Total commands: %2.").arg(array.count()).arg(m_commands.count()), "#BDBDBD");
+    m_plan = loaded.plan;
+    emit logMessage(loaded.message, "#BDBDBD");
     return true;}
 
-QStringList SequenceRunner::getCommandsAsText() const {
-    QStringList result;
-    for (const WorkflowCmd &cmd : m_commands) {
-        QString line = cmd.command;        
-        QString details;
-        if (cmd.delayAfterMs > 0) {
-            details += QString(" (Delay: %1ms)").arg(cmd.delayAfterMs);}
-        if (cmd.runAsRoot) {
-            details += " (ROOT)";}
-        if (!details.isEmpty()) {
-            line += details;}
-        result.append(line);}
-    return result;}
-
 void SequenceRunner::startSequence() {
     if (m_isRunning) {
         emit logMessage("Sequence is already running.", "#FFAA66");
         return;}
-    if (m_commands.isEmpty()) {
+    if (!m_plan || m_plan->stepCount() == 0) {
         emit logMessage("No commands loaded. Please load a workflow file.", "#F44336");
         return;}
+    m_run = m_plan;
+    m_stream.reset();
+    if (m_run->isStreamed()) {
+        m_stream = std::make_unique<WorkflowStream>(m_run);
+        QString error;
+        if (!m_stream->open(&error)) {
+            emit logMessage(QString("Cannot open streamed workflow: %1").arg(error), "#F44336");
+            m_stream.reset();
+            return;}}
     m_currentIndex = 0;
+    m_phase = MainPhase;
+    m_failed = false;
+    m_lastExitCode = 0;
+    m_stepExitCodes.clear();
+    m_variables.clear();
+    m_stepOutputs.clear();
+    m_artifacts.clear();
+    m_artifacts.setQuota(m_run->artifactQuotaMB * 1024 * 1024);
     m_isRunning = true;
     emit sequenceStarted();
     executeNextCommand();}
 
 void SequenceRunner::stopSequence(bool forcedStop) {
     if (m_isRunning) {
+        m_awaitingExit = false;
         m_executor->stop();        
+        m_executor->killDetached();
+        m_matrix.stop();
+        m_pipeline.stop();
         finishSequence(false);        
         if (forcedStop) {
             emit logMessage("--- SEQUENCE FORCED STOP ---", "#F44336");}        
@@ -83,7 +104,14 @@ void SequenceRunner::stopSequence(bool forcedStop) {
 
 void SequenceRunner::finishSequence(bool success) {
     m_isRunning = false; 
+    m_awaitingExit = false;
     m_delayTimer.stop();
+    m_readyLineTimer.stop();
+    m_probe.cancel();
+    m_matrix.stop();
+    m_pipeline.stop();
+    m_artifacts.clear();
+    m_stream.reset();
     emit sequenceFinished(success);
     if (success) {
         emit logMessage("--- WORKFLOW SEQUENCE FINISHED SUCCESSFULLY ---", "#4CAF50");        
@@ -97,42 +125,323 @@ void SequenceRunner::finishSequence(bool success) {
             m_isInterval = false;}
         emit logMessage("--- WORKFLOW SEQUENCE TERMINATED DUE TO ERROR ---", "#F44336");}}
 
+ExpressionContext SequenceRunner::expressionContext() const {
+    ExpressionContext ctx;
+    ctx.lastExitCode = m_lastExitCode;
+    ctx.failed = m_failed;
+    ctx.stepExitCodes = &m_stepExitCodes;
+    ctx.variables = &m_variables;
+    return ctx;}
+
+bool SequenceRunner::shouldRun(const WorkflowCmd &cmd, const ExpressionContext &ctx) const {
+    if (cmd.runIf.isValid() && !cmd.runIf.test(ctx)) return false;
+    if (cmd.runUnless.isValid() && cmd.runUnless.test(ctx)) return false;
+    return true;}
+
+const QList<WorkflowCmd> &SequenceRunner::phaseSteps() const {
+    switch (m_phase) {
+    case FailurePhase: return m_run->onFailure;
+    case FinallyPhase: return m_run->finally;
+    case MainPhase: break;}
+    return m_stream ? m_stream->window() : m_run->steps;}
+
+// Streamed main steps are parsed on demand, so looking ahead may read the
+// file and must not be done while holding a step reference.
+bool SequenceRunner::hasStep(int index) {
+    if (m_phase != MainPhase || !m_stream) return index < phaseSteps().count();
+    return m_stream->fill(index);}
+
+// A streamed step that fails to parse fails the run like a failed step.
+bool SequenceRunner::streamFailed() {
+    if (m_phase != MainPhase || !m_stream || m_stream->error().isEmpty()) return false;
+    emit logMessage(QString("Invalid workflow: %1").arg(m_stream->error()), "#F44336");
+    m_failed = true;
+    startPhase(FailurePhase);
+    return true;}
+
+qint64 SequenceRunner::stepNumber(int index) const {
+    return (m_phase == MainPhase && m_stream ? m_stream->base() : 0) + index + 1;}
+
+void SequenceRunner::startPhase(Phase phase) {
+    m_phase = phase;
+    m_currentIndex = 0;
+    if (phaseSteps().isEmpty()) {
+        finishPhase();
+        return;}
+    emit logMessage(phase == FailurePhase ? "--- RUNNING onFailure STEPS ---" : "--- RUNNING finally STEPS ---", "#00BCD4");
+    executeNextCommand();}
+
+void SequenceRunner::finishPhase() {
+    if (m_phase == FinallyPhase) {
+        finishSequence(!m_failed);
+        return;}
+    startPhase(FinallyPhase);}
+
 void SequenceRunner::executeNextCommand() {
     if (!m_isRunning) return;
-    if (m_currentIndex >= m_commands.count()) {
-        finishSequence(true);
+    const ExpressionContext ctx = expressionContext();
+    for (;;) {
+        if (m_phase == MainPhase && m_stream && m_currentIndex > 0) {
+            m_stream->discard(m_currentIndex);
+            m_currentIndex = 0;}
+        if (!hasStep(m_currentIndex) || shouldRun(currentStep(), ctx)) break;
+        emit logMessage(QString("Skipping step %1: condition not met.").arg(stepNumber(m_currentIndex)), "#BDBDBD");
+        releaseArtifacts(currentStep());
+        m_currentIndex++;}
+    if (!hasStep(m_currentIndex)) {
+        if (!streamFailed()) finishPhase();
         return;}
-    const WorkflowCmd &currentCmd = m_commands.at(m_currentIndex);
-    emit commandExecuting(currentCmd.command, m_currentIndex, m_commands.count());    
-    QString program;
-    QStringList args;    
-    if (currentCmd.runAsRoot) {
-        program = "/usr/bin/sudo";  
-        args << "-n" << "bash" << "-c" << currentCmd.command;            
-        emit logMessage(QString(">>> root: %1").arg(currentCmd.command), "#FF0000");
-    } else {
-        program = "/bin/bash";  
-        args << "-c" << currentCmd.command;
-        emit logMessage(QString(">>> user: %1").arg(currentCmd.command), "#FFE066");}
-    m_executor->runSystemCommand(program, args);}
+    const qint64 total = m_phase == MainPhase ? m_run->stepCount() : phaseSteps().count();
+    emit commandExecuting(currentStep().command, int(stepNumber(m_currentIndex) - 1), int(total));
+    m_waitIndex = 0;
+    runNextWait();}
+
+void SequenceRunner::runNextWait() {
+    const WorkflowCmd &currentCmd = currentStep();
+    if (m_waitIndex < currentCmd.waits.count()) {
+        const ReadinessWait &wait = currentCmd.waits.at(m_waitIndex);
+        emit logMessage(QString("Waiting for %1...").arg(wait.describe()), "#FFC107");
+        m_probe.start(wait, currentCmd.waitTimeoutMs);
+        return;}
+    launchCurrentCommand();}
+
+void SequenceRunner::onProbeReady() {
+    if (!m_isRunning) return;
+    m_waitIndex++;
+    runNextWait();}
+
+void SequenceRunner::onProbeFailed(const QString &reason) {
+    if (!m_isRunning) return;
+    emit logMessage(QString("Readiness wait failed: %1").arg(reason), "#F44336");
+    handleStepResult(-1);}
+
+void SequenceRunner::launchCurrentCommand() {
+    if (currentStep().command.trimmed().isEmpty()) {
+        handleStepResult(0);
+        return;}
+    int last = m_currentIndex;
+    while (hasStep(last + 1) && phaseSteps().at(last + 1).isPiped()) last++;
+    if (last > m_currentIndex) {
+        launchPipeline(last);
+        return;}
+    const WorkflowCmd &currentCmd = currentStep();
+    if (currentCmd.isMatrix()) {
+        std::unique_ptr<MatrixItemSource> source = createItemSource(currentCmd.matrix);
+        if (!source) {
+            emit logMessage(QString("Cannot open forEach source: %1").arg(currentCmd.matrix.describe()), "#F44336");
+            handleStepResult(-1);
+            return;}
+        emit logMessage(currentCmd.launch.logLine, currentCmd.runAsRoot ? "#FF0000" : "#FFE066");
+        m_awaitingExit = true;
+        m_matrix.start(currentCmd.commandTemplate, currentCmd.runAsRoot, currentCmd.stopOnError,
+                       currentCmd.matrix.maxParallel, std::move(source), currentCmd.matrix.backend);
+        return;}
+    ProcessRedirects redirects;
+    if (!currentCmd.artifactIn.isEmpty()) {
+        redirects.stdinFile = m_artifacts.path(currentCmd.artifactIn);
+        if (redirects.stdinFile.isEmpty()) {
+            emit logMessage(QString("Artifact '%1' was not produced in this run.").arg(currentCmd.artifactIn), "#F44336");
+            handleStepResult(-1);
+            return;}}
+    if (!currentCmd.artifactOut.isEmpty()) {
+        QString error;
+        if (!m_artifacts.create(currentCmd.artifactOut, m_run->artifactConsumers.value(currentCmd.artifactOut), &error)) {
+            emit logMessage(error, "#F44336");
+            handleStepResult(-1);
+            return;}
+        redirects.stdoutFile = m_artifacts.path(currentCmd.artifactOut);
+        m_variables.insert(QLatin1String("artifact:") + currentCmd.artifactOut, redirects.stdoutFile);}
+    if (currentCmd.fileCapture.isValid()) {
+        const FileCaptureSpec &spec = currentCmd.fileCapture;
+        redirects.stdoutFile = spec.path;
+        redirects.stderrFile = spec.stderrPath;
+        redirects.mergeStderr = spec.stderrPath.isEmpty();
+        redirects.append = spec.append;
+        m_fileCaptureOffset = spec.append ? QFileInfo(spec.path).size() : 0;}
+    const LaunchSpec &launch = currentCmd.launch;
+    const QString command = launch.program.isEmpty() ? expandCommand(currentCmd) : QString();
+    emit logMessage(launch.logLine.isEmpty() ? QString(">>> %1: %2").arg(currentCmd.runAsRoot ? "root" : "user", command) : launch.logLine,
+                    currentCmd.runAsRoot ? "#FF0000" : "#FFE066");
+    m_lineBuffer.clear();
+    m_captureBuffer.clear();
+    m_awaitingExit = true;
+    if (currentCmd.hasReadyLine() && currentCmd.waitTimeoutMs > 0) {
+        m_readyLineTimer.setInterval(currentCmd.waitTimeoutMs);
+        m_readyLineTimer.start();}
+    m_executor->setRedirects(redirects);
+    if (!currentCmd.artifactOut.isEmpty()) m_artifacts.watch(currentCmd.artifactOut);
+    if (launch.program.isEmpty()) m_executor->runShellCommand(command, currentCmd.runAsRoot);
+    else m_executor->runSystemCommand(launch.program, launch.args);}
+
+// captureAs values come from arbitrary command output; expand() quotes them
+// like forEach items.
+QString SequenceRunner::expandCommand(const WorkflowCmd &cmd) const {
+    return cmd.commandTemplate.expand([this](const QString &name) -> const QString * {
+        const auto it = m_variables.constFind(name);
+        return it != m_variables.cend() ? &it.value() : nullptr;});}
+
+// Steps m_currentIndex..last form one pipeline; while it runs the last stage
+// is the current step, so its captureAs, stopOnError and delay apply.
+void SequenceRunner::launchPipeline(int last) {
+    const QList<WorkflowCmd> &steps = phaseSteps();
+    QList<PipelineStage> stages;
+    QStringList shown;
+    bool asRoot = false;
+    for (int i = m_currentIndex; i <= last; ++i) {
+        const WorkflowCmd &cmd = steps.at(i);
+        PipelineStage stage;
+        if (cmd.launch.program.isEmpty()) {
+            const QString command = expandCommand(cmd);
+            CommandExecutor::shellInvocation(command, cmd.runAsRoot, &stage.program, &stage.args);
+            shown.append(command);
+        } else {
+            stage.program = cmd.launch.program;
+            stage.args = cmd.launch.args;
+            shown.append(cmd.command);}
+        stages.append(stage);
+        asRoot = asRoot || cmd.runAsRoot;}
+    emit logMessage(QString(">>> %1: %2").arg(asRoot ? "root" : "user", shown.join(" | ")), asRoot ? "#FF0000" : "#FFE066");
+    m_pipelineFirst = m_currentIndex;
+    m_currentIndex = last;
+    m_captureBuffer.clear();
+    m_awaitingExit = true;
+    m_pipeline.start(stages);}
+
+void SequenceRunner::onPipelineFinished(int exitCode) {
+    if (!m_isRunning || !m_awaitingExit) return;
+    m_awaitingExit = false;
+    const QList<WorkflowCmd> &steps = phaseSteps();
+    const QList<int> &codes = m_pipeline.exitCodes();
+    for (int i = 0; i < codes.count(); ++i) {
+        const WorkflowCmd &cmd = steps.at(m_pipelineFirst + i);
+        if (!cmd.id.isEmpty()) m_stepExitCodes.insert(cmd.id, codes.at(i));
+        if (m_pipelineFirst + i < m_currentIndex) releaseArtifacts(cmd);}
+    storeStepOutput();
+    handleStepResult(exitCode);}
+
+void SequenceRunner::onMatrixFinished(int exitCode) {
+    if (!m_isRunning || !m_awaitingExit) return;
+    m_awaitingExit = false;
+    handleStepResult(exitCode);}
+
+void SequenceRunner::onCommandOutput(const QString &text) {
+    if (!m_isRunning || !m_awaitingExit) return;
+    const WorkflowCmd &currentCmd = currentStep();
+    if (currentCmd.captureOutput || currentCmd.capture.isValid()) m_captureBuffer += text;
+    if (!currentCmd.hasReadyLine()) return;
+    m_lineBuffer += text;
+    int start = 0;
+    int nl;
+    while ((nl = m_lineBuffer.indexOf('\n', start)) >= 0) {
+        const QStringView line = QStringView(m_lineBuffer).mid(start, nl - start);
+        start = nl + 1;
+        if (currentCmd.readyLine.matchView(line).hasMatch()) {
+            m_awaitingExit = false;
+            m_readyLineTimer.stop();
+            m_lineBuffer.clear();
+            emit logMessage("Readiness line matched; command keeps running in background.", "#00BCD4");
+            m_executor->detach();
+            storeStepOutput();
+            handleStepResult(0);
+            return;}}
+    m_lineBuffer.remove(0, start);}
+
+void SequenceRunner::onReadyLineTimeout() {
+    if (!m_isRunning || !m_awaitingExit) return;
+    m_awaitingExit = false;
+    emit logMessage(QString("Timed out waiting for output line: %1").arg(currentStep().readyLine.pattern()), "#F44336");
+    m_executor->stop();
+    handleStepResult(-1);}
 
 void SequenceRunner::onCommandFinished(int exitCode, QProcess::ExitStatus) {
-    if (!m_isRunning) return;    
-    const WorkflowCmd &currentCmd = m_commands.at(m_currentIndex);
+    if (!m_isRunning || !m_awaitingExit) return;    
+    m_awaitingExit = false;
+    m_readyLineTimer.stop();
+    storeStepOutput();
+    const WorkflowCmd &currentCmd = currentStep();
+    if (!currentCmd.artifactOut.isEmpty()) {
+        QString error;
+        if (!m_artifacts.finishWrite(currentCmd.artifactOut, &error)) {
+            emit logMessage(QString("Artifact '%1': %2").arg(currentCmd.artifactOut, error), "#F44336");
+            handleStepResult(exitCode != 0 ? exitCode : -1);
+            return;}
+        emit logMessage(QString("Artifact '%1' ready (%2 MB in memory).").arg(currentCmd.artifactOut).arg(m_artifacts.totalSize() >> 20), "#00BCD4");}
+    if (currentCmd.fileCapture.isValid()) showFileCapturePreview(currentCmd.fileCapture);
+    if (currentCmd.hasReadyLine()) {
+        const bool matched = !m_lineBuffer.isEmpty() && currentCmd.readyLine.match(m_lineBuffer).hasMatch();
+        m_lineBuffer.clear();
+        if (!matched) {
+            emit logMessage("Command exited before printing the expected readiness line.", "#F44336");
+            handleStepResult(exitCode != 0 ? exitCode : -1);
+            return;}}
+    handleStepResult(exitCode);}
+
+void SequenceRunner::storeStepOutput() {
+    const WorkflowCmd &currentCmd = currentStep();
+    if (currentCmd.captureOutput) m_stepOutputs.insert(currentCmd.id, m_captureBuffer);
+    if (currentCmd.capture.isValid()) {
+        QString value;
+        if (currentCmd.capture.extract(m_captureBuffer, &value)) {
+            m_variables.insert(currentCmd.capture.name(), value);
+            emit logMessage(QString("Captured %1 = %2").arg(currentCmd.capture.name(), value.left(120)), "#00BCD4");
+        } else {
+            m_variables.remove(currentCmd.capture.name());
+            emit logMessage(QString("captureAs %1: nothing matched in command output.").arg(currentCmd.capture.name()), "#FFAA66");}}
+    m_captureBuffer.clear();}
+
+// Reads back at most previewBytes of what this run appended, so the log stays
+// bounded however large the file got.
+void SequenceRunner::showFileCapturePreview(const FileCaptureSpec &spec) {
+    QFile file(spec.path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        emit logMessage(QString("Cannot read captured output %1").arg(spec.path), "#FFAA66");
+        return;}
+    const qint64 written = file.size() - m_fileCaptureOffset;
+    emit logMessage(QString("Output saved to %1 (%2 bytes).").arg(spec.path).arg(written), "#00BCD4");
+    if (spec.previewBytes <= 0 || written <= 0 || !file.seek(m_fileCaptureOffset)) return;
+    const QByteArray head = file.read(qMin<qint64>(spec.previewBytes, written));
+    emit outputReceived(QString::fromUtf8(head));
+    if (written > head.size()) {
+        emit logMessage(QString("... preview truncated, %1 more bytes in file.").arg(written - head.size()), "#BDBDBD");}}
+
+void SequenceRunner::releaseArtifacts(const WorkflowCmd &cmd) {
+    for (const QString &name : cmd.artifactsUsed) m_artifacts.release(name);}
+
+void SequenceRunner::onArtifactQuotaExceeded(const QString &name, qint64 totalBytes) {
+    if (!m_isRunning || !m_awaitingExit) return;
+    emit logMessage(QString("Artifact '%1' stopped: %2 MB exceeds the %3 MB quota.").arg(name).arg(totalBytes >> 20).arg(m_run->artifactQuotaMB), "#F44336");
+    m_awaitingExit = false;
+    m_executor->stop();
+    QString error;
+    m_artifacts.finishWrite(name, &error);
+    handleStepResult(-1);}
+
+void SequenceRunner::onArtifactClosed(const QString &name) {
+    m_variables.remove(QLatin1String("artifact:") + name);}
+
+void SequenceRunner::handleStepResult(int exitCode) {
+    const WorkflowCmd &currentCmd = currentStep();
+    releaseArtifacts(currentCmd);
+    m_lastExitCode = exitCode;
+    if (!currentCmd.id.isEmpty()) m_stepExitCodes.insert(currentCmd.id, exitCode);
     if (exitCode != 0 && currentCmd.stopOnError) {
         emit logMessage(QString("Workflow stopped: Command failed with code %1. (stopOnError is true)").arg(exitCode), "#F44336");
-        finishSequence(false);
+        m_failed = true;
+        if (m_phase == MainPhase) startPhase(FailurePhase);
+        else if (m_phase == FailurePhase) startPhase(FinallyPhase);
+        else finishSequence(false);
         return;}
+    const int delayAfterMs = currentCmd.delayAfterMs;   // hasStep() may grow a streamed window
     m_currentIndex++;    
-    if (m_currentIndex < m_commands.count()) {
-        if (currentCmd.delayAfterMs > 0) {
-            emit logMessage(QString("Waiting for %1 ms before next command...").arg(currentCmd.delayAfterMs), "#FFC107");
-            m_delayTimer.setInterval(currentCmd.delayAfterMs);
+    if (hasStep(m_currentIndex)) {
+        if (delayAfterMs > 0) {
+            emit logMessage(QString("Waiting for %1 ms before next command...").arg(delayAfterMs), "#FFC107");
+            m_delayTimer.setInterval(delayAfterMs);
             m_delayTimer.start();
         } else {
             executeNextCommand();}
-    } else {
-        finishSequence(true);}}
+    } else if (!streamFailed()) {
+        finishPhase();}}
 
 void SequenceRunner::onDelayTimeout() {
     if (m_isRunning) {
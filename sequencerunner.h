@@ -5,27 +5,35 @@
 #include <QList>
 #include <QTimer>
 #include <QJsonObject>
+#include <QRegularExpression>
+#include <QHash>
+#include <memory>
+#include "readinessprobe.h"
+#include "matrixrunner.h"
+#include "pipelinerunner.h"
+#include "artifactstore.h"
+#include "workflowplan.h"
+#include "workflowstream.h"
+#include "workflowloader.h"
 
 class CommandExecutor;
 
-struct WorkflowCmd {
-    QString command;
-    int delayAfterMs = 0;
-    bool runAsRoot = false;
-    bool stopOnError = true;
-};
-
 class SequenceRunner : public QObject {
     Q_OBJECT
 public:
     explicit SequenceRunner(CommandExecutor *executor, QObject *parent = nullptr);
     bool loadWorkflow(const QString &filePath, bool clearExisting = true);
-    QStringList getCommandsAsText() const;
+    // Publishes a plan loaded elsewhere (see WorkflowLoader), or logs why it was rejected.
+    bool setPlan(const WorkflowLoader::Result &loaded);
+    std::shared_ptr<const WorkflowPlan> plan() const { return m_plan; }
     void startSequence();
     void stopSequence(bool forcedStop = true);
     void setIntervalToggle(bool toggle);
     void setIntervalValue(int seconds);
     bool isRunning() const { return m_isRunning; }
+    int commandCount() const { return m_plan ? int(m_plan->stepCount()) : 0; }
+    int priority() const { return m_plan ? m_plan->priority : 0; }
+    int scheduleInterval() const { return m_plan ? m_plan->intervalS : 0; }
 
 signals:
     void sequenceStarted();
@@ -33,20 +41,67 @@ signals:
     void scheduleRestart(int intervalSeconds); 
     void commandExecuting(const QString &cmd, int index, int total);
     void logMessage(const QString &text, const QString &color);
+    void outputReceived(const QString &text);
+    void errorReceived(const QString &text);
 
 private slots:
     void onCommandFinished(int exitCode, QProcess::ExitStatus exitStatus); 
+    void onCommandOutput(const QString &text);
     void onDelayTimeout();
+    void onProbeReady();
+    void onProbeFailed(const QString &reason);
+    void onReadyLineTimeout();
+    void onMatrixFinished(int exitCode);
+    void onPipelineFinished(int exitCode);
+    void onArtifactQuotaExceeded(const QString &name, qint64 totalBytes);
+    void onArtifactClosed(const QString &name);
 
 private:
+    enum Phase { MainPhase, FailurePhase, FinallyPhase };
     CommandExecutor *m_executor;
-    QList<WorkflowCmd> m_commands;
+    std::shared_ptr<const WorkflowPlan> m_plan;   // latest successfully loaded
+    std::shared_ptr<const WorkflowPlan> m_run;    // plan of the current run
+    std::unique_ptr<WorkflowStream> m_stream;     // main steps of a streamed m_run
+    Phase m_phase = MainPhase;
+    bool m_failed = false;
+    int m_lastExitCode = 0;
+    QHash<QString, int> m_stepExitCodes;
+    QHash<QString, QString> m_variables;
     QTimer m_delayTimer;
+    QTimer m_readyLineTimer;
+    ReadinessProbe m_probe;
+    MatrixRunner m_matrix;
+    PipelineRunner m_pipeline;
+    ArtifactStore m_artifacts;
+    int m_pipelineFirst = 0;
+    QHash<QString, QString> m_stepOutputs;
+    QString m_captureBuffer;
+    qint64 m_fileCaptureOffset = 0;
+    QString m_lineBuffer;
     int m_currentIndex = 0;
+    int m_waitIndex = 0;
+    bool m_awaitingExit = false;
     bool m_isRunning = false;
     bool m_isInterval = false;
     int m_intervalValueS = 60;   
     void finishSequence(bool success); 
     void executeNextCommand();
-    WorkflowCmd parseCommandFromJson(const QJsonObject &obj);
+    void runNextWait();
+    void launchCurrentCommand();
+    void handleStepResult(int exitCode);
+    void storeStepOutput();
+    void showFileCapturePreview(const FileCaptureSpec &spec);
+    void launchPipeline(int last);
+    QString expandCommand(const WorkflowCmd &cmd) const;
+    void startPhase(Phase phase);
+    void finishPhase();
+    const QList<WorkflowCmd> &phaseSteps() const;
+    const WorkflowCmd &currentStep() const { return phaseSteps().at(m_currentIndex); }
+    bool hasStep(int index);
+    bool streamFailed();
+    qint64 stepNumber(int index) const;
+    bool shouldRun(const WorkflowCmd &cmd, const ExpressionContext &ctx) const;
+    ExpressionContext expressionContext() const;
+    void releaseArtifacts(const WorkflowCmd &cmd);
+    std::unique_ptr<MatrixItemSource> createItemSource(const MatrixSpec &spec);
 };
@@ -13,6 +13,8 @@ SettingsDialog::SettingsDialog(QWidget *parent)
     auto main = new QVBoxLayout(this);
     m_safeCheck = new QCheckBox("Safe mode (block destructive commands)");
     main->addWidget(m_safeCheck);
+    m_brokerCheck = new QCheckBox("Root helper (one sudo -n for all root commands)");
+    main->addWidget(m_brokerCheck);
     auto btnRow = new QHBoxLayout();
     btnRow->addStretch(1);
     auto ok = new QPushButton("OK");
@@ -27,3 +29,5 @@ SettingsDialog::SettingsDialog(QWidget *parent)
 SettingsDialog::~SettingsDialog() = default;
 void SettingsDialog::setSafeMode(bool v) { m_safeCheck->setChecked(v); }
 bool SettingsDialog::safeMode() const { return m_safeCheck->isChecked(); }
+void SettingsDialog::setRootBroker(bool v) { m_brokerCheck->setChecked(v); }
+bool SettingsDialog::rootBroker() const { return m_brokerCheck->isChecked(); }
@@ -12,6 +12,9 @@ public:
     ~SettingsDialog();
     void setSafeMode(bool v);
     bool safeMode() const;
+    void setRootBroker(bool v);
+    bool rootBroker() const;
 private:
     QCheckBox *m_safeCheck = nullptr;
+    QCheckBox *m_brokerCheck = nullptr;
 };
@@ -0,0 +1,267 @@
+#include "spawnhelper.h"
+#include <vector>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+#ifndef SYS_close_range
+#define SYS_close_range 436
+#endif
+
+std::atomic<int> SpawnHelper::s_socket{-1};
+quint64 SpawnHelper::s_nextRequest = 1;
+QList<quint64> SpawnHelper::s_abandoned;
+
+namespace {
+enum MessageType : quint32 { Spawned = 1, Exited = 2 };
+
+struct Request {
+    quint64 id;
+    quint32 argc;
+    quint32 size;     // bytes of NUL-terminated argv that follow
+};
+
+struct Reply {
+    quint32 type;
+    qint32 pid;
+    qint32 value;     // errno for Spawned, wait status for Exited
+    quint64 id;
+};
+
+constexpr int MaxMessage = 1 << 20;
+
+void sendReply(int sock, const Reply &reply) {
+    while (send(sock, &reply, sizeof(reply), MSG_NOSIGNAL) < 0 && errno == EINTR) {}
+}
+
+void closeFrom(int first) {
+    if (syscall(SYS_close_range, first, ~0U, 0) == 0) return;
+    const long max = qMin(sysconf(_SC_OPEN_MAX), 65536L);
+    for (long fd = first; fd < max; ++fd) ::close(int(fd));
+}
+
+// posix_spawn uses CLONE_VM|CLONE_VFORK on glibc, so even this small
+// process is never copied.
+int spawnChild(char *const argv[], const int fds[3], pid_t *pid) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    for (int i = 0; i < 3; ++i) posix_spawn_file_actions_adddup2(&actions, fds[i], i);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t none;
+    sigset_t defaults;
+    sigemptyset(&none);
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    sigaddset(&defaults, SIGCHLD);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    const int rc = posix_spawnp(pid, argv[0], &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    return rc;
+}
+}
+
+void SpawnHelper::launch() {
+    const char *flag = std::getenv("SHOOT_COMMANDS_SPAWN_HELPER");
+    if (flag && std::strcmp(flag, "0") == 0) return;
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0) return;
+    const int size = MaxMessage + 4096;
+    for (int fd : sv) {
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+    const pid_t pid = fork();
+    if (pid < 0) {
+        ::close(sv[0]);
+        ::close(sv[1]);
+        return;
+    }
+    if (pid == 0) {
+        ::close(sv[0]);
+        serve(sv[1]);
+    }
+    ::close(sv[1]);
+    s_socket.store(sv[0], std::memory_order_release);
+}
+
+void SpawnHelper::serve(int sock) {
+    // Keep stdio for diagnostics, the socket as fd 3, nothing else.
+    if (sock != 3) {
+        dup2(sock, 3);
+        ::close(sock);
+        sock = 3;
+    }
+    fcntl(sock, F_SETFD, FD_CLOEXEC);
+    closeFrom(4);
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, nullptr);
+    const int sigfd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    std::vector<char> buffer(MaxMessage);
+    for (;;) {
+        pollfd pfd[2] = {{sock, POLLIN, 0}, {sigfd, POLLIN, 0}};
+        if (poll(pfd, sigfd >= 0 ? 2 : 1, sigfd >= 0 ? -1 : 100) < 0 && errno != EINTR) _exit(1);
+        if (sigfd < 0 || (pfd[1].revents & POLLIN)) {
+            signalfd_siginfo info;
+            while (sigfd >= 0 && read(sigfd, &info, sizeof(info)) > 0) {}
+            int status = 0;
+            pid_t pid;
+            while ((pid = waitpid(-1, &status, WNOHANG)) > 0) sendReply(sock, {Exited, pid, status, 0});
+        }
+        if (!(pfd[0].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+        iovec iov{buffer.data(), buffer.size()};
+        alignas(cmsghdr) char control[CMSG_SPACE(3 * sizeof(int))];
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        const ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN)) _exit(0);   // GUI is gone
+        if (n < 0) continue;
+        // Every descriptor received is taken before any check, so one that
+        // came with a short or truncated message is closed, not leaked.
+        int fds[3] = {-1, -1, -1};
+        bool wellFormed = !(msg.msg_flags & (MSG_CTRUNC | MSG_TRUNC));
+        for (cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+            const size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            int received[3];
+            std::memcpy(received, CMSG_DATA(c), qMin<size_t>(count, 3) * sizeof(int));
+            if (count == 3 && fds[0] < 0) {
+                std::memcpy(fds, received, sizeof(fds));
+            } else {
+                for (size_t i = 0; i < qMin<size_t>(count, 3); ++i) ::close(received[i]);
+                wellFormed = false;
+            }
+        }
+        if (!wellFormed || n < ssize_t(sizeof(Request))) {
+            for (int fd : fds) if (fd >= 0) ::close(fd);
+            // With its id readable the request fails now instead of timing out.
+            if (n >= ssize_t(sizeof(Request))) {
+                Request request;
+                std::memcpy(&request, buffer.data(), sizeof(request));
+                sendReply(sock, {Spawned, -1, EMSGSIZE, request.id});
+            }
+            continue;
+        }
+        Request request;
+        std::memcpy(&request, buffer.data(), sizeof(request));
+        std::vector<char *> argv;
+        char *p = buffer.data() + sizeof(Request);
+        char *end = p + qMin<qint64>(request.size, n - qint64(sizeof(Request)));
+        while (p < end && argv.size() < request.argc) {
+            argv.push_back(p);
+            p += std::strlen(p) + 1;
+        }
+        argv.push_back(nullptr);
+        pid_t pid = -1;
+        int rc = EINVAL;
+        if (fds[0] >= 0 && argv.size() > 1) rc = spawnChild(argv.data(), fds, &pid);
+        for (int fd : fds) if (fd >= 0) ::close(fd);
+        sendReply(sock, {Spawned, rc == 0 ? pid : -1, rc, request.id});
+    }
+}
+
+void SpawnHelper::shutdownSocket() {
+    const int sock = s_socket.exchange(-1, std::memory_order_acq_rel);
+    if (sock >= 0) ::close(sock);
+    s_abandoned.clear();
+}
+
+// The helper still reaps a killed child and reports its exit, which no
+// supervisor knows any more.
+bool SpawnHelper::killAbandoned(quint64 id, pid_t pid) {
+    if (!s_abandoned.removeOne(id)) return false;
+    if (pid > 0) ::kill(pid, SIGKILL);
+    return true;
+}
+
+int SpawnHelper::spawn(const QList<QByteArray> &argv, const int fds[3], pid_t *pid, const ExitHandler &onExit) {
+    const int sock = s_socket.load(std::memory_order_acquire);
+    if (sock < 0) return ENOTCONN;
+    QByteArray payload;
+    for (const QByteArray &arg : argv) {
+        payload += arg;
+        payload += '\0';
+    }
+    if (payload.size() + qsizetype(sizeof(Request)) > MaxMessage) return E2BIG;
+    Request request{s_nextRequest++, quint32(argv.size()), quint32(payload.size())};
+    iovec iov[2] = {{&request, sizeof(request)}, {payload.data(), size_t(payload.size())}};
+    alignas(cmsghdr) char control[CMSG_SPACE(3 * sizeof(int))] = {};
+    msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    std::memcpy(CMSG_DATA(c), fds, 3 * sizeof(int));
+    ssize_t sent;
+    while ((sent = sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR) {}
+    if (sent < 0) {
+        const int err = errno;
+        shutdownSocket();
+        return err;
+    }
+    // Exits of earlier children can be queued ahead of our reply.
+    for (;;) {
+        pollfd pfd{sock, POLLIN, 0};
+        if (poll(&pfd, 1, 5000) <= 0) {
+            s_abandoned.append(request.id);
+            return ETIMEDOUT;
+        }
+        Reply reply;
+        const ssize_t n = recv(sock, &reply, sizeof(reply), 0);
+        if (n <= 0) {
+            shutdownSocket();
+            return ECONNRESET;
+        }
+        if (n != ssize_t(sizeof(reply))) continue;
+        if (reply.type == Exited) {
+            onExit(reply.pid, reply.value);
+        } else if (reply.type == Spawned && reply.id == request.id) {
+            *pid = reply.pid;
+            return reply.value;
+        } else if (reply.type == Spawned) {
+            killAbandoned(reply.id, reply.pid);
+        }
+    }
+}
+
+bool SpawnHelper::processMessages(int timeoutMs, const ExitHandler &onExit) {
+    const int sock = s_socket.load(std::memory_order_acquire);
+    if (sock < 0) return false;
+    pollfd pfd{sock, POLLIN, 0};
+    if (poll(&pfd, 1, timeoutMs) <= 0) return true;
+    for (;;) {
+        Reply reply;
+        const ssize_t n = recv(sock, &reply, sizeof(reply), MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) return true;
+        if (n <= 0) {
+            shutdownSocket();
+            return false;
+        }
+        if (n != ssize_t(sizeof(reply))) continue;
+        if (reply.type == Exited) onExit(reply.pid, reply.value);
+        else if (reply.type == Spawned) killAbandoned(reply.id, reply.pid);
+    }
+}
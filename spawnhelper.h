@@ -0,0 +1,37 @@
+#pragma once
+
+#include <QList>
+#include <QByteArray>
+#include <atomic>
+#include <functional>
+#include <sys/types.h>
+
+// A small process forked from main() before Qt starts. It performs every
+// EpollBackend spawn with posix_spawn, so starting a command never has to
+// duplicate the GUI's page tables however large the log has grown. Requests go
+// over a SOCK_SEQPACKET socketpair with the child's stdin/stdout/stderr passed
+// as SCM_RIGHTS; the helper reaps its children and reports their wait status.
+// Only the executor thread talks to it; isRunning() may be asked from any thread.
+class SpawnHelper {
+public:
+    using ExitHandler = std::function<void(pid_t pid, int status)>;
+
+    // Call first in main(); SHOOT_COMMANDS_SPAWN_HELPER=0 disables it.
+    static void launch();
+    static bool isRunning() { return s_socket.load(std::memory_order_acquire) >= 0; }
+    static int socketFd() { return s_socket.load(std::memory_order_acquire); }
+    // Returns 0 or an errno value. Exits reported while waiting go to onExit.
+    // A request that times out is abandoned: should its child start after
+    // all, it is killed as soon as the late reply is read.
+    static int spawn(const QList<QByteArray> &argv, const int fds[3], pid_t *pid, const ExitHandler &onExit);
+    // Handles every message that arrives within timeoutMs; false once the helper is gone.
+    static bool processMessages(int timeoutMs, const ExitHandler &onExit);
+
+private:
+    static std::atomic<int> s_socket;
+    static quint64 s_nextRequest;
+    static QList<quint64> s_abandoned;   // timed-out request ids
+    [[noreturn]] static void serve(int sock);
+    static void shutdownSocket();
+    static bool killAbandoned(quint64 id, pid_t pid);
+};
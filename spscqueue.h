@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+// Unbounded single-producer/single-consumer queue. push() is only called from
+// one thread and pop() from one other thread; neither takes a lock. The last
+// popped node stays behind as the stub, so the two sides only ever meet on
+// an atomic next pointer.
+template <typename T>
+class SpscQueue {
+public:
+    SpscQueue() {
+        Node *stub = new Node;
+        m_head = stub;
+        m_tail = stub;}
+    ~SpscQueue() {
+        T discard;
+        while (pop(&discard)) {}
+        delete m_head;}
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    void push(T value) {
+        Node *node = new Node;
+        node->value = std::move(value);
+        m_tail->next.store(node, std::memory_order_release);
+        m_tail = node;}
+
+    bool pop(T *out) {
+        Node *next = m_head->next.load(std::memory_order_acquire);
+        if (!next) return false;
+        *out = std::move(next->value);
+        delete m_head;
+        m_head = next;
+        return true;}
+
+private:
+    struct Node {
+        std::atomic<Node *> next{nullptr};
+        T value{};
+    };
+    alignas(64) Node *m_head;   // consumer only
+    alignas(64) Node *m_tail;   // producer only
+};
@@ -2,27 +2,22 @@
 #define SYSTEMCMD_H
 
 #include <QString>
-#include <string>
-#include "nlohmann/json.hpp"
 
+// One entry of the command store; read and written by JsonIO.
 struct SystemCmd {
     QString command;
     QString description;
-    nlohmann::json toJson() const {
-        return nlohmann::json{
-            {"command", command.toStdString()},
-            {"description", description.toStdString()}
-        };
-    }
+    bool operator==(const SystemCmd &other) const { return command == other.command && description == other.description; }
+    bool operator!=(const SystemCmd &other) const { return !(*this == other); }};
 
-    static SystemCmd fromJson(const nlohmann::json &j) {
-        SystemCmd cmd;
-        if (j.contains("command")) {
-            cmd.command = QString::fromStdString(j.at("command").get<std::string>());
-        }
-        if (j.contains("description")) {
-            cmd.description = QString::fromStdString(j.at("description").get<std::string>());
-        }
-        return cmd;}};
+// One edit of the command store, as kept in its journal. Entries are named by
+// command and description, so replaying a change twice leaves the same store.
+struct CommandChange {
+    enum Kind { Add, Remove, Replace };
+    Kind kind = Add;
+    QString category;
+    SystemCmd cmd;
+    SystemCmd replacement;      // Replace only
+};
 
 #endif // SYSTEMCMD_H
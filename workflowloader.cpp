@@ -0,0 +1,99 @@
+#include "workflowloader.h"
+#include "workflowstream.h"
+#include "jsonio.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QSet>
+
+namespace {
+// forEach files are named relative to the workflow file, not the working directory.
+void resolveStepPaths(WorkflowPlan *plan, const QFileInfo &info) {
+    for (QList<WorkflowCmd> *steps : {&plan->steps, &plan->onFailure, &plan->finally}) {
+        for (WorkflowCmd &cmd : *steps) cmd.matrix.resolvePath(info.absolutePath());}}
+
+// Marks the steps whose output feeds a later forEach so only those are buffered,
+// and counts the consumers of each artifact so it can be freed after the last one.
+bool linkStepReferences(WorkflowPlan *plan, QString *error) {
+    QList<WorkflowCmd *> all;
+    for (QList<WorkflowCmd> *steps : {&plan->steps, &plan->onFailure, &plan->finally}) {
+        for (WorkflowCmd &cmd : *steps) all.append(&cmd);}
+    plan->artifactConsumers.clear();
+    QSet<QString> produced;
+    for (int i = 0; i < all.count(); ++i) {
+        const WorkflowCmd *cmd = all.at(i);
+        for (const QString &name : cmd->artifactsUsed) {
+            if (!produced.contains(name)) {
+                *error = QString("Step %1: artifact '%2' is not produced by an earlier step.").arg(i + 1).arg(name);
+                return false;}
+            plan->artifactConsumers[name]++;}
+        if (!cmd->artifactOut.isEmpty()) produced.insert(cmd->artifactOut);
+        if (cmd->matrix.source != MatrixSpec::StepOutput) continue;
+        bool found = false;
+        for (int j = 0; j < i && !found; ++j) {
+            if (!all.at(j)->id.isEmpty() && all.at(j)->id == cmd->matrix.stepId) {
+                if (j + 1 < all.count() && all.at(j + 1)->pipeFrom == cmd->matrix.stepId) {
+                    *error = QString("Step %1: forEach.fromStep '%2' pipes its output into the next step.").arg(i + 1).arg(cmd->matrix.stepId);
+                    return false;}
+                all.at(j)->captureOutput = true;
+                found = true;}}
+        if (!found) {
+            *error = QString("Step %1: forEach.fromStep '%2' does not name an earlier step id.").arg(i + 1).arg(cmd->matrix.stepId);
+            return false;}}
+    return true;}
+
+WorkflowLoader::Result rejected(const QString &path, const QString &message) {
+    return {path, nullptr, QString("%1: %2").arg(path, message)};}
+
+// Only the step offsets are kept; steps are parsed as the run reaches them.
+// The NDJSON header line supplies what the root object holds in a .json file.
+WorkflowLoader::Result loadStreamed(const QString &path, const QFileInfo &info) {
+    auto plan = std::make_shared<WorkflowPlan>();
+    QString error;
+    if (!WorkflowStream::index(path, plan.get(), &error)) return rejected(path, error);
+    if (WorkflowStream::isLineFormat(path) && plan->stepCount() > 0) {
+        QFile file(path);
+        QByteArray line;
+        bool isHeader = false;
+        if (!file.open(QIODevice::ReadOnly) || !WorkflowStream::readRecord(&file, plan->streamOffsets, 0, &line, &error)
+            || !JsonIO::readStreamHeader(line, plan.get(), &isHeader, &error)) {
+            return rejected(path, error);}
+        if (isHeader) plan->streamOffsets.removeFirst();}
+    resolveStepPaths(plan.get(), info);
+    if (!linkStepReferences(plan.get(), &error)) return rejected(path, QString("Invalid workflow: %1").arg(error));
+    plan->buildSummary();
+    WorkflowPlanCache::insert(info, QByteArray(), plan);
+    const QString message = QString("Indexed %1 streamed commands from %2.").arg(plan->stepCount()).arg(path);
+    return {path, std::move(plan), message};}
+
+WorkflowLoader::Result cached(const QString &path, std::shared_ptr<const WorkflowPlan> plan) {
+    const QString message = QString("Loaded %1 commands (unchanged since the last load).").arg(plan->stepCount());
+    return {path, std::move(plan), message};}
+}
+
+WorkflowLoader::Result WorkflowLoader::load(const QString &path, std::shared_ptr<const WorkflowPlan> base) {
+    // Appending depends on what is already loaded, so only full loads are cached.
+    const QFileInfo info(path);
+    if (!base) {
+        if (std::shared_ptr<const WorkflowPlan> plan = WorkflowPlanCache::lookup(info)) return cached(path, std::move(plan));}
+    if (WorkflowStream::wantsStreaming(path)) return loadStreamed(path, info);
+    if (base && base->isStreamed()) return rejected(path, "Cannot append steps to a streamed workflow.");
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) return rejected(path, "Cannot open file.");
+    const QByteArray data = file.readAll();
+    file.close();
+    if (!base) {
+        if (std::shared_ptr<const WorkflowPlan> plan = WorkflowPlanCache::revalidate(info, data)) return cached(path, std::move(plan));}
+    // Built aside and published whole, so a failed load leaves the old plan
+    // and a running sequence keeps the one it started with.
+    auto plan = std::make_shared<WorkflowPlan>();
+    if (base) *plan = *base;
+    const qsizetype before = plan->steps.count();
+    QString error;
+    if (!JsonIO::readWorkflow(data, plan.get(), &error)) return rejected(path, error);
+    // Steps appended to a base plan were resolved against their own file already.
+    resolveStepPaths(plan.get(), info);
+    if (!linkStepReferences(plan.get(), &error)) return rejected(path, QString("Invalid workflow: %1").arg(error));
+    plan->buildSummary();
+    if (!base) WorkflowPlanCache::insert(info, data, plan);
+    const QString message = QString("Loaded %1 commands. Total commands: %2.").arg(plan->steps.count() - before).arg(plan->steps.count());
+    return {path, std::move(plan), message};}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <QString>
+#include <memory>
+#include "workflowplan.h"
+
+// Reads, parses and validates workflow files into plans. Keeps no state and
+// only touches the thread-safe plan and executable caches, so many files can
+// be loaded on worker threads and the plans handed to runners afterwards.
+class WorkflowLoader {
+public:
+    struct Result {
+        QString path;
+        std::shared_ptr<const WorkflowPlan> plan;   // null when the file was rejected
+        QString message;    // the error ("file: line L, column C: ..."), or what was loaded
+    };
+    // base: a plan to append the file's steps to; null loads the file on its own.
+    static Result load(const QString &path, std::shared_ptr<const WorkflowPlan> base = nullptr);
+};
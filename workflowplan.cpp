@@ -0,0 +1,337 @@
+#include "workflowplan.h"
+#include "commandexecutor.h"
+#include <QFileInfo>
+#include <QCache>
+#include <QMutex>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QJsonArray>
+#include <QJsonValue>
+#include <QSet>
+#include <QStandardPaths>
+#include <QPair>
+
+namespace {
+// Builtins and keywords exist only inside bash, or behave differently there.
+const QSet<QString> &shellWords() {
+    static const QSet<QString> words = {
+        "cd", "export", "source", ".", "alias", "unalias", "unset", "set", "exit", "eval", "exec", "read",
+        "ulimit", "umask", "wait", "trap", "shopt", "declare", "typeset", "local", "readonly", "let", "type",
+        "hash", "history", "jobs", "fg", "bg", "disown", "builtin", "command", "enable", "pushd", "popd",
+        "dirs", "logout", "return", "shift", "break", "continue", "getopts", "times", "suspend", "caller",
+        "compgen", "complete", "mapfile", "readarray", "if", "then", "else", "elif", "fi", "for", "while",
+        "until", "do", "done", "case", "esac", "function", "select", "time", "coproc", "!", "[[", "]]", "{", "}"};
+    return words;}
+
+// Splits a command that needs nothing from the shell: words of plain
+// characters, optionally single-quoted or double-quoted without $ ` \ or !.
+// Anything bash would have to interpret (globs, ~, variables, redirections,
+// separators, comments, escapes) makes it return false.
+bool splitPlainCommand(const QString &command, QStringList *argv) {
+    QString word;
+    bool inWord = false;
+    for (qsizetype i = 0; i < command.size(); ++i) {
+        const QChar c = command.at(i);
+        if (c == QLatin1Char(' ') || c == QLatin1Char('\t')) {
+            if (inWord) argv->append(word);
+            word.clear();
+            inWord = false;
+            continue;}
+        inWord = true;
+        if (c == QLatin1Char('\'') || c == QLatin1Char('"')) {
+            const qsizetype close = command.indexOf(c, i + 1);
+            if (close < 0) return false;
+            const QStringView quoted = QStringView(command).mid(i + 1, close - i - 1);
+            if (c == QLatin1Char('"')) {
+                for (const QChar q : quoted) {
+                    if (q == QLatin1Char('$') || q == QLatin1Char('`') || q == QLatin1Char('\\') || q == QLatin1Char('!')) return false;}}
+            word += quoted;
+            i = close;
+            continue;}
+        if (!c.isLetterOrNumber() && !QStringView(u"-_./=:,+@%^").contains(c)) return false;
+        word += c;}
+    if (inWord) argv->append(word);
+    return !argv->isEmpty();}
+}
+
+LaunchSpec LaunchSpec::forStep(const WorkflowCmd &cmd) {
+    LaunchSpec spec;
+    const QString who = cmd.runAsRoot ? QStringLiteral("root") : QStringLiteral("user");
+    if (cmd.isMatrix()) {
+        spec.logLine = QString(">>> %1: %2 (%3)").arg(who, cmd.command, cmd.matrix.describe());
+        return spec;}
+    if (cmd.commandTemplate.hasVariables()) return spec;
+    spec.logLine = QString(">>> %1: %2").arg(who, cmd.command);
+    // Root steps stay on runShellCommand() so they can use the root broker.
+    if (cmd.runAsRoot) return spec;
+    QStringList argv;
+    if (splitPlainCommand(cmd.command, &argv) && !argv.first().contains(QLatin1Char('=')) && !shellWords().contains(argv.first())) {
+        spec.program = ExecutableCache::resolve(argv.first());
+        if (!spec.program.isEmpty()) {
+            spec.args = argv.mid(1);
+            spec.direct = true;
+            return spec;}}
+    CommandExecutor::shellInvocation(cmd.command, false, &spec.program, &spec.args);
+    return spec;}
+
+// Values are taken with QJsonValue's conversions, so a key of the wrong type
+// reads as its default just as it did with QJsonObject::value().
+void WorkflowStepKeys::set(const QString &key, const QJsonValue &v) {
+    if (key == QLatin1String("id")) id = v.toString();
+    else if (key == QLatin1String("command")) command = v.toString();
+    else if (key == QLatin1String("delayAfterMs")) delayAfterMs = v.toInt(0);
+    else if (key == QLatin1String("runAsRoot")) runAsRoot = v.toBool(false);
+    else if (key == QLatin1String("stopOnError")) stopOnError = v.toBool(true);
+    else if (key == QLatin1String("waitTimeoutMs")) waitTimeoutMs = v.toInt(60000);
+    else if (key == QLatin1String("waitForFile")) waitForFile = v.toString();
+    else if (key == QLatin1String("waitForPort")) waitForPort = v;
+    else if (key == QLatin1String("waitForProcessExit")) waitForProcessExit = v;
+    else if (key == QLatin1String("waitForOutputLine")) waitForOutputLine = v.toString();
+    else if (key == QLatin1String("if")) runIf = v.toString();
+    else if (key == QLatin1String("unless")) runUnless = v.toString();
+    else if (key == QLatin1String("forEach")) forEach = v;
+    else if (key == QLatin1String("maxParallel")) maxParallel = v.toInt(4);
+    else if (key == QLatin1String("backend")) backend = v.toString();
+    else if (key == QLatin1String("pipeFrom")) pipeFrom = v.toString();
+    else if (key == QLatin1String("artifactOut")) artifactOut = v.toString();
+    else if (key == QLatin1String("artifactIn")) artifactIn = v.toString();
+    else if (key == QLatin1String("captureToFile")) captureToFile = v;
+    else if (key == QLatin1String("captureAs")) captureAs = v;}
+
+bool WorkflowCmd::compile(const WorkflowStepKeys &keys, WorkflowCmd *out, QString *error) {
+    WorkflowCmd &cmd = *out;
+    cmd.id = keys.id;
+    cmd.command = keys.command;
+    cmd.commandTemplate = CommandTemplate::compile(cmd.command);
+    cmd.delayAfterMs = keys.delayAfterMs;
+    cmd.runAsRoot = keys.runAsRoot;
+    cmd.stopOnError = keys.stopOnError;
+    cmd.waitTimeoutMs = keys.waitTimeoutMs;
+    if (keys.waitForFile) {
+        ReadinessWait w;
+        w.kind = ReadinessWait::File;
+        w.path = *keys.waitForFile;
+        cmd.waits.append(w);}
+    if (!keys.waitForPort.isUndefined()) {
+        // Checked here rather than narrowed, so a bad port is a load error
+        // instead of a wait on some other port until waitTimeoutMs.
+        const double port = keys.waitForPort.toDouble(-1);
+        if (!keys.waitForPort.isDouble() || port != qint64(port) || port < 1 || port > 65535) {
+            *error = "waitForPort needs a port number from 1 to 65535";
+            return false;}
+        ReadinessWait w;
+        w.kind = ReadinessWait::Port;
+        w.port = static_cast<quint16>(port);
+        cmd.waits.append(w);}
+    if (!keys.waitForProcessExit.isUndefined()) {
+        const QJsonValue &v = keys.waitForProcessExit;
+        ReadinessWait w;
+        w.kind = ReadinessWait::ProcessExit;
+        if (v.isString()) w.path = v.toString();
+        else w.pid = v.toInteger();
+        cmd.waits.append(w);}
+    if (keys.waitForOutputLine) {
+        cmd.readyLine.setPattern(*keys.waitForOutputLine);
+        if (!cmd.readyLine.isValid()) {
+            *error = QString("invalid waitForOutputLine pattern '%1': %2").arg(cmd.readyLine.pattern(), cmd.readyLine.errorString());
+            return false;}}
+    if (keys.runIf) {
+        QString exprError;
+        cmd.runIf = Expression::compile(*keys.runIf, &exprError);
+        if (!cmd.runIf.isValid()) {
+            *error = QString("invalid \"if\" condition: %1").arg(exprError);
+            return false;}}
+    if (keys.runUnless) {
+        QString exprError;
+        cmd.runUnless = Expression::compile(*keys.runUnless, &exprError);
+        if (!cmd.runUnless.isValid()) {
+            *error = QString("invalid \"unless\" condition: %1").arg(exprError);
+            return false;}}
+    if (!keys.forEach.isUndefined()) {
+        const QJsonValue &v = keys.forEach;
+        // A malformed forEach must not fall back to one plain run, which
+        // would hand bash a literal {{item}}.
+        if (v.isArray()) {
+            cmd.matrix.source = MatrixSpec::Inline;
+            cmd.matrix.items = v.toArray();
+        } else if (v.isObject()) {
+            const QJsonObject spec = v.toObject();
+            if (spec.contains("items")) {
+                if (!spec.value("items").isArray()) {
+                    *error = "forEach items must be an array";
+                    return false;}
+                cmd.matrix.source = MatrixSpec::Inline;
+                cmd.matrix.items = spec.value("items").toArray();
+            } else if (spec.contains("file")) {
+                cmd.matrix.source = MatrixSpec::File;
+                cmd.matrix.path = spec.value("file").toString();
+            } else if (spec.contains("fromStep")) {
+                cmd.matrix.source = MatrixSpec::StepOutput;
+                cmd.matrix.stepId = spec.value("fromStep").toString();}}
+        if (!cmd.isMatrix()) {
+            *error = "forEach needs an array or an object with items, file or fromStep";
+            return false;}
+        cmd.matrix.maxParallel = qMax(1, keys.maxParallel);}
+    if (keys.backend) {
+        const QString &backend = *keys.backend;
+        if (!cmd.isMatrix()) {
+            *error = "backend applies to forEach steps only";
+            return false;}
+        if (backend == "epoll") {
+            cmd.matrix.backend = CommandExecutor::EpollBackend;
+        } else if (backend == "qprocess") {
+            cmd.matrix.backend = CommandExecutor::QProcessBackend;
+        } else {
+            *error = QString("unknown backend '%1' (expected qprocess or epoll)").arg(backend);
+            return false;}}
+    cmd.pipeFrom = keys.pipeFrom;
+    cmd.artifactOut = keys.artifactOut;
+    cmd.artifactIn = keys.artifactIn;
+    if (!cmd.artifactIn.isEmpty()) cmd.artifactsUsed.append(cmd.artifactIn);
+    for (const CommandTemplate::Segment &seg : cmd.commandTemplate.segments()) {
+        if (seg.isVariable && seg.text.startsWith(QLatin1String("artifact:")) && !cmd.artifactsUsed.contains(seg.text.mid(9))) {
+            cmd.artifactsUsed.append(seg.text.mid(9));}}
+    if (!cmd.artifactOut.isEmpty() && (cmd.isMatrix() || cmd.isPiped() || cmd.hasReadyLine() || !keys.captureAs.isUndefined())) {
+        *error = "artifactOut cannot be combined with forEach, pipeFrom, waitForOutputLine or captureAs";
+        return false;}
+    if (!cmd.artifactIn.isEmpty() && (cmd.isMatrix() || cmd.isPiped())) {
+        *error = "artifactIn cannot be combined with forEach or pipeFrom";
+        return false;}
+    if (cmd.isPiped() && (cmd.isMatrix() || cmd.hasReadyLine() || !cmd.waits.isEmpty() || cmd.runIf.isValid() || cmd.runUnless.isValid())) {
+        *error = "a pipeFrom step cannot use forEach, waitFor*, if or unless";
+        return false;}
+    if (!keys.captureToFile.isUndefined()) {
+        const QJsonValue &v = keys.captureToFile;
+        if (v.isObject()) {
+            const QJsonObject spec = v.toObject();
+            cmd.fileCapture.path = spec.value("path").toString();
+            cmd.fileCapture.stderrPath = spec.value("stderr").toString();
+            cmd.fileCapture.append = spec.value("append").toBool(false);
+            cmd.fileCapture.previewBytes = qMax(0, spec.value("previewBytes").toInt(2048));
+        } else {
+            cmd.fileCapture.path = v.toString();}
+        if (!cmd.fileCapture.isValid()) {
+            *error = "captureToFile needs a path";
+            return false;}
+        if (cmd.isMatrix() || cmd.isPiped() || cmd.hasReadyLine() || !cmd.artifactOut.isEmpty() || !keys.captureAs.isUndefined()) {
+            *error = "captureToFile cannot be combined with forEach, pipeFrom, waitForOutputLine, artifactOut or captureAs";
+            return false;}}
+    if (!keys.captureAs.isUndefined()) {
+        if (cmd.isMatrix()) {
+            *error = "captureAs is not supported on forEach steps";
+            return false;}
+        cmd.capture = OutputCapture::fromJson(keys.captureAs, error);
+        if (!cmd.capture.isValid()) return false;}
+    cmd.launch = LaunchSpec::forStep(cmd);
+    return true;}
+
+bool WorkflowCmd::canFeedPipe() const {
+    return !isMatrix() && !hasReadyLine() && !capture.isValid() && artifactOut.isEmpty() && artifactIn.isEmpty()
+           && !fileCapture.isValid() && !command.trimmed().isEmpty();}
+
+QString WorkflowCmd::describe() const {
+    QString line = command;
+    QString details;
+    if (runIf.isValid()) {
+        details += QString(" (If: %1)").arg(runIf.source());}
+    if (runUnless.isValid()) {
+        details += QString(" (Unless: %1)").arg(runUnless.source());}
+    if (delayAfterMs > 0) {
+        details += QString(" (Delay: %1ms)").arg(delayAfterMs);}
+    if (runAsRoot) {
+        details += " (ROOT)";}
+    for (const ReadinessWait &w : waits) {
+        details += QString(" (Wait: %1)").arg(w.describe());}
+    if (hasReadyLine()) {
+        details += QString(" (Until line: %1)").arg(readyLine.pattern());}
+    if (isMatrix()) {
+        details += QString(" (%1)").arg(matrix.describe());}
+    if (capture.isValid()) {
+        details += QString(" (%1)").arg(capture.describe());}
+    if (isPiped()) {
+        details += QString(" (Pipe from: %1)").arg(pipeFrom);}
+    if (!artifactOut.isEmpty()) {
+        details += QString(" (Artifact out: %1)").arg(artifactOut);}
+    if (!artifactIn.isEmpty()) {
+        details += QString(" (Artifact in: %1)").arg(artifactIn);}
+    if (fileCapture.isValid()) {
+        details += QString(" (Output to: %1)").arg(fileCapture.path);}
+    if (launch.direct) {
+        details += QString(" (Exec: %1)").arg(launch.program);}
+    if (!details.isEmpty()) {
+        line += details;}
+    return line;}
+
+void WorkflowPlan::buildSummary() {
+    summary.clear();
+    const QList<QPair<QString, const QList<WorkflowCmd> *>> sections = {
+        {QString(), &steps}, {QStringLiteral("[onFailure] "), &onFailure}, {QStringLiteral("[finally] "), &finally}};
+    for (const auto &section : sections) {
+        for (const WorkflowCmd &cmd : *section.second) summary.append(section.first + cmd.describe());}}
+
+QString ExecutableCache::resolve(const QString &name) {
+    static QMutex mutex;
+    static QHash<QString, QString> cache;
+    static QByteArray cachedPath;
+    const QMutexLocker locker(&mutex);
+    const QByteArray path = qgetenv("PATH");
+    if (path != cachedPath) {
+        cache.clear();
+        cachedPath = path;}
+    const auto it = cache.constFind(name);
+    if (it != cache.cend()) return it.value();
+    QString resolved;
+    if (name.contains(QLatin1Char('/'))) {
+        const QFileInfo info(name);
+        if (info.isFile() && info.isExecutable()) resolved = info.absoluteFilePath();
+    } else {
+        resolved = QStandardPaths::findExecutable(name);}
+    cache.insert(name, resolved);
+    return resolved;}
+
+namespace {
+struct CachedPlan {
+    qint64 size = 0;
+    QDateTime modified;
+    QByteArray hash;
+    QByteArray searchPath;
+    std::shared_ptr<const WorkflowPlan> plan;
+};
+
+QMutex planCacheMutex;
+
+QCache<QString, CachedPlan> &planCache() {
+    static QCache<QString, CachedPlan> cache(WorkflowPlanCache::MaxEntries);
+    return cache;}
+
+CachedPlan *cachedPlan(const QFileInfo &file) {
+    CachedPlan *entry = planCache().object(file.absoluteFilePath());
+    return entry && entry->searchPath == qgetenv("PATH") ? entry : nullptr;}
+
+QByteArray contentHash(const QByteArray &content) {
+    return content.isEmpty() ? QByteArray() : QCryptographicHash::hash(content, QCryptographicHash::Sha1);}
+}
+
+std::shared_ptr<const WorkflowPlan> WorkflowPlanCache::lookup(const QFileInfo &file) {
+    const QMutexLocker locker(&planCacheMutex);
+    const CachedPlan *entry = cachedPlan(file);
+    if (!entry || entry->size != file.size() || entry->modified != file.lastModified()) return nullptr;
+    return entry->plan;}
+
+std::shared_ptr<const WorkflowPlan> WorkflowPlanCache::revalidate(const QFileInfo &file, const QByteArray &content) {
+    const QByteArray hash = contentHash(content);
+    const QMutexLocker locker(&planCacheMutex);
+    CachedPlan *entry = cachedPlan(file);
+    if (!entry || entry->hash.isEmpty() || entry->size != content.size() || entry->hash != hash) return nullptr;
+    entry->modified = file.lastModified();
+    return entry->plan;}
+
+void WorkflowPlanCache::insert(const QFileInfo &file, const QByteArray &content, std::shared_ptr<const WorkflowPlan> plan) {
+    auto entry = new CachedPlan;
+    entry->size = file.size();
+    entry->modified = file.lastModified();
+    entry->hash = contentHash(content);
+    entry->searchPath = qgetenv("PATH");
+    entry->plan = std::move(plan);
+    const QMutexLocker locker(&planCacheMutex);
+    planCache().insert(file.absoluteFilePath(), entry);}
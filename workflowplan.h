@@ -0,0 +1,144 @@
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QHash>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QJsonObject>
+#include <QJsonValue>
+#include <QRegularExpression>
+#include <memory>
+#include <optional>
+#include "readinessprobe.h"
+#include "matrixrunner.h"
+#include "commandtemplate.h"
+#include "expression.h"
+#include "outputcapture.h"
+
+struct WorkflowCmd;
+
+// How a step is started, worked out once when the workflow is loaded.
+// Steps without placeholders that are not run as root get a ready argv:
+// plain "program arg..." commands are executed directly with the program
+// resolved through ExecutableCache, anything else becomes bash -c.
+struct LaunchSpec {
+    QString program;        // empty: expand the template and use runShellCommand()
+    QStringList args;
+    bool direct = false;    // program is the command itself, no shell in between
+    QString logLine;        // ">>> user: ..."; empty when it depends on placeholders
+    static LaunchSpec forStep(const WorkflowCmd &cmd);
+};
+
+// "captureToFile": the child writes straight to disk; the log only gets a
+// bounded preview read back once the step ends.
+struct FileCaptureSpec {
+    QString path;
+    QString stderrPath;     // empty: stderr is merged into path
+    bool append = false;
+    int previewBytes = 2048;
+    bool isValid() const { return !path.isEmpty(); }
+};
+
+// The keys of one step object, set one at a time as the JSON reader meets
+// them; WorkflowCmd::compile() validates them into a step. Options that are
+// only checked for presence are optional / Undefined when absent.
+struct WorkflowStepKeys {
+    QString id;
+    QString command;
+    int delayAfterMs = 0;
+    bool runAsRoot = false;
+    bool stopOnError = true;
+    int waitTimeoutMs = 60000;
+    std::optional<QString> waitForFile;
+    QJsonValue waitForPort{QJsonValue::Undefined};
+    QJsonValue waitForProcessExit{QJsonValue::Undefined};
+    std::optional<QString> waitForOutputLine;
+    std::optional<QString> runIf;
+    std::optional<QString> runUnless;
+    QJsonValue forEach{QJsonValue::Undefined};
+    int maxParallel = 4;
+    std::optional<QString> backend;
+    QString pipeFrom;
+    QString artifactOut;
+    QString artifactIn;
+    QJsonValue captureToFile{QJsonValue::Undefined};
+    QJsonValue captureAs{QJsonValue::Undefined};
+    void set(const QString &key, const QJsonValue &value);   // unknown keys are ignored
+};
+
+struct WorkflowCmd {
+    QString id;
+    QString command;
+    CommandTemplate commandTemplate;
+    int delayAfterMs = 0;
+    bool runAsRoot = false;
+    bool stopOnError = true;
+    QList<ReadinessWait> waits;     // preconditions checked before the command starts
+    QRegularExpression readyLine;   // waitForOutputLine: step is done once a line matches
+    int waitTimeoutMs = 60000;
+    MatrixSpec matrix;              // forEach: fan the command out over a list
+    bool captureOutput = false;     // a later forEach reads this step's stdout lines
+    Expression runIf;               // "if": step runs only when true
+    Expression runUnless;           // "unless": step is skipped when true
+    OutputCapture capture;          // "captureAs": stdout -> workflow variable
+    QString pipeFrom;               // id of the previous step whose stdout feeds this stdin
+    QString artifactOut;            // stdout goes into this named in-memory artifact
+    QString artifactIn;             // stdin is read from this artifact
+    QStringList artifactsUsed;      // artifactIn plus {{artifact:NAME}} references
+    FileCaptureSpec fileCapture;
+    LaunchSpec launch;
+    bool hasReadyLine() const { return !readyLine.pattern().isEmpty(); }
+    bool isPiped() const { return !pipeFrom.isEmpty(); }
+    bool isMatrix() const { return matrix.source != MatrixSpec::None; }
+    // forEach, waitForOutputLine, captureAs, artifacts and empty commands cannot feed a pipe.
+    bool canFeedPipe() const;
+    // One display line: the command followed by its options.
+    QString describe() const;
+    static bool compile(const WorkflowStepKeys &keys, WorkflowCmd *cmd, QString *error);
+};
+
+// Everything compiled from one workflow file. Never modified once built: a run
+// keeps the plan it started with, interval repetitions reuse it as is, and a
+// reload publishes a new one.
+struct WorkflowPlan {
+    QList<WorkflowCmd> steps;
+    QList<WorkflowCmd> onFailure;
+    QList<WorkflowCmd> finally;
+    QHash<QString, int> artifactConsumers;
+    qint64 artifactQuotaMB = 2048;
+    int priority = 0;
+    int intervalS = 0;
+    QStringList summary;            // one display line per loaded step, for "Show JSON"
+    // Streamed workflows (see WorkflowStream): the main steps stay in the file
+    // and only their record offsets are kept; steps above is empty.
+    QString streamPath;
+    QList<qint64> streamOffsets;    // record i spans [offsets[i], offsets[i + 1])
+    qint64 streamSize = 0;          // the indexed file, to tell whether it changed since
+    QDateTime streamModified;
+    bool isStreamed() const { return !streamPath.isEmpty(); }
+    qint64 stepCount() const { return isStreamed() ? streamOffsets.count() - 1 : steps.count(); }
+    void buildSummary();
+};
+
+// Bare program names resolved against PATH, once per name until PATH changes.
+// Thread-safe; workflows are compiled on worker threads.
+class ExecutableCache {
+public:
+    static QString resolve(const QString &name);
+};
+
+// Compiled plans of recently loaded files, so loading a file that did not
+// change costs a stat() instead of a parse. An entry is reused while size and
+// mtime match; when only the mtime moved, an equal content hash revalidates
+// it. Plans compiled under another PATH are not reused, since their launches
+// hold resolved program paths. Thread-safe.
+class WorkflowPlanCache {
+public:
+    static constexpr int MaxEntries = 128;
+    static std::shared_ptr<const WorkflowPlan> lookup(const QFileInfo &file);
+    static std::shared_ptr<const WorkflowPlan> revalidate(const QFileInfo &file, const QByteArray &content);
+    // An empty content (streamed files) is only ever matched by size and mtime.
+    static void insert(const QFileInfo &file, const QByteArray &content, std::shared_ptr<const WorkflowPlan> plan);
+};
@@ -0,0 +1,227 @@
+#include "workflowqueue.h"
+#include "commandexecutor.h"
+#include "sequencerunner.h"
+#include <QTimer>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QFutureWatcher>
+#include <QtConcurrent/QtConcurrentMap>
+
+namespace {
+// Steps whose display line differs, plus those added or removed.
+int changedSteps(const WorkflowPlan &previous, const WorkflowPlan &plan) {
+    const int common = int(qMin(previous.summary.count(), plan.summary.count()));
+    int changed = int(qAbs(previous.summary.count() - plan.summary.count()));
+    for (int i = 0; i < common; ++i) {
+        if (previous.summary.at(i) != plan.summary.at(i)) changed++;}
+    return changed;}
+}
+
+QString WorkflowJob::stateText() const {
+    switch (state) {
+    case Idle: return "Idle";
+    case Queued: return "Queued";
+    case Running: return "Running";
+    case Scheduled: return "Scheduled";}
+    return QString();}
+
+WorkflowQueue::WorkflowQueue(QObject *parent) : QObject(parent) {
+    m_watcher = new QFileSystemWatcher(this);
+    m_reloadTimer = new QTimer(this);
+    m_reloadTimer->setSingleShot(true);
+    m_reloadTimer->setInterval(ReloadDelayMs);
+    connect(m_reloadTimer, &QTimer::timeout, this, &WorkflowQueue::reloadChangedFiles);
+    connect(m_watcher, &QFileSystemWatcher::fileChanged, this, [this](const QString &path){
+        m_changedFiles.insert(path);
+        m_reloadTimer->start();});
+    // Editors and config pushes often replace the file by a rename, which
+    // drops it from the watcher; its directory sees the new one.
+    connect(m_watcher, &QFileSystemWatcher::directoryChanged, this, [this](const QString &dir){
+        const QStringList watched = m_watcher->files();
+        for (const WorkflowJob *job : m_jobs) {
+            const QFileInfo info(job->filePath);
+            if (info.absolutePath() == dir && !watched.contains(info.absoluteFilePath()) && info.exists()) {
+                m_changedFiles.insert(info.absoluteFilePath());}}
+        if (!m_changedFiles.isEmpty()) m_reloadTimer->start();});}
+
+WorkflowQueue::~WorkflowQueue() {
+    for (WorkflowJob *job : m_jobs) {
+        job->runner->disconnect(this);
+        job->executor->disconnect(this);
+        delete job->runner;
+        delete job->executor;}
+    qDeleteAll(m_jobs);}
+
+int WorkflowQueue::addJob(const QString &filePath) {
+    return addJob(WorkflowLoader::load(filePath));}
+
+int WorkflowQueue::addJob(const WorkflowLoader::Result &loaded) {
+    auto job = new WorkflowJob;
+    job->id = m_nextId;
+    job->filePath = loaded.path;
+    job->name = QFileInfo(loaded.path).completeBaseName();
+    job->executor = new CommandExecutor(this);
+    job->runner = new SequenceRunner(job->executor, this);
+    job->timer = new QTimer(this);
+    job->timer->setSingleShot(true);
+    connect(job->runner, &SequenceRunner::logMessage, this, [this, job](const QString &text, const QString &color){
+        emit logMessage(QString("[%1] %2").arg(job->name, text), color);});
+    if (!job->runner->setPlan(loaded)) {
+        job->runner->deleteLater();
+        job->executor->deleteLater();
+        job->timer->deleteLater();
+        delete job;
+        return -1;}
+    m_nextId++;
+    job->priority = job->runner->priority();
+    if (job->runner->scheduleInterval() > 0) {
+        job->intervalS = job->runner->scheduleInterval();
+        job->runner->setIntervalValue(job->intervalS);
+        job->runner->setIntervalToggle(true);}
+    connect(job->runner, &SequenceRunner::sequenceStarted, this, [this, job]{
+        setState(job, WorkflowJob::Running);
+        emit jobStarted(job->id);});
+    connect(job->runner, &SequenceRunner::sequenceFinished, this, [this, job](bool success){
+        if (!success) job->intervalS = 0;
+        setState(job, WorkflowJob::Idle);
+        emit jobFinished(job->id, success);
+        dispatch();});
+    connect(job->runner, &SequenceRunner::scheduleRestart, this, [this, job](int interval){
+        job->nextRun = QDateTime::currentDateTime().addSecs(interval);
+        job->timer->start(interval * 1000);
+        setState(job, WorkflowJob::Scheduled);});
+    connect(job->runner, &SequenceRunner::commandExecuting, this, [this, job](const QString &cmd, int index, int total){
+        emit commandExecuting(job->name, cmd, index, total);});
+    connect(job->runner, &SequenceRunner::outputReceived, this, [this, job](const QString &text){
+        emit jobOutput(job->name, text);});
+    connect(job->runner, &SequenceRunner::errorReceived, this, [this, job](const QString &text){
+        emit jobError(job->name, text);});
+    const int id = job->id;
+    connect(job->timer, &QTimer::timeout, this, [this, id]{ enqueue(id); });
+    m_jobs.insert(id, job);
+    watchFiles();
+    emit jobsChanged();
+    return id;}
+
+void WorkflowQueue::removeJob(int id) {
+    WorkflowJob *job = m_jobs.value(id, nullptr);
+    if (!job) return;
+    stopJob(id);
+    m_jobs.remove(id);
+    job->runner->disconnect(this);
+    job->executor->disconnect(this);
+    job->timer->disconnect(this);
+    job->runner->deleteLater();
+    job->executor->deleteLater();
+    job->timer->deleteLater();
+    delete job;
+    watchFiles();
+    emit jobsChanged();
+    dispatch();}
+
+void WorkflowQueue::enqueue(int id) {
+    WorkflowJob *job = m_jobs.value(id, nullptr);
+    if (!job) return;
+    if (job->state == WorkflowJob::Running || job->state == WorkflowJob::Queued) {
+        emit logMessage(QString("[%1] Workflow is already %2.").arg(job->name, job->stateText().toLower()), "#FFAA66");
+        return;}
+    job->timer->stop();
+    m_pending.append(id);
+    setState(job, WorkflowJob::Queued);
+    if (runningCount() >= m_maxConcurrent) {
+        emit logMessage(QString("[%1] Queued: %2 of %3 workflow slots busy.").arg(job->name).arg(runningCount()).arg(m_maxConcurrent), "#BDBDBD");}
+    dispatch();}
+
+void WorkflowQueue::stopJob(int id) {
+    WorkflowJob *job = m_jobs.value(id, nullptr);
+    if (!job) return;
+    m_pending.removeAll(id);
+    job->timer->stop();
+    job->intervalS = 0;
+    job->runner->setIntervalToggle(false);
+    if (job->runner->isRunning()) job->runner->stopSequence(true);
+    setState(job, WorkflowJob::Idle);}
+
+void WorkflowQueue::stopAll() {
+    for (int id : m_jobs.keys()) stopJob(id);}
+
+void WorkflowQueue::setPriority(int id, int priority) {
+    WorkflowJob *job = m_jobs.value(id, nullptr);
+    if (!job || job->priority == priority) return;
+    job->priority = priority;
+    emit jobStateChanged(id);}
+
+void WorkflowQueue::setInterval(int id, int seconds) {
+    WorkflowJob *job = m_jobs.value(id, nullptr);
+    if (!job || job->intervalS == seconds) return;
+    job->intervalS = seconds;
+    if (seconds > 0) job->runner->setIntervalValue(seconds);
+    job->runner->setIntervalToggle(seconds > 0);
+    if (seconds == 0 && job->state == WorkflowJob::Scheduled) {
+        job->timer->stop();
+        setState(job, WorkflowJob::Idle);
+    } else {
+        emit jobStateChanged(id);}}
+
+void WorkflowQueue::setMaxConcurrent(int count) {
+    m_maxConcurrent = qMax(1, count);
+    dispatch();}
+
+int WorkflowQueue::runningCount() const {
+    int count = 0;
+    for (const WorkflowJob *job : m_jobs) {
+        if (job->runner->isRunning()) count++;}
+    return count;}
+
+void WorkflowQueue::dispatch() {
+    while (!m_pending.isEmpty() && runningCount() < m_maxConcurrent) {
+        int best = 0;
+        for (int i = 1; i < m_pending.count(); ++i) {
+            if (m_jobs.value(m_pending.at(i))->priority > m_jobs.value(m_pending.at(best))->priority) best = i;}
+        WorkflowJob *job = m_jobs.value(m_pending.takeAt(best));
+        job->runner->startSequence();
+        if (!job->runner->isRunning() && job->state == WorkflowJob::Queued) {
+            setState(job, WorkflowJob::Idle);}}}
+
+void WorkflowQueue::setState(WorkflowJob *job, WorkflowJob::State state) {
+    job->state = state;
+    if (state != WorkflowJob::Scheduled) job->nextRun = QDateTime();
+    emit jobStateChanged(job->id);}
+
+// The watch list follows the jobs: their files and the directories holding them.
+void WorkflowQueue::watchFiles() {
+    QSet<QString> wanted;
+    for (const WorkflowJob *job : m_jobs) {
+        const QFileInfo info(job->filePath);
+        wanted.insert(info.absolutePath());
+        if (info.exists()) wanted.insert(info.absoluteFilePath());}
+    const QStringList watched = m_watcher->files() + m_watcher->directories();
+    for (const QString &path : watched) {
+        if (!wanted.remove(path)) m_watcher->removePath(path);}
+    if (!wanted.isEmpty()) m_watcher->addPaths(QStringList(wanted.cbegin(), wanted.cend()));}
+
+void WorkflowQueue::reloadChangedFiles() {
+    const QStringList paths(m_changedFiles.cbegin(), m_changedFiles.cend());
+    m_changedFiles.clear();
+    watchFiles();
+    auto *watcher = new QFutureWatcher<WorkflowLoader::Result>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher]{
+        watcher->deleteLater();
+        applyReloaded(watcher->future().results());});
+    watcher->setFuture(QtConcurrent::mapped(paths, [](const QString &path) { return WorkflowLoader::load(path); }));}
+
+void WorkflowQueue::applyReloaded(const QList<WorkflowLoader::Result> &results) {
+    for (const WorkflowLoader::Result &result : results) {
+        for (WorkflowJob *job : m_jobs) {
+            if (QFileInfo(job->filePath).absoluteFilePath() != result.path) continue;
+            const std::shared_ptr<const WorkflowPlan> previous = job->runner->plan();
+            if (!result.plan) {
+                emit logMessage(QString("[%1] Reload failed, keeping the loaded steps: %2").arg(job->name, result.message), "#F44336");
+                continue;}
+            // Touched but unchanged files come back from the plan cache as the same plan.
+            if (result.plan == previous) continue;
+            job->runner->setPlan(result);
+            if (previous && !previous->isStreamed() && !result.plan->isStreamed()) {
+                emit logMessage(QString("[%1] Reloaded: %2 of %3 steps changed.").arg(job->name).arg(changedSteps(*previous, *result.plan)).arg(result.plan->summary.count()), "#BDBDBD");}
+            emit planReplaced(job->id, previous.get(), result.plan);
+            emit jobStateChanged(job->id);}}}
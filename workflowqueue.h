@@ -0,0 +1,82 @@
+#pragma once
+
+#include <QObject>
+#include <QMap>
+#include <QList>
+#include <QDateTime>
+#include <QSet>
+#include <QString>
+#include "workflowloader.h"
+
+class CommandExecutor;
+class SequenceRunner;
+class QTimer;
+class QFileSystemWatcher;
+
+struct WorkflowJob {
+    enum State { Idle, Queued, Running, Scheduled };
+    int id = 0;
+    QString filePath;
+    QString name;
+    int priority = 0;     // higher value is dispatched first
+    int intervalS = 0;    // restart interval after a successful run, 0 = run once
+    State state = Idle;
+    QDateTime nextRun;
+    CommandExecutor *executor = nullptr;
+    SequenceRunner *runner = nullptr;
+    QTimer *timer = nullptr;
+    QString stateText() const;
+};
+
+// Every loaded workflow file is an independent job with its own executor and runner.
+// Jobs waiting to run are dispatched by priority (FIFO within the same priority)
+// while fewer than maxConcurrent jobs are running.
+// Job files are watched: a file that changed and then stayed quiet for
+// ReloadDelayMs is loaded again on worker threads and its plan swapped in.
+// A running sequence finishes with the steps it started with; a file that no
+// longer loads keeps the previous plan.
+class WorkflowQueue : public QObject {
+    Q_OBJECT
+public:
+    static constexpr int ReloadDelayMs = 300;
+    explicit WorkflowQueue(QObject *parent = nullptr);
+    ~WorkflowQueue();
+    int addJob(const QString &filePath);
+    int addJob(const WorkflowLoader::Result &loaded);
+    void removeJob(int id);
+    void enqueue(int id);
+    void stopJob(int id);
+    void stopAll();
+    void setPriority(int id, int priority);
+    void setInterval(int id, int seconds);
+    void setMaxConcurrent(int count);
+    int maxConcurrent() const { return m_maxConcurrent; }
+    int runningCount() const;
+    QList<int> jobIds() const { return m_jobs.keys(); }
+    const WorkflowJob *job(int id) const { return m_jobs.value(id, nullptr); }
+
+signals:
+    void jobsChanged();
+    void jobStateChanged(int id);
+    void jobStarted(int id);
+    void jobFinished(int id, bool success);
+    void commandExecuting(const QString &job, const QString &cmd, int index, int total);
+    void jobOutput(const QString &job, const QString &text);
+    void jobError(const QString &job, const QString &text);
+    void logMessage(const QString &text, const QString &color);
+    void planReplaced(int id, const WorkflowPlan *previous, std::shared_ptr<const WorkflowPlan> plan);
+
+private:
+    QMap<int, WorkflowJob *> m_jobs;
+    QList<int> m_pending;
+    int m_nextId = 1;
+    int m_maxConcurrent = 4;
+    QFileSystemWatcher *m_watcher = nullptr;
+    QTimer *m_reloadTimer = nullptr;
+    QSet<QString> m_changedFiles;
+    void dispatch();
+    void setState(WorkflowJob *job, WorkflowJob::State state);
+    void watchFiles();
+    void reloadChangedFiles();
+    void applyReloaded(const QList<WorkflowLoader::Result> &results);
+};
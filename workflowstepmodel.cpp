@@ -0,0 +1,95 @@
+#include "workflowstepmodel.h"
+#include "workflowstream.h"
+#include <algorithm>
+
+namespace {
+constexpr int HeaderRows = 2;      // title and a blank line
+constexpr int FooterRows = 1;
+}
+
+WorkflowStepModel::WorkflowStepModel(QObject *parent)
+    : QAbstractListModel(parent), m_rendered(4096) {}
+
+void WorkflowStepModel::addWorkflow(const QString &name, std::shared_ptr<const WorkflowPlan> plan) {
+    if (!plan) return;
+    Section section;
+    section.name = name;
+    section.firstRow = m_rows;
+    section.plan = std::move(plan);
+    openStream(&section);
+    const int rows = rowsOf(section);
+    beginInsertRows(QModelIndex(), m_rows, m_rows + rows - 1);
+    m_sections.push_back(std::move(section));
+    m_rows += rows;
+    endInsertRows();}
+
+void WorkflowStepModel::replaceWorkflow(const WorkflowPlan *previous, std::shared_ptr<const WorkflowPlan> plan) {
+    if (!plan) return;
+    for (std::size_t i = 0; i < m_sections.size(); ++i) {
+        Section &section = m_sections[i];
+        if (section.plan.get() != previous) continue;
+        const int before = rowsOf(section);
+        int same = 0;
+        if (!previous->isStreamed() && !plan->isStreamed()) {
+            while (same < previous->summary.count() && same < plan->summary.count()
+                   && previous->summary.at(same) == plan->summary.at(same)) {
+                same++;}}
+        section.plan = plan;
+        openStream(&section);
+        const int after = rowsOf(section);
+        m_rendered.clear();
+        // Rows come and go just above the footer; the rows in between are
+        // rendered from the new plan either way.
+        const int footer = section.firstRow + before - FooterRows;
+        if (after > before) beginInsertRows(QModelIndex(), footer, footer + after - before - 1);
+        else if (after < before) beginRemoveRows(QModelIndex(), footer - (before - after), footer - 1);
+        for (std::size_t j = i + 1; j < m_sections.size(); ++j) m_sections[j].firstRow += after - before;
+        m_rows += after - before;
+        if (after > before) endInsertRows();
+        else if (after < before) endRemoveRows();
+        emit dataChanged(index(section.firstRow), index(section.firstRow));
+        const int first = section.firstRow + HeaderRows + same;
+        const int last = section.firstRow + after - FooterRows - 1;
+        if (first <= last) emit dataChanged(index(first), index(last));}}
+
+int WorkflowStepModel::rowCount(const QModelIndex &parent) const {
+    return parent.isValid() ? 0 : m_rows;}
+
+QVariant WorkflowStepModel::data(const QModelIndex &index, int role) const {
+    if (role != Qt::DisplayRole || !index.isValid() || index.row() >= m_rows) return QVariant();
+    const int row = index.row();
+    if (const QString *text = m_rendered.object(row)) return *text;
+    const auto it = std::upper_bound(m_sections.begin(), m_sections.end(), row,
+                                     [](int r, const Section &s) { return r < s.firstRow; }) - 1;
+    QString *text = new QString(render(*it, row - it->firstRow));
+    m_rendered.insert(row, text);
+    return *text;}
+
+int WorkflowStepModel::rowsOf(const Section &section) {
+    return HeaderRows + section.streamed + int(section.plan->summary.count()) + FooterRows;}
+
+void WorkflowStepModel::openStream(Section *section) {
+    section->streamed = 0;
+    section->file.reset();
+    if (!section->plan->isStreamed()) return;
+    section->streamed = int(section->plan->stepCount());
+    section->file = std::make_unique<QFile>();
+    QString error;
+    if (!WorkflowStream::openIndexed(*section->plan, section->file.get(), &error)) section->file.reset();}
+
+QString WorkflowStepModel::render(const Section &section, int offset) const {
+    const int steps = section.streamed + section.plan->summary.count();
+    if (offset == 0) return QString("--- %1: TOTAL COMMANDS: %2 ---").arg(section.name).arg(steps);
+    const int step = offset - HeaderRows;
+    if (step < 0 || step >= steps) return QString();
+    QString line;
+    if (step >= section.streamed) {
+        line = section.plan->summary.at(step - section.streamed);
+    } else if (!section.file) {
+        line = QString("<cannot read %1>").arg(section.plan->streamPath);
+    } else {
+        WorkflowCmd cmd;
+        QString error;
+        line = WorkflowStream::readStep(section.file.get(), section.plan->streamOffsets, step, &cmd, &error)
+                   ? cmd.describe() : QString("<invalid step: %1>").arg(error);}
+    return QString("[%1] %2").arg(step + 1, 2, 10, QChar('0')).arg(line);}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <QAbstractListModel>
+#include <QCache>
+#include <QFile>
+#include <memory>
+#include <vector>
+#include "workflowplan.h"
+
+// Rows of the "Show JSON" dialog: per workflow a header, one line per step and
+// a blank separator. Streamed steps are read from the file and formatted only
+// when the view asks for them, and only the last few thousand are kept.
+class WorkflowStepModel : public QAbstractListModel {
+    Q_OBJECT
+public:
+    explicit WorkflowStepModel(QObject *parent = nullptr);
+    void addWorkflow(const QString &name, std::shared_ptr<const WorkflowPlan> plan);
+    // Swaps a reloaded plan into the sections showing previous; only rows
+    // from the first changed step on are updated, so the view keeps its place.
+    void replaceWorkflow(const WorkflowPlan *previous, std::shared_ptr<const WorkflowPlan> plan);
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+private:
+    struct Section {
+        QString name;
+        std::shared_ptr<const WorkflowPlan> plan;
+        std::unique_ptr<QFile> file;    // streamed plans only
+        int firstRow = 0;
+        int streamed = 0;               // steps read from file, shown before plan->summary
+    };
+    std::vector<Section> m_sections;
+    int m_rows = 0;
+    mutable QCache<int, QString> m_rendered;
+    QString render(const Section &section, int offset) const;
+    static int rowsOf(const Section &section);
+    static void openStream(Section *section);
+};
@@ -0,0 +1,163 @@
+#include "workflowstream.h"
+#include "jsonio.h"
+#include <QFileInfo>
+
+namespace {
+constexpr qint64 ScanChunk = 1 << 20;
+
+bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+// Record starts of an NDJSON file: every line with something on it.
+void scanLines(QFile *file, QList<qint64> *offsets) {
+    qint64 pos = 0;
+    qint64 lineStart = 0;
+    bool content = false;
+    QByteArray chunk;
+    while (!(chunk = file->read(ScanChunk)).isEmpty()) {
+        const char *p = chunk.constData();
+        for (qsizetype i = 0; i < chunk.size(); ++i) {
+            if (p[i] == '\n') {
+                if (content) offsets->append(lineStart);
+                content = false;
+                lineStart = pos + i + 1;
+            } else if (!content && !isSpace(p[i])) {
+                content = true;}}
+        pos += chunk.size();}
+    if (content) offsets->append(lineStart);
+    offsets->append(pos);}
+
+// Object starts of a top-level array; the final entry is the closing bracket.
+bool scanArray(QFile *file, QList<qint64> *offsets, QString *error) {
+    qint64 pos = 0;
+    int depth = 0;
+    bool inString = false;
+    bool escape = false;
+    bool closed = false;
+    QByteArray chunk;
+    while (!(chunk = file->read(ScanChunk)).isEmpty()) {
+        const char *p = chunk.constData();
+        for (qsizetype i = 0; i < chunk.size(); ++i) {
+            const char c = p[i];
+            if (inString) {
+                if (escape) escape = false;
+                else if (c == '\\') escape = true;
+                else if (c == '"') inString = false;
+                continue;}
+            if (closed || depth == 0) {
+                if (!closed && c == '[') {
+                    depth = 1;
+                } else if (!isSpace(c)) {
+                    *error = closed ? QString("unexpected data after the step array at byte %1").arg(pos + i)
+                                    : QString("a streamed workflow must be NDJSON or a JSON array");
+                    return false;}
+                continue;}
+            if (depth == 1 && !isSpace(c) && c != ',' && c != '{' && c != ']') {
+                *error = QString("only step objects may appear in the step array (byte %1)").arg(pos + i);
+                return false;}
+            switch (c) {
+            case '"':
+                inString = true;
+                break;
+            case '{':
+            case '[':
+                if (depth == 1) offsets->append(pos + i);
+                depth++;
+                break;
+            case '}':
+            case ']':
+                if (--depth == 0) {
+                    offsets->append(pos + i);
+                    closed = true;}
+                break;
+            default:
+                break;}}
+        pos += chunk.size();}
+    if (!closed) {
+        *error = "the step array is not terminated";
+        return false;}
+    return true;}
+}
+
+bool WorkflowStream::isLineFormat(const QString &path) {
+    const QString suffix = QFileInfo(path).suffix().toLower();
+    return suffix == u"ndjson" || suffix == u"jsonl";}
+
+bool WorkflowStream::wantsStreaming(const QString &path) {
+    if (isLineFormat(path)) return true;
+    QFile file(path);
+    if (file.size() <= ArrayThreshold || !file.open(QIODevice::ReadOnly)) return false;
+    const QByteArray head = file.read(4096).trimmed();
+    return head.startsWith('[');}
+
+bool WorkflowStream::index(const QString &path, WorkflowPlan *plan, QString *error) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        *error = file.errorString();
+        return false;}
+    // Taken before the scan, so a write during it is caught by openIndexed().
+    const qint64 size = file.size();
+    const QDateTime modified = file.fileTime(QFileDevice::FileModificationTime);
+    QList<qint64> offsets;
+    if (!isLineFormat(path)) {
+        if (!scanArray(&file, &offsets, error)) return false;
+    } else {
+        scanLines(&file, &offsets);}
+    plan->streamPath = QFileInfo(path).absoluteFilePath();
+    plan->streamOffsets = std::move(offsets);
+    plan->streamSize = size;
+    plan->streamModified = modified;
+    return true;}
+
+// Size and mtime are read from the open handle, so a file replaced between
+// the check and the reads is still the one checked.
+bool WorkflowStream::openIndexed(const WorkflowPlan &plan, QFile *file, QString *error) {
+    file->setFileName(plan.streamPath);
+    if (!file->open(QIODevice::ReadOnly)) {
+        *error = file->errorString();
+        return false;}
+    if (file->size() != plan.streamSize || file->fileTime(QFileDevice::FileModificationTime) != plan.streamModified) {
+        file->close();
+        *error = QString("%1 changed since it was loaded; load it again").arg(plan.streamPath);
+        return false;}
+    return true;}
+
+bool WorkflowStream::readRecord(QFile *file, const QList<qint64> &offsets, qint64 index, QByteArray *record, QString *error) {
+    const qint64 start = offsets.at(index);
+    if (!file->seek(start)) {
+        *error = file->errorString();
+        return false;}
+    *record = file->read(offsets.at(index + 1) - start).trimmed();
+    while (record->endsWith(',')) {
+        record->chop(1);
+        *record = record->trimmed();}
+    return true;}
+
+bool WorkflowStream::readStep(QFile *file, const QList<qint64> &offsets, qint64 index, WorkflowCmd *cmd, QString *error) {
+    QByteArray record;
+    return readRecord(file, offsets, index, &record, error) && JsonIO::readStep(record, cmd, error);}
+
+bool WorkflowStream::open(QString *error) {
+    return openIndexed(*m_plan, &m_file, error);}
+
+void WorkflowStream::discard(int count) {
+    m_window.remove(0, qMin<qsizetype>(count, m_window.count()));
+    m_base += count;}
+
+bool WorkflowStream::fill(int index) {
+    const int target = m_window.count() <= index ? index + ReadAhead : index;
+    while (m_window.count() <= target && m_error.isEmpty() && m_next < m_plan->stepCount()) {
+        WorkflowCmd cmd;
+        QString error;
+        if (!readStep(&m_file, m_plan->streamOffsets, m_next, &cmd, &error)) {
+            m_error = QString("step %1: %2").arg(m_next + 1).arg(error);
+        } else if (cmd.matrix.source == MatrixSpec::StepOutput || !cmd.artifactOut.isEmpty() || !cmd.artifactsUsed.isEmpty()) {
+            m_error = QString("step %1: artifacts and forEach.fromStep are not supported in streamed workflows").arg(m_next + 1);
+        } else if (cmd.isPiped() && (cmd.pipeFrom != m_previousId || !m_previousFeedsPipe || cmd.command.trimmed().isEmpty())) {
+            m_error = QString("step %1: pipeFrom '%2' must name the step directly before it, and that step must be able to feed a pipe").arg(m_next + 1).arg(cmd.pipeFrom);
+        } else {
+            cmd.matrix.resolvePath(QFileInfo(m_plan->streamPath).absolutePath());
+            m_previousId = cmd.id;
+            m_previousFeedsPipe = cmd.canFeedPipe();
+            m_window.append(std::move(cmd));
+            m_next++;}}
+    return index < m_window.count();}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <QFile>
+#include <QList>
+#include <QString>
+#include <memory>
+#include "workflowplan.h"
+
+// Main steps of a streamed workflow, parsed only as the run reaches them.
+// Two formats are streamed:
+//   - NDJSON (*.ndjson, *.jsonl): one step object per line; an optional first
+//     line {"workflow": {...}} carries priority, intervalS, onFailure, finally
+//     (read by the loader, see JsonIO::readStreamHeader()).
+//   - a top-level JSON array of steps larger than ArrayThreshold.
+// index() scans the file once at load and keeps only where each step starts;
+// a run then holds the current step, its pipe partners and at most ReadAhead
+// parsed steps ahead. Artifacts and forEach.fromStep need the whole step list
+// and are rejected in streamed steps.
+class WorkflowStream {
+public:
+    static constexpr int ReadAhead = 32;
+    static constexpr qint64 ArrayThreshold = 16 * 1024 * 1024;
+
+    static bool wantsStreaming(const QString &path);
+    static bool isLineFormat(const QString &path);
+    // Fills plan->streamPath, plan->streamOffsets and the file's size and mtime.
+    static bool index(const QString &path, WorkflowPlan *plan, QString *error);
+    // Opens the indexed file read-only; fails if it is no longer the file
+    // index() saw, since its offsets would point into other data.
+    static bool openIndexed(const WorkflowPlan &plan, QFile *file, QString *error);
+    // Record index of an indexed file opened read-only, without surrounding
+    // whitespace and array commas; readStep() also parses it.
+    static bool readRecord(QFile *file, const QList<qint64> &offsets, qint64 index, QByteArray *record, QString *error);
+    static bool readStep(QFile *file, const QList<qint64> &offsets, qint64 index, WorkflowCmd *cmd, QString *error);
+
+    explicit WorkflowStream(std::shared_ptr<const WorkflowPlan> plan) : m_plan(std::move(plan)) {}
+    bool open(QString *error);
+    const QList<WorkflowCmd> &window() const { return m_window; }
+    qint64 base() const { return m_base; }    // step number of window()[0]
+    void discard(int count);
+    // Parses until window() holds index (or the file ends); false when it does not.
+    bool fill(int index);
+    const QString &error() const { return m_error; }
+
+private:
+    std::shared_ptr<const WorkflowPlan> m_plan;
+    QFile m_file;
+    QList<WorkflowCmd> m_window;
+    qint64 m_base = 0;
+    qint64 m_next = 0;
+    QString m_previousId;
+    bool m_previousFeedsPipe = false;
+    QString m_error;
+};